@@ -0,0 +1,651 @@
+/**
+ * @file bench.c
+ * @brief microbenchmarks of each layer of the filesystem: sectors, bitmaps,
+ *        inodes, directories and files. Each one reports its throughput and
+ *        the percentiles of its latency.
+ *
+ * The benchmarks run on an image built from a shape (see struct bench_shape)
+ * and a seed: the same arguments always build the same image, byte for byte,
+ * so that two versions of the code can be compared on the same disk. With
+ * -g, the image is only built, and kept.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+#include "mount.h"
+#include "error.h"
+#include "sector.h"
+#include "bmblock.h"
+#include "inode.h"
+#include "filev6.h"
+#include "direntv6.h"
+#include "journal.h"
+
+#define USAGE "bench [-g] [-o <image>] [-d <depth>] [-w <width>[,<width>...]] [-s <small files>]\n" \
+              "             [-b <big files>] [-n <samples>] [-r <seed>]"
+
+#define BENCH_MAX_WIDTHS 4            /* directory widths of an image */
+#define BENCH_SMALL_SIZE (6 * SECTOR_SIZE + 100) /* size of the small files: no indirection */
+#define BENCH_BIG_SIZE (256 * SECTOR_SIZE)     /* size of the big files: an indirection sector */
+#define BENCH_FILL_MAX 65536         /* bits of the bitmaps of the bitmap benchmarks */
+#define BENCH_BM_BATCH 16            /* bitmap operations per sample: a single one is too short to time */
+#define BENCH_MAX_WRITES 4096        /* samples of the write benchmarks, which fill the image */
+
+/* Shape of a generated image */
+struct bench_shape {
+	uint32_t depth;                       // directories on the path of the deepest files
+	uint32_t widths[BENCH_MAX_WIDTHS];    // entries of each of these directories: one tree per width
+	uint32_t nwidths;                     // number of widths
+	uint32_t nsmall;                      // small files, in /small
+	uint32_t nbig;                        // big files, in /big
+	uint64_t seed;                        // seed of the content of the files
+};
+
+/* What the benchmarks need to know about a generated image */
+struct bench_image {
+	struct unix_filesystem u;             // the mounted image
+	uint16_t *small;                      // inode numbers of the small files
+	uint16_t *big;                        // inode numbers of the big files
+	uint16_t ninodes;                     // number of inodes used
+};
+
+/**
+ * @brief next number of a pseudo-random sequence (xorshift64*), the same for the same seed
+ * @param state the state of the sequence (IN-OUT, never 0)
+ * @return the number
+ */
+static uint64_t bench_rand(uint64_t *state){
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * UINT64_C(2685821657736338717);
+}
+
+/**
+ * @brief current time, in nanoseconds
+ * @return the time of a monotonic clock
+ */
+static uint64_t bench_now(void){
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t)t.tv_sec * 1000000000u + (uint64_t)t.tv_nsec;
+}
+
+/**
+ * @brief compare two durations, for qsort
+ * @param a the first duration
+ * @param b the second duration
+ * @return <0, 0 or >0 as a is shorter than, as long as or longer than b
+ */
+static int bench_cmp(const void *a, const void *b){
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+/* A benchmarked operation: its i-th call, on its context; <0 on error */
+typedef int (*bench_op)(void *ctx, uint32_t i);
+
+/**
+ * @brief time an operation and print its throughput and the percentiles of its latency
+ * @param name the name of the benchmark
+ * @param op the operation
+ * @param ctx its context
+ * @param nsamples the number of samples
+ * @param batch the number of calls of each sample (the latency is per call)
+ * @return 0 on success; <0 if an operation failed
+ */
+static int bench_run(const char *name, bench_op op, void *ctx, uint32_t nsamples, uint32_t batch){
+	uint64_t *ns = calloc(nsamples, sizeof(uint64_t));
+	if(ns == NULL) return ERR_NOMEM;
+
+	uint64_t total = 0;
+	int err = 0;
+	for(uint32_t s = 0; s < nsamples && err == 0; ++s){
+		uint64_t start = bench_now();
+		for(uint32_t b = 0; b < batch && err >= 0; ++b) err = op(ctx, s * batch + b);
+		ns[s] = (bench_now() - start) / batch;
+		total += ns[s] * batch;
+		if(err > 0) err = 0;
+	}
+	if(err < 0){
+		printf("%-36s failed: %s\n", name, ERR_MESSAGES[err - ERR_FIRST]);
+		free(ns);
+		return err;
+	}
+
+	qsort(ns, nsamples, sizeof(uint64_t), bench_cmp);
+	double ops = total > 0 ? (double)nsamples * batch * 1e9 / (double)total : 0;
+	printf("%-36s %12.0f %9" PRIu64 " %9" PRIu64 " %9" PRIu64 " %9" PRIu64 "\n", name, ops,
+	       ns[nsamples / 2], ns[nsamples * 90 / 100], ns[nsamples * 99 / 100], ns[nsamples - 1]);
+	free(ns);
+	return 0;
+}
+
+/**
+ * @brief fill a file with pseudo-random bytes
+ * @param u the filesystem
+ * @param inr the inode number of the file, empty
+ * @param size the number of bytes
+ * @param seed the seed of the bytes
+ * @return 0 on success; <0 on error
+ */
+static int bench_fill(struct unix_filesystem *u, uint16_t inr, int32_t size, uint64_t seed){
+	struct filev6 fv6;
+	int err = filev6_open(u, inr, &fv6);
+	uint8_t buf[SECTOR_SIZE];
+	for(int32_t done = 0; done < size && err == 0; done += SECTOR_SIZE){
+		for(int i = 0; i < SECTOR_SIZE; i += 8){
+			uint64_t r = bench_rand(&seed);
+			memcpy(buf + i, &r, 8);
+		}
+		int len = size - done < SECTOR_SIZE ? size - done : SECTOR_SIZE;
+		err = filev6_writebytes(u, &fv6, buf, len);
+	}
+	return err;
+}
+
+/**
+ * @brief create a file or a directory in a directory
+ * @param u the filesystem
+ * @param parent the inode number of the directory
+ * @param name the name of the entry
+ * @param mode 0 or IFDIR
+ * @return the inode number of the entry; <0 on error
+ */
+static int bench_create(struct unix_filesystem *u, int parent, const char *name, uint16_t mode){
+	if(parent < 0) return parent;
+	return direntv6_create_in(u, (uint16_t)parent, name, strlen(name), mode);
+}
+
+/**
+ * @brief number of inodes of an image of a given shape
+ * @param shape the shape
+ * @return the number of inodes, with room for the files of the write benchmarks
+ */
+static uint32_t bench_inodes(const struct bench_shape *shape){
+	uint32_t n = ROOT_INUMBER + 3 + shape->nsmall + shape->nbig;
+	for(uint32_t w = 0; w < shape->nwidths; ++w) n += 1 + shape->depth * shape->widths[w];
+	return n + BENCH_MAX_WRITES / 8 + BENCH_MAX_WRITES / 256 + 2 * INODES_PER_SECTOR;
+}
+
+/**
+ * @brief build an image of a given shape, always the same for the same shape:
+ *        /w<width>/d/d/.../f<i> for each width (depth directories of width entries each),
+ *        /small/s<i> and /big/b<i> with pseudo-random content; all the dates are 0
+ * @param filename the image file, created or overwritten
+ * @param shape the shape
+ * @return 0 on success; <0 on error
+ */
+static int bench_generate(const char *filename, const struct bench_shape *shape){
+	uint32_t ninodes = bench_inodes(shape);
+	//mkfs wants a sector per inode, and JOURNAL_MIN_DATA past the journal; then the data, and room for the write benchmarks
+	uint64_t nblocks = (uint64_t)ninodes / INODES_PER_SECTOR + 2 + JOURNAL_SECTORS + ninodes + 2 * BENCH_MAX_WRITES + JOURNAL_MIN_DATA;
+	nblocks += (uint64_t)shape->nsmall * (BENCH_SMALL_SIZE / SECTOR_SIZE + 1);
+	nblocks += (uint64_t)shape->nbig * (BENCH_BIG_SIZE / SECTOR_SIZE + 2);
+	for(uint32_t w = 0; w < shape->nwidths; ++w){
+		nblocks += (uint64_t)shape->depth * (shape->widths[w] * sizeof(struct direntv6) / SECTOR_SIZE + 2);
+	}
+	if(ninodes > UINT16_MAX || nblocks > UINT16_MAX) return ERR_BAD_PARAMETER;
+
+	int err = mountv6_mkfs_opts(filename, (uint16_t)nblocks, (uint16_t)ninodes, MKFS_LAZY_ITABLE);
+	if(err < 0) return err;
+	struct unix_filesystem u;
+	memset(&u, 0, sizeof(u));
+	err = mountv6(filename, &u);
+	if(err < 0) return err;
+
+	char name[DIRENT_MAXLEN + 1];
+	for(uint32_t w = 0; w < shape->nwidths && err >= 0; ++w){
+		snprintf(name, sizeof(name), "w%" PRIu32, shape->widths[w]);
+		int dir = bench_create(&u, ROOT_INUMBER, name, IFDIR);
+		for(uint32_t d = 0; d < shape->depth && dir >= 0; ++d){
+			//the files of each level, then the next level (if any) as the last entry
+			int next = dir;
+			for(uint32_t i = 0; i + 1 < shape->widths[w] && next >= 0; ++i){
+				snprintf(name, sizeof(name), "f%" PRIu32, i);
+				next = bench_create(&u, dir, name, 0);
+			}
+			if(next >= 0) next = d + 1 < shape->depth ? bench_create(&u, dir, "d", IFDIR) : dir;
+			dir = next;
+		}
+		err = dir;
+	}
+
+	int small = bench_create(&u, ROOT_INUMBER, "small", IFDIR);
+	for(uint32_t i = 0; i < shape->nsmall && small >= 0 && err >= 0; ++i){
+		snprintf(name, sizeof(name), "s%" PRIu32, i);
+		err = bench_create(&u, small, name, 0);
+		if(err >= 0) err = bench_fill(&u, (uint16_t)err, BENCH_SMALL_SIZE, shape->seed ^ (2 * i + 1));
+	}
+	int big = bench_create(&u, ROOT_INUMBER, "big", IFDIR);
+	for(uint32_t i = 0; i < shape->nbig && big >= 0 && err >= 0; ++i){
+		snprintf(name, sizeof(name), "b%" PRIu32, i);
+		err = bench_create(&u, big, name, 0);
+		if(err >= 0) err = bench_fill(&u, (uint16_t)err, BENCH_BIG_SIZE, shape->seed ^ (2 * i + 2));
+	}
+	if(small < 0) err = small;
+	if(big < 0) err = big;
+
+	uint32_t itable = u.s.s_inode_start;
+	uint32_t isize = u.s.s_isize;
+	uint32_t journal = u.s.s_journal_start;
+	uint32_t journal_size = u.s.s_journal_size;
+	int e = umountv6(&u);
+	if(err < 0 || e < 0) return err < 0 ? err : e;
+
+	//the dates would make two images of the same shape differ; they are cleared on the
+	//disk, as the write-back never sets older dates
+	FILE *f = fopen(filename, "r+");
+	if(f == NULL) return ERR_IO;
+	struct inode inodes[INODES_PER_SECTOR];
+	for(uint32_t i = 0; i < isize && err >= 0; ++i){
+		err = sector_read(f, itable + i, inodes);
+		for(uint32_t k = 0; k < INODES_PER_SECTOR && err >= 0; ++k){
+			memset(inodes[k].i_atime, 0, sizeof(inodes[k].i_atime));
+			memset(inodes[k].i_mtime, 0, sizeof(inodes[k].i_mtime));
+		}
+		if(err >= 0) err = sector_write(f, itable + i, inodes);
+	}
+	//the transactions left in the journal depend on when the batches were taken
+	uint8_t zeros[SECTOR_SIZE];
+	memset(zeros, 0, sizeof(zeros));
+	for(uint32_t i = 0; i < journal_size && err >= 0; ++i) err = sector_write(f, journal + i, zeros);
+	if(fclose(f) != 0 && err >= 0) err = ERR_IO;
+	return err < 0 ? err : 0;
+}
+
+/**
+ * @brief mount a generated image and find its files
+ * @param filename the image file
+ * @param shape the shape it was generated with
+ * @param img the image (OUT)
+ * @return 0 on success; <0 on error
+ */
+static int bench_open(const char *filename, const struct bench_shape *shape, struct bench_image *img){
+	memset(img, 0, sizeof(*img));
+	int err = mountv6(filename, &img->u);
+	if(err < 0) return err;
+	img->small = calloc(shape->nsmall + 1, sizeof(uint16_t));
+	img->big = calloc(shape->nbig + 1, sizeof(uint16_t));
+	if(img->small == NULL || img->big == NULL) return ERR_NOMEM;
+
+	char path[64];
+	for(uint32_t i = 0; i < shape->nsmall && err >= 0; ++i){
+		snprintf(path, sizeof(path), "/small/s%" PRIu32, i);
+		err = direntv6_dirlookup(&img->u, ROOT_INUMBER, path);
+		img->small[i] = (uint16_t)err;
+	}
+	for(uint32_t i = 0; i < shape->nbig && err >= 0; ++i){
+		snprintf(path, sizeof(path), "/big/b%" PRIu32, i);
+		err = direntv6_dirlookup(&img->u, ROOT_INUMBER, path);
+		img->big[i] = (uint16_t)err;
+	}
+	img->ninodes = (uint16_t)(img->u.ibm->max + 1 - img->u.ibm->nfree);
+	return err < 0 ? err : 0;
+}
+
+/* Context of the sector benchmarks */
+struct bench_sectors {
+	FILE *f;                     // the image
+	uint16_t *sectors;           // the sectors to read or write, in order
+	uint32_t n;                  // number of sectors
+	uint8_t data[SECTOR_SIZE];   // what is written
+};
+
+static int bench_sector_read(void *ctx, uint32_t i){
+	struct bench_sectors *c = ctx;
+	return sector_read(c->f, c->sectors[i % c->n], c->data);
+}
+
+static int bench_sector_write(void *ctx, uint32_t i){
+	struct bench_sectors *c = ctx;
+	return sector_write(c->f, c->sectors[i % c->n], c->data);
+}
+
+/* Context of the bitmap benchmarks */
+struct bench_bitmap {
+	struct bmblock_array *bm;    // the bitmap, filled to a given level
+	uint16_t *bits;              // free bits, in a random order
+	uint32_t n;                  // number of free bits
+	uint16_t *found;             // bits set by bm_find_next during a sample
+};
+
+static int bench_bm_find_next(void *ctx, uint32_t i){
+	struct bench_bitmap *c = ctx;
+	//each sample allocates from the same level: what it set is cleared by the next one
+	if(i % BENCH_BM_BATCH == 0 && i > 0) bm_clear_many(c->bm, c->found, BENCH_BM_BATCH);
+	int bit = bm_find_next(c->bm);
+	if(bit < 0) return bit;
+	bm_set(c->bm, (uint64_t)bit);
+	c->found[i % BENCH_BM_BATCH] = (uint16_t)bit;
+	return 0;
+}
+
+static int bench_bm_set(void *ctx, uint32_t i){
+	struct bench_bitmap *c = ctx;
+	bm_set(c->bm, c->bits[i % c->n]);
+	return 0;
+}
+
+static int bench_bm_clear(void *ctx, uint32_t i){
+	struct bench_bitmap *c = ctx;
+	bm_clear(c->bm, c->bits[i % c->n]);
+	return 0;
+}
+
+/* Context of the inode benchmarks */
+struct bench_inodes {
+	struct bench_image *img;     // the image
+	uint64_t rand;               // state of the random choices
+	struct inode big;            // the inode of a big file
+};
+
+static int bench_inode_read(void *ctx, uint32_t i){
+	(void)i;
+	struct bench_inodes *c = ctx;
+	struct inode inode;
+	int err = inode_read(&c->img->u, (uint16_t)(ROOT_INUMBER + bench_rand(&c->rand) % c->img->ninodes), &inode);
+	return err == ERR_UNALLOCATED_INODE ? 0 : err;
+}
+
+static int bench_inode_findsector(void *ctx, uint32_t i){
+	(void)i;
+	struct bench_inodes *c = ctx;
+	return inode_findsector(&c->img->u, &c->big, (int32_t)(bench_rand(&c->rand) % (BENCH_BIG_SIZE / SECTOR_SIZE)));
+}
+
+/* Context of the lookup benchmarks */
+struct bench_lookup {
+	const struct unix_filesystem *u; // the filesystem
+	char prefix[DIRENT_MAXLEN * 64]; // the directory looked into
+	uint32_t width;              // its number of files
+	uint64_t rand;               // state of the random choices
+};
+
+static int bench_dirlookup(void *ctx, uint32_t i){
+	(void)i;
+	struct bench_lookup *c = ctx;
+	char path[sizeof(c->prefix) + 16];
+	snprintf(path, sizeof(path), "%s/f%" PRIu64, c->prefix, bench_rand(&c->rand) % (c->width - 1));
+	int inr = direntv6_dirlookup(c->u, ROOT_INUMBER, path);
+	return inr < 0 ? inr : 0;
+}
+
+/* Context of the file benchmarks */
+struct bench_files {
+	struct unix_filesystem *u;   // the filesystem
+	struct filev6 *files;        // the files
+	uint32_t n;                  // number of files
+	uint32_t per_file;           // number of sectors read or written in a file before the next one
+	uint8_t data[SECTOR_SIZE];   // what is read or written
+};
+
+static int bench_readblock(void *ctx, uint32_t i){
+	struct bench_files *c = ctx;
+	struct filev6 *fv6 = &c->files[i / c->per_file % c->n];
+	if(i % c->per_file == 0) fv6->offset = 0;
+	return filev6_readblock(fv6, c->data);
+}
+
+static int bench_writebytes(void *ctx, uint32_t i){
+	struct bench_files *c = ctx;
+	return filev6_writebytes(c->u, &c->files[i / c->per_file % c->n], c->data, SECTOR_SIZE);
+}
+
+/**
+ * @brief benchmark the reads and writes of sectors: random data sectors are read,
+ *        free sectors are written
+ * @param img the image
+ * @param nsamples the number of samples
+ * @param seed the seed of the random choices
+ * @return 0 on success; <0 on error
+ */
+static int bench_sector(struct bench_image *img, uint32_t nsamples, uint64_t seed){
+	struct bench_sectors c;
+	memset(&c, 0, sizeof(c));
+	c.f = img->u.f;
+	c.sectors = calloc(nsamples, sizeof(uint16_t));
+	if(c.sectors == NULL) return ERR_NOMEM;
+
+	struct bmblock_array *fbm = img->u.fbm;
+	for(c.n = 0; c.n < nsamples; ++c.n){
+		c.sectors[c.n] = (uint16_t)(fbm->min + bench_rand(&seed) % (fbm->max - fbm->min + 1));
+	}
+	int err = bench_run("sector_read (random)", bench_sector_read, &c, nsamples, 1);
+
+	//the free sectors at the end of the disk: the write benchmarks of the files come later
+	c.n = 0;
+	for(uint64_t s = fbm->max; s >= fbm->min && c.n < nsamples && c.n < BENCH_MAX_WRITES / 2; --s){
+		if(bm_get(fbm, s) == 0) c.sectors[c.n++] = (uint16_t)s;
+	}
+	if(err == 0 && c.n > 0) err = bench_run("sector_write (free, descending)", bench_sector_write, &c, nsamples, 1);
+	free(c.sectors);
+	return err;
+}
+
+/**
+ * @brief benchmark the bitmaps, filled at random to several levels
+ * @param nsamples the number of samples
+ * @param seed the seed of the random choices
+ * @return 0 on success; <0 on error
+ */
+static int bench_bitmaps(uint32_t nsamples, uint64_t seed){
+	const unsigned int levels[] = {0, 50, 90, 99};
+	uint16_t found[BENCH_BM_BATCH];
+	int err = 0;
+	for(size_t l = 0; l < sizeof(levels) / sizeof(levels[0]) && err == 0; ++l){
+		struct bench_bitmap c;
+		c.bm = bm_alloc(0, BENCH_FILL_MAX - 1);
+		c.bits = calloc(BENCH_FILL_MAX, sizeof(uint16_t));
+		c.found = found;
+		if(c.bm == NULL || c.bits == NULL){
+			bm_free(c.bm);
+			free(c.bits);
+			return ERR_NOMEM;
+		}
+		//a random permutation of the bits: the first ones are set, the others stay free
+		for(uint32_t i = 0; i < BENCH_FILL_MAX; ++i) c.bits[i] = (uint16_t)i;
+		for(uint32_t i = BENCH_FILL_MAX - 1; i > 0; --i){
+			uint32_t j = (uint32_t)(bench_rand(&seed) % (i + 1));
+			uint16_t t = c.bits[i];
+			c.bits[i] = c.bits[j];
+			c.bits[j] = t;
+		}
+		uint32_t used = BENCH_FILL_MAX / 100 * levels[l];
+		for(uint32_t i = 0; i < used; ++i) bm_set(c.bm, c.bits[i]);
+		c.bits += used;
+		c.n = BENCH_FILL_MAX - used;
+
+		char name[64];
+		snprintf(name, sizeof(name), "bm_find_next+bm_set (%u%% full)", levels[l]);
+		err = bench_run(name, bench_bm_find_next, &c, nsamples, BENCH_BM_BATCH);
+		bm_clear_many(c.bm, found, BENCH_BM_BATCH);
+		//the same few free bits are set, then cleared: the level changes by 1% at most
+		if(c.n > BENCH_FILL_MAX / 100) c.n = BENCH_FILL_MAX / 100;
+		snprintf(name, sizeof(name), "bm_set (%u%% full)", levels[l]);
+		if(err == 0) err = bench_run(name, bench_bm_set, &c, nsamples, BENCH_BM_BATCH);
+		snprintf(name, sizeof(name), "bm_clear (%u%% full)", levels[l]);
+		if(err == 0) err = bench_run(name, bench_bm_clear, &c, nsamples, BENCH_BM_BATCH);
+		bm_free(c.bm);
+		free(c.bits - used);
+	}
+	return err;
+}
+
+/**
+ * @brief benchmark the reads of inodes, and the sectors of a big file
+ * @param img the image
+ * @param shape its shape
+ * @param nsamples the number of samples
+ * @param seed the seed of the random choices
+ * @return 0 on success; <0 on error
+ */
+static int bench_inode(struct bench_image *img, const struct bench_shape *shape, uint32_t nsamples, uint64_t seed){
+	struct bench_inodes c;
+	c.img = img;
+	c.rand = seed;
+	int err = bench_run("inode_read (random)", bench_inode_read, &c, nsamples, 1);
+	if(err == 0 && shape->nbig > 0) err = inode_read(&img->u, img->big[0], &c.big);
+	if(err == 0 && shape->nbig > 0) err = bench_run("inode_findsector (big file)", bench_inode_findsector, &c, nsamples, 1);
+	return err;
+}
+
+/**
+ * @brief benchmark the lookups of paths, for each width of the image, at the first,
+ *        middle and last level of its tree
+ * @param img the image
+ * @param shape its shape
+ * @param nsamples the number of samples
+ * @param seed the seed of the random choices
+ * @return 0 on success; <0 on error
+ */
+static int bench_lookup(struct bench_image *img, const struct bench_shape *shape, uint32_t nsamples, uint64_t seed){
+	int err = 0;
+	for(uint32_t w = 0; w < shape->nwidths && err == 0; ++w){
+		if(shape->widths[w] < 2) continue;
+		uint32_t depths[3] = {1, (shape->depth + 1) / 2, shape->depth};
+		for(int k = 0; k < 3 && err == 0; ++k){
+			if(k > 0 && depths[k] == depths[k - 1]) continue;
+			struct bench_lookup c;
+			c.u = &img->u;
+			c.width = shape->widths[w];
+			c.rand = seed;
+			int len = snprintf(c.prefix, sizeof(c.prefix), "/w%" PRIu32, c.width);
+			for(uint32_t d = 1; d < depths[k] && len + 2 < (int)sizeof(c.prefix); ++d){
+				len += snprintf(c.prefix + len, sizeof(c.prefix) - len, "/d");
+			}
+			char name[64];
+			snprintf(name, sizeof(name), "direntv6_dirlookup (w%" PRIu32 ", depth %" PRIu32 ")", c.width, depths[k]);
+			err = bench_run(name, bench_dirlookup, &c, nsamples, 1);
+		}
+	}
+	return err;
+}
+
+/**
+ * @brief benchmark the sequential reads of the files, and the appends to new files
+ * @param img the image
+ * @param shape its shape
+ * @param nsamples the number of samples
+ * @return 0 on success; <0 on error
+ */
+static int bench_file(struct bench_image *img, const struct bench_shape *shape, uint32_t nsamples){
+	struct bench_files c;
+	memset(&c, 0, sizeof(c));
+	c.u = &img->u;
+	uint32_t nmax = shape->nsmall > shape->nbig ? shape->nsmall : shape->nbig;
+	uint32_t nwrites = nsamples < BENCH_MAX_WRITES ? nsamples : BENCH_MAX_WRITES;
+	if(nmax < nwrites / 8 + 1) nmax = nwrites / 8 + 1;
+	c.files = calloc(nmax, sizeof(struct filev6));
+	if(c.files == NULL) return ERR_NOMEM;
+
+	int err = 0;
+	const struct {
+		const char *read;
+		const char *write;
+		const uint16_t *inodes;
+		uint32_t n;
+		uint32_t sectors;
+		uint32_t written;
+	} kinds[2] = {
+		{"filev6_readblock (small files)", "filev6_writebytes (small files)", img->small, shape->nsmall,
+		 BENCH_SMALL_SIZE / SECTOR_SIZE + 1, 8},
+		{"filev6_readblock (big files)", "filev6_writebytes (big files)", img->big, shape->nbig,
+		 BENCH_BIG_SIZE / SECTOR_SIZE, 256}
+	};
+	for(int k = 0; k < 2 && err == 0; ++k){
+		c.per_file = kinds[k].sectors;
+		c.n = kinds[k].n;
+		for(uint32_t i = 0; i < c.n && err == 0; ++i) err = filev6_open(&img->u, kinds[k].inodes[i], &c.files[i]);
+		if(err == 0 && c.n > 0) err = bench_run(kinds[k].read, bench_readblock, &c, nsamples, 1);
+
+		//the appends go to new files, created beforehand: small ones stay without indirection
+		c.per_file = kinds[k].written;
+		c.n = (nwrites + c.per_file - 1) / c.per_file;
+		for(uint32_t i = 0; i < c.n && err == 0; ++i){
+			char path[32];
+			snprintf(path, sizeof(path), "/%s%" PRIu32, k == 0 ? "ws" : "wb", i);
+			err = direntv6_create(&img->u, path, 0);
+			if(err >= 0) err = filev6_open(&img->u, (uint16_t)err, &c.files[i]);
+		}
+		if(err == 0) err = bench_run(kinds[k].write, bench_writebytes, &c, nwrites, 1);
+	}
+	free(c.files);
+	return err;
+}
+
+/**
+ * @brief parse a list of widths, separated by commas
+ * @param arg the list
+ * @param shape the shape whose widths are set (OUT)
+ * @return 0 on success; <0 on error
+ */
+static int bench_widths(const char *arg, struct bench_shape *shape){
+	shape->nwidths = 0;
+	while(*arg != '\0' && shape->nwidths < BENCH_MAX_WIDTHS){
+		char *end;
+		unsigned long w = strtoul(arg, &end, 10);
+		if(end == arg || w < 2 || w > 4096) return ERR_BAD_PARAMETER;
+		shape->widths[shape->nwidths++] = (uint32_t)w;
+		arg = *end == ',' ? end + 1 : end;
+	}
+	return *arg == '\0' && shape->nwidths > 0 ? 0 : ERR_BAD_PARAMETER;
+}
+
+int main(int argc, char *argv[]){
+	struct bench_shape shape = {4, {8, 64, 512}, 3, 64, 8, 42};
+	const char *filename = "bench.uv6";
+	uint32_t nsamples = 20000;
+	int generate_only = 0;
+
+	int opt;
+	int err = 0;
+	while((opt = getopt(argc, argv, "go:d:w:s:b:n:r:")) != -1 && err == 0){
+		switch(opt){
+		case 'g': generate_only = 1; break;
+		case 'o': filename = optarg; break;
+		case 'd': shape.depth = (uint32_t)strtoul(optarg, NULL, 10); break;
+		case 'w': err = bench_widths(optarg, &shape); break;
+		case 's': shape.nsmall = (uint32_t)strtoul(optarg, NULL, 10); break;
+		case 'b': shape.nbig = (uint32_t)strtoul(optarg, NULL, 10); break;
+		case 'n': nsamples = (uint32_t)strtoul(optarg, NULL, 10); break;
+		case 'r': shape.seed = strtoull(optarg, NULL, 10); break;
+		default: err = ERR_BAD_PARAMETER;
+		}
+	}
+	if(err < 0 || optind != argc || shape.depth < 1 || shape.depth > 32 || nsamples < 1 || shape.seed == 0){
+		fputs("Usage: " USAGE "\n", stderr);
+		return 1;
+	}
+
+	err = bench_generate(filename, &shape);
+	if(err < 0){
+		printf("cannot build %s: %s\n", filename, ERR_MESSAGES[err - ERR_FIRST]);
+		return 1;
+	}
+	if(generate_only) return 0;
+
+	struct bench_image img;
+	err = bench_open(filename, &shape, &img);
+	if(err == 0){
+		printf("%-36s %12s %9s %9s %9s %9s\n", "benchmark", "ops/s", "p50 ns", "p90 ns", "p99 ns", "max ns");
+		err = bench_sector(&img, nsamples, shape.seed);
+	}
+	if(err == 0) err = bench_bitmaps(nsamples, shape.seed);
+	if(err == 0) err = bench_inode(&img, &shape, nsamples, shape.seed);
+	if(err == 0) err = bench_lookup(&img, &shape, nsamples, shape.seed);
+	if(err == 0) err = bench_file(&img, &shape, nsamples);
+	if(err < 0) printf("%s\n", ERR_MESSAGES[err - ERR_FIRST]);
+
+	umountv6(&img.u);
+	free(img.small);
+	free(img.big);
+	//the write benchmarks changed the image: it no longer has the shape
+	remove(filename);
+	return err < 0 ? 1 : 0;
+}
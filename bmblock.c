@@ -25,6 +25,7 @@ struct bmblock_array *bm_alloc(uint64_t min, uint64_t max){
 		bm->cursor = 0;
 		bm->min = min;
 		bm->max = max;
+		bm->nfree = max - min + 1;
 	}
 	return bm;
 }
@@ -61,7 +62,7 @@ int bm_get(struct bmblock_array *bmblock_array, uint64_t x){
 	
 	uint64_t elem = bmblock_array->bm[pos_in_bm];
 	uint64_t mask = UINT64_C(1);
-	int offset = (x % BITS_PER_VECTOR) - bmblock_array->min;
+	int offset = (x - bmblock_array->min) % BITS_PER_VECTOR;
 	
 	int bit = (elem >> offset) & mask;
 	return bit;
@@ -76,8 +77,10 @@ void bm_set(struct bmblock_array *bmblock_array, uint64_t x){
 	if(bmblock_array != NULL){
 		int pos_in_bm = check_and_get_pos(bmblock_array, x);
 		if(pos_in_bm >= 0){
-			int offset = (x % BITS_PER_VECTOR) - bmblock_array->min;
+			int offset = (x - bmblock_array->min) % BITS_PER_VECTOR;
 			uint64_t mask = UINT64_C(1) << offset;
+			//the counter changes only if the bit does
+			if((bmblock_array->bm[pos_in_bm] & mask) == 0) --bmblock_array->nfree;
 			bmblock_array->bm[pos_in_bm] |= mask;
 		}
 	}
@@ -93,8 +96,9 @@ void bm_clear(struct bmblock_array *bmblock_array, uint64_t x){
 		int pos_in_bm = check_and_get_pos(bmblock_array, x);
 		if(pos_in_bm < 0) return;
 		
-		int offset = (x % BITS_PER_VECTOR) - bmblock_array->min;
+		int offset = (x - bmblock_array->min) % BITS_PER_VECTOR;
 		uint64_t mask = ~(UINT64_C(1) << offset);
+		if((bmblock_array->bm[pos_in_bm] & ~mask) != 0) ++bmblock_array->nfree;
 		bmblock_array->bm[pos_in_bm] &= mask;
 		
 		//Update the cursor
@@ -103,6 +107,37 @@ void bm_clear(struct bmblock_array *bmblock_array, uint64_t x){
 	}
 }
 
+/**
+ * @brief set to false (or 0) the bits associated to several values, a vector at a time
+ * @param bmblock_array the array containing the values we want to clear
+ * @param values the values (those out of range, e.g. 0, are ignored)
+ * @param n the number of values
+ */
+void bm_clear_many(struct bmblock_array *bmblock_array, const uint16_t *values, size_t n){
+	if(bmblock_array == NULL || values == NULL) return;
+	
+	size_t i = 0;
+	while(i < n){
+		int pos_in_bm = check_and_get_pos(bmblock_array, values[i]);
+		if(pos_in_bm < 0){
+			++i;
+			continue;
+		}
+		
+		//the following values of the same vector are cleared with a single write
+		uint64_t mask = 0;
+		for(; i < n && check_and_get_pos(bmblock_array, values[i]) == pos_in_bm; ++i){
+			mask |= UINT64_C(1) << ((values[i] - bmblock_array->min) % BITS_PER_VECTOR);
+		}
+		bmblock_array->nfree += (uint64_t)__builtin_popcountll(bmblock_array->bm[pos_in_bm] & mask);
+		bmblock_array->bm[pos_in_bm] &= ~mask;
+		
+		//Update the cursor
+		if((unsigned int) pos_in_bm < bmblock_array->cursor)
+			bmblock_array->cursor = pos_in_bm;
+	}
+}
+
 /**
  * @brief return the next unused bit
  * @param bmblock_array the array we want to search for place
@@ -111,8 +146,11 @@ void bm_clear(struct bmblock_array *bmblock_array, uint64_t x){
 int bm_find_next(struct bmblock_array *bmblock_array){
 	M_REQUIRE_NON_NULL(bmblock_array);
 	
+	//a full bitmap is known without looking at it
+	if(bmblock_array->nfree == 0) return ERR_BITMAP_FULL;
+	
 	uint64_t i;
-	for(i = bmblock_array->cursor; bmblock_array->bm[i] == UINT64_C(-1) && i < bmblock_array->length; ++i);
+	for(i = bmblock_array->cursor; i < bmblock_array->length && bmblock_array->bm[i] == UINT64_C(-1); ++i);
 
 	if(i == bmblock_array->length){
 		bmblock_array->cursor = i;
@@ -125,10 +163,52 @@ int bm_find_next(struct bmblock_array *bmblock_array){
 		for(j = 0; ((elem & mask) != 0) && (j < BITS_PER_VECTOR); ++j){
 		 elem >>= 1;
 		}
-		int next = i * BITS_PER_VECTOR + j + bmblock_array->min;	
+		uint64_t next = i * BITS_PER_VECTOR + j + bmblock_array->min;
 		bmblock_array->cursor = i;
-		return next;
+		//the unused bits of the last vector are past max
+		if(next > bmblock_array->max) return ERR_BITMAP_FULL;
+		return (int)next;
+	}
+}
+
+/**
+ * @brief find the first run of n consecutive unused bits, or the longest run if there is none
+ * @param bmblock_array the array we want to search for place
+ * @param n the length of the run we are looking for
+ * @param len the length of the run found, at most n (OUT)
+ * @return <0 on failure (ERR_BITMAP_FULL if there is no unused bit), the first value of the run otherwise
+ */
+int bm_find_run(struct bmblock_array *bmblock_array, uint64_t n, uint64_t *len){
+	M_REQUIRE_NON_NULL(bmblock_array);
+	M_REQUIRE_NON_NULL(len);
+	if(n == 0) return ERR_BAD_PARAMETER;
+	if(bmblock_array->nfree == 0) return ERR_BITMAP_FULL;
+	
+	uint64_t best = 0, best_len = 0;
+	uint64_t start = 0, run = 0;
+	//the vectors before the cursor are full
+	for(uint64_t x = bmblock_array->min + bmblock_array->cursor * BITS_PER_VECTOR; x <= bmblock_array->max && best_len < n; ++x){
+		uint64_t offset = (x - bmblock_array->min) % BITS_PER_VECTOR;
+		uint64_t elem = bmblock_array->bm[(x - bmblock_array->min) / BITS_PER_VECTOR];
+		
+		//a full vector ends the current run at once
+		if(offset == 0 && elem == UINT64_C(-1)){
+			run = 0;
+			x += BITS_PER_VECTOR - 1;
+		}else if((elem >> offset) & UINT64_C(1)){
+			run = 0;
+		}else{
+			if(run == 0) start = x;
+			if(++run > best_len){
+				best = start;
+				best_len = run;
+			}
+		}
 	}
+	
+	if(best_len == 0) return ERR_BITMAP_FULL;
+	*len = best_len;
+	return (int)best;
 }
 
 /**
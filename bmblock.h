@@ -8,6 +8,7 @@
  * @date summer 2016
  */
 
+#include <stddef.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -19,6 +20,7 @@ struct bmblock_array {
     uint64_t cursor;
     uint64_t min;
     uint64_t max;
+    uint64_t nfree;     // number of unused values, kept up to date by bm_set and bm_clear
     uint64_t bm[1];
 };
 
@@ -61,6 +63,14 @@ void bm_set(struct bmblock_array *bmblock_array, uint64_t x);
  */
 void bm_clear(struct bmblock_array *bmblock_array, uint64_t x);
 
+/**
+ * @brief set to false (or 0) the bits associated to several values, a vector at a time
+ * @param bmblock_array the array containing the values we want to clear
+ * @param values the values (those out of range, e.g. 0, are ignored)
+ * @param n the number of values
+ */
+void bm_clear_many(struct bmblock_array *bmblock_array, const uint16_t *values, size_t n);
+
 /**
  * @brief return the next unused bit
  * @param bmblock_array the array we want to search for place
@@ -68,6 +78,15 @@ void bm_clear(struct bmblock_array *bmblock_array, uint64_t x);
  */
 int bm_find_next(struct bmblock_array *bmblock_array);
 
+/**
+ * @brief find the first run of n consecutive unused bits, or the longest run if there is none
+ * @param bmblock_array the array we want to search for place
+ * @param n the length of the run we are looking for
+ * @param len the length of the run found, at most n (OUT)
+ * @return <0 on failure (ERR_BITMAP_FULL if there is no unused bit), the first value of the run otherwise
+ */
+int bm_find_run(struct bmblock_array *bmblock_array, uint64_t n, uint64_t *len);
+
 /**
  * @brief usefull to see (and debug) content of a bmblock_array
  * @param bmblock_array the array we want to see
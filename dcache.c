@@ -0,0 +1,145 @@
+#include <stdlib.h>
+#include <string.h>
+#include "dcache.h"
+#include "error.h"
+
+/**
+ * @brief build the key of an entry, i.e. its name padded with '\0'
+ * @param name the name of the entry
+ * @param len the length of name
+ * @param key DIRENT_MAXLEN bytes filled with the padded name (OUT)
+ * @return 0 on success; -1 if the name is too long to be cached
+ */
+static int dcache_make_key(const char *name, size_t len, char *key){
+	if(len == 0 || len > DIRENT_MAXLEN) return -1;
+	memset(key, 0, DIRENT_MAXLEN);
+	memcpy(key, name, len);
+	return 0;
+}
+
+/**
+ * @brief compute the slot of a given (parent, key) pair (FNV-1a hash)
+ * @param parent the inode number of the directory
+ * @param key the padded name
+ * @return the index of the slot in the cache
+ */
+static size_t dcache_slot(uint16_t parent, const char *key){
+	uint32_t h = UINT32_C(2166136261);
+	h = (h ^ (parent & 0xFF)) * UINT32_C(16777619);
+	h = (h ^ (parent >> 8)) * UINT32_C(16777619);
+	for(int i = 0; i < DIRENT_MAXLEN && key[i] != '\0'; ++i){
+		h = (h ^ (uint8_t)key[i]) * UINT32_C(16777619);
+	}
+	return h & (DCACHE_SIZE - 1);
+}
+
+/**
+ * @brief allocate a new empty dentry cache
+ * @return a pointer to the new cache or NULL on failure
+ */
+struct dcache *dcache_alloc(void){
+	return calloc(1, sizeof(struct dcache));
+}
+
+/**
+ * @brief free a dentry cache
+ * @param dc the cache
+ */
+void dcache_free(struct dcache *dc){
+	free(dc);
+}
+
+/**
+ * @brief look up the child inode of a given name in a given directory
+ * @param dc the cache (may be NULL)
+ * @param parent the inode number of the directory
+ * @param name the name of the entry (not necessarily null-terminated)
+ * @param len the length of name
+ * @return the child inode number on a hit; ERR_INODE_OUTOF_RANGE if the name
+ *         is known to be absent from the directory; 0 on a miss
+ */
+int dcache_lookup(struct dcache *dc, uint16_t parent, const char *name, size_t len){
+	if(dc == NULL || name == NULL) return 0;
+
+	char key[DIRENT_MAXLEN];
+	if(dcache_make_key(name, len, key) < 0) return 0;
+
+	const struct dcache_entry *e = &dc->entries[dcache_slot(parent, key)];
+	if(e->parent == parent && memcmp(e->name, key, DIRENT_MAXLEN) == 0){
+		++dc->hits;
+		if(e->child == 0){
+			++dc->negative_hits;
+			return ERR_INODE_OUTOF_RANGE;
+		}
+		return e->child;
+	}
+	++dc->misses;
+	return 0;
+}
+
+/**
+ * @brief record that a name of a given directory refers to a given inode
+ * @param dc the cache (may be NULL)
+ * @param parent the inode number of the directory
+ * @param name the name of the entry (not necessarily null-terminated)
+ * @param len the length of name
+ * @param child the inode number of the entry
+ */
+void dcache_insert(struct dcache *dc, uint16_t parent, const char *name, size_t len, uint16_t child){
+	if(dc == NULL || name == NULL || parent == 0) return;
+
+	char key[DIRENT_MAXLEN];
+	if(dcache_make_key(name, len, key) < 0) return;
+
+	//Direct-mapped: a colliding entry is simply replaced
+	struct dcache_entry *e = &dc->entries[dcache_slot(parent, key)];
+	e->parent = parent;
+	e->child = child;
+	memcpy(e->name, key, DIRENT_MAXLEN);
+}
+
+/**
+ * @brief record that a name is absent from a given directory (negative entry)
+ * @param dc the cache (may be NULL)
+ * @param parent the inode number of the directory
+ * @param name the name that was not found (not necessarily null-terminated)
+ * @param len the length of name
+ */
+void dcache_insert_negative(struct dcache *dc, uint16_t parent, const char *name, size_t len){
+	//inode 0 is never used, so it marks the entry as negative
+	dcache_insert(dc, parent, name, len, 0);
+}
+
+/**
+ * @brief forget what is known about a name of a given directory;
+ *        to be called whenever that entry of the directory is modified
+ * @param dc the cache (may be NULL)
+ * @param parent the inode number of the directory
+ * @param name the name of the entry (not necessarily null-terminated)
+ * @param len the length of name
+ */
+void dcache_invalidate(struct dcache *dc, uint16_t parent, const char *name, size_t len){
+	if(dc == NULL || name == NULL) return;
+
+	char key[DIRENT_MAXLEN];
+	if(dcache_make_key(name, len, key) < 0) return;
+
+	struct dcache_entry *e = &dc->entries[dcache_slot(parent, key)];
+	if(e->parent == parent && memcmp(e->name, key, DIRENT_MAXLEN) == 0){
+		memset(e, 0, sizeof(*e));
+	}
+}
+
+/**
+ * @brief forget all the entries of a given directory, negative ones included;
+ *        to be called when the directory is removed, as its inode number may come back
+ * @param dc the cache (may be NULL)
+ * @param parent the inode number of the directory
+ */
+void dcache_invalidate_dir(struct dcache *dc, uint16_t parent){
+	if(dc == NULL) return;
+	//the names are unknown: every slot is checked
+	for(size_t i = 0; i < DCACHE_SIZE; ++i){
+		if(dc->entries[i].parent == parent) memset(&dc->entries[i], 0, sizeof(dc->entries[i]));
+	}
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+/**
+ * @file dcache.h
+ * @brief directory entry cache: maps (parent inode, name) to the child inode
+ *        so that path lookups do not have to rescan directories from disk
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "unixv6fs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DCACHE_SIZE 4096 /* number of slots, must be a power of 2 */
+
+struct dcache_entry {
+    uint16_t parent;             // inode number of the directory; 0 for an empty slot
+    uint16_t child;              // inode number of the entry; 0 if the name is known to be absent
+    char name[DIRENT_MAXLEN];    // name of the entry, padded with '\0'
+};
+
+struct dcache {
+    struct dcache_entry entries[DCACHE_SIZE]; // direct-mapped slots
+    uint64_t hits;                            // number of lookups answered by the cache
+    uint64_t misses;                          // number of lookups not answered by the cache
+    uint64_t negative_hits;                   // number of hits that found a negative entry
+};
+
+/**
+ * @brief allocate a new empty dentry cache
+ * @return a pointer to the new cache or NULL on failure
+ */
+struct dcache *dcache_alloc(void);
+
+/**
+ * @brief free a dentry cache
+ * @param dc the cache
+ */
+void dcache_free(struct dcache *dc);
+
+/**
+ * @brief look up the child inode of a given name in a given directory
+ * @param dc the cache (may be NULL)
+ * @param parent the inode number of the directory
+ * @param name the name of the entry (not necessarily null-terminated)
+ * @param len the length of name
+ * @return the child inode number on a hit; ERR_INODE_OUTOF_RANGE if the name
+ *         is known to be absent from the directory; 0 on a miss
+ */
+int dcache_lookup(struct dcache *dc, uint16_t parent, const char *name, size_t len);
+
+/**
+ * @brief record that a name of a given directory refers to a given inode
+ * @param dc the cache (may be NULL)
+ * @param parent the inode number of the directory
+ * @param name the name of the entry (not necessarily null-terminated)
+ * @param len the length of name
+ * @param child the inode number of the entry
+ */
+void dcache_insert(struct dcache *dc, uint16_t parent, const char *name, size_t len, uint16_t child);
+
+/**
+ * @brief record that a name is absent from a given directory (negative entry)
+ * @param dc the cache (may be NULL)
+ * @param parent the inode number of the directory
+ * @param name the name that was not found (not necessarily null-terminated)
+ * @param len the length of name
+ */
+void dcache_insert_negative(struct dcache *dc, uint16_t parent, const char *name, size_t len);
+
+/**
+ * @brief forget what is known about a name of a given directory;
+ *        to be called whenever that entry of the directory is modified
+ * @param dc the cache (may be NULL)
+ * @param parent the inode number of the directory
+ * @param name the name of the entry (not necessarily null-terminated)
+ * @param len the length of name
+ */
+void dcache_invalidate(struct dcache *dc, uint16_t parent, const char *name, size_t len);
+
+/**
+ * @brief forget all the entries of a given directory, negative ones included;
+ *        to be called when the directory is removed, as its inode number may come back
+ * @param dc the cache (may be NULL)
+ * @param parent the inode number of the directory
+ */
+void dcache_invalidate_dir(struct dcache *dc, uint16_t parent);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,8 +1,20 @@
 #include <stdio.h>
 #include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define DIRENTV6_AVX2 /* built whatever the compiler flags, used when the CPU has it */
+#endif
+#endif
 #include "direntv6.h"
 #include "inode.h"
 #include "error.h"
+#include "dcache.h"
+#include "dirindex.h"
+#include "sector.h"
+#include "fslock.h"
+#include "writeback.h"
 
 #define MAXPATHLEN_UV6 1024
 
@@ -32,6 +44,7 @@ int direntv6_opendir(const struct unix_filesystem *u, uint16_t inr, struct direc
 	d->fv6 = fv6;
 	d->curr = 0;
 	d->last = 0;
+	d->slot = 0;
 	
 	//Check if inode is dir
 	if((fv6.i_node.i_mode & IFMT) != IFDIR) return ERR_INVALID_DIRECTORY_INODE;
@@ -49,7 +62,7 @@ int direntv6_nonempty(struct directory_reader *d) {
 }
 
 /**
- * @brief return the next directory entry.
+ * @brief return the next directory entry (free slots are skipped).
  * @param d the directory reader
  * @param name pointer to at least DIRENTMAX_LEN+1 bytes. 
           Filled in with the NULL-terminated string of the entry (OUT)
@@ -62,41 +75,150 @@ int direntv6_readdir(struct directory_reader *d, char *name, uint16_t *child_inr
 	M_REQUIRE_NON_NULL(name);
 	M_REQUIRE_NON_NULL(child_inr);
 	
-	//if cursor is at the beginning of a sector, read it
-	if (d->curr==0){
-		struct direntv6 buf[DIRENTRIES_PER_SECTOR];
-		int readBytes = filev6_readblock(&d->fv6,buf);
-		if (readBytes<0){
-			return readBytes;
+	do{
+		//if all the entries of the current sector were returned, read the next sector
+		if (d->curr == d->last){
+			int readBytes = filev6_readblock(&d->fv6, d->dirs);
+			if (readBytes<0) return readBytes;
+			d->curr = 0;
+			d->last = readBytes/sizeof(struct direntv6);
+			if (d->last == 0) return 0;//end of the directory
 		}
-		memcpy(&d->dirs,buf,readBytes);
-		d->last = readBytes/sizeof(struct direntv6);
-		if (readBytes == 0)
-		  debug_print("Error: empty dir!\n");
-		//place the number of the last child of the sector in d->last
-	}
+		++d->slot;
+	}while(d->dirs[d->curr++].d_inumber == 0);
 	
-	if (d->curr > DIRENTRIES_PER_SECTOR) return ERR_BAD_PARAMETER;
+	const struct direntv6 *entry = &d->dirs[d->curr - 1];
 	//write the inode number of the next file to read
-	*child_inr = d->dirs[d->curr].d_inumber; 
+	*child_inr = entry->d_inumber; 
 	
 	//read the name and add the '\0' at the end
 	//(if the name has DIRENT_MAXLEN chars there is not '\0' at the end of the name)
 	int l;
 	char c;
-	for (l=0;l<DIRENT_MAXLEN && (c=d->dirs[d->curr].d_name[l])!='\0';++l){
+	for (l=0;l<DIRENT_MAXLEN && (c=entry->d_name[l])!='\0';++l){
 		name[l]=c;
 	}
 	name[l]='\0';
-	++d->curr;
-	if (d->curr==d->last){
-		//if last element is the last of the sector, read next sector
-		if (d->last==DIRENTRIES_PER_SECTOR) d->curr = 0;
-		else return 0;
-	}
 	return 1;
 }
 
+/**
+ * @brief move a directory reader to a given entry, reading at most one sector
+ * @param d the directory reader
+ * @param slot the position (in direntv6 units) of the next entry to read
+ * @return 0 on success; <0 on error
+ */
+int direntv6_seekdir(struct directory_reader *d, uint32_t slot){
+	M_REQUIRE_NON_NULL(d);
+	
+	int32_t size = inode_getsize(&d->fv6.i_node);
+	d->curr = 0;
+	d->last = 0;
+	if (slot * sizeof(struct direntv6) >= (uint32_t)size){
+		//past the last entry: the next readdir returns 0
+		d->fv6.offset = size;
+		d->slot = size / sizeof(struct direntv6);
+		return 0;
+	}
+	
+	//read the sector holding the entry, then skip the entries before it
+	int err = filev6_lseek(&d->fv6, (slot - slot % DIRENTRIES_PER_SECTOR) * sizeof(struct direntv6));
+	if (err < 0) return err;
+	int readBytes = filev6_readblock(&d->fv6, d->dirs);
+	if (readBytes < 0) return readBytes;
+	d->last = readBytes/sizeof(struct direntv6);
+	d->curr = slot % DIRENTRIES_PER_SECTOR;
+	d->slot = slot;
+	return 0;
+}
+
+/**
+ * @brief return the position of the next entry a directory reader will read
+ * @param d the directory reader
+ * @return the position (in direntv6 units), to be given to direntv6_seekdir
+ */
+uint32_t direntv6_telldir(const struct directory_reader *d){
+	return d == NULL ? 0 : d->slot;
+}
+
+/**
+ * @brief compare two (inode number, position) pairs by inode number, for qsort
+ * @param a the first pair
+ * @param b the second pair
+ * @return <0, 0 or >0 if a is before, with or after b in the inode table
+ */
+static int direntv6_cmp_inr(const void *a, const void *b){
+	const uint16_t *x = a;
+	const uint16_t *y = b;
+	return (int)x[0] - (int)y[0];
+}
+
+/**
+ * @brief return the next directory entries together with the content of their inodes.
+ *        The inodes are read in the order of the inode table, so that each sector
+ *        of the table is read once per call however many entries it holds.
+ * @param d the directory reader
+ * @param entries array of at least max entries, filled in (OUT)
+ * @param max the maximal number of entries to return
+ * @return the number of entries returned (0 if there are no more entries to read); <0 on error
+ */
+int direntv6_readdirplus(struct directory_reader *d, struct direntv6_plus *entries, int max){
+	M_REQUIRE_NON_NULL(d);
+	M_REQUIRE_NON_NULL(d->fv6.u);
+	M_REQUIRE_NON_NULL(entries);
+	if (max <= 0) return ERR_BAD_PARAMETER;
+	
+	const struct unix_filesystem *u = d->fv6.u;
+	
+	//first collect the names, as direntv6_readdir returns them
+	int n = 0;
+	int r = 0;
+	while (n < max && (r = direntv6_readdir(d, entries[n].name, &entries[n].inr)) > 0){
+		entries[n].next = direntv6_telldir(d);
+		++n;
+	}
+	if (r < 0 && n == 0) return r;
+	if (n == 0) return 0;
+	
+	//then sort the entries by inode number, i.e. by sector of the inode table
+	uint16_t (*order)[2] = malloc(n * sizeof(*order));
+	if (order == NULL) return ERR_NOMEM;
+	for (int i = 0; i < n; ++i){
+		order[i][0] = entries[i].inr;
+		order[i][1] = (uint16_t)i;
+	}
+	qsort(order, n, sizeof(*order), direntv6_cmp_inr);
+	
+	uint32_t ninodes = (uint32_t)u->s.s_isize * INODES_PER_SECTOR;
+	struct inode inode_tab[INODES_PER_SECTOR];
+	uint32_t loaded = 0; //sector of the table in inode_tab, 0 if none
+	int sector_err = 0;
+	for (int i = 0; i < n; ++i){
+		uint16_t inr = order[i][0];
+		struct direntv6_plus *e = &entries[order[i][1]];
+		memset(&e->inode, 0, sizeof(e->inode));
+		if (inr < ROOT_INUMBER || inr >= ninodes){
+			e->err = ERR_INODE_OUTOF_RANGE;
+			continue;
+		}
+		uint32_t sector = u->s.s_inode_start + inr / INODES_PER_SECTOR;
+		if (sector != loaded){
+			sector_err = inode_read_sector(u, inr / INODES_PER_SECTOR, inode_tab);
+			loaded = sector;
+		}
+		if (sector_err < 0){
+			e->err = sector_err;
+		}else if (!(inode_tab[inr % INODES_PER_SECTOR].i_mode & IALLOC)){
+			e->err = ERR_UNALLOCATED_INODE;
+		}else{
+			e->err = 0;
+			e->inode = inode_tab[inr % INODES_PER_SECTOR];
+		}
+	}
+	free(order);
+	return n;
+}
+
 /**
  * @brief debugging routine; print a subtree (note: recursive)
  * @param u a mounted filesystem
@@ -124,18 +246,17 @@ int direntv6_print_tree(const struct unix_filesystem *u, uint16_t inr, const cha
 	char next_name[DIRENT_MAXLEN+1];
 
 	if(is_dir == 0){
-		int r=direntv6_nonempty(&d);
+		int r;
 		uint16_t child_inr;
 		char to_print[MAXPATHLEN_UV6+1];
 		printf("%s %s%c\n", SHORT_DIR_NAME, prefix, PATH_TOKEN);
-		while(r){
-			r=direntv6_readdir(&d, next_name, &child_inr);
-			if (r<0) return r;
+		while((r=direntv6_readdir(&d, next_name, &child_inr)) > 0){
 			//create the to_print by concatenating the prefix, the PATH_TOKEN and the next_name
 			snprintf(to_print, MAXPATHLEN_UV6+1, "%s%c%s", prefix, PATH_TOKEN, next_name);
 			//call recursively print_tree with all children of the node
 			direntv6_print_tree(u, child_inr, to_print);
 		}
+		if (r<0) return r;
 	}else{
 		//the dirent is a FIL, simply print it
 		strncpy(next_name, prefix, strlen(prefix)+1);
@@ -145,60 +266,230 @@ int direntv6_print_tree(const struct unix_filesystem *u, uint16_t inr, const cha
 }
 
 /**
- * @brief utility function for direntv6_dirlookup, used to handle recursion easily by also passing the size of the entry
- * @param u a mounted filesystem
- * @param inr the current of the subtree
- * @param entry the prefix to the subtree
- * @param size the size of the string entry
- * @return inr on success; <0 on error
+ * @brief find a name among the entries of a directory sector, one entry at a time
+ * @param dirs the entries of the sector
+ * @param count the number of entries in dirs
+ * @param name the name to search (not necessarily null-terminated)
+ * @param len the length of name
+ * @return the position of the first used entry with this name; -1 if there is none
+ */
+int direntv6_match_scalar(const struct direntv6 *dirs, int count, const char *name, size_t len){
+	if(dirs == NULL || name == NULL || len == 0 || len > DIRENT_MAXLEN) return -1;
+	
+	for(int i = 0; i < count; ++i){
+		if(dirs[i].d_inumber != 0 && memcmp(dirs[i].d_name, name, len) == 0
+		   && (len == DIRENT_MAXLEN || dirs[i].d_name[len] == '\0')) return i;
+	}
+	return -1;
+}
+
+#if defined(__SSE2__)
+/**
+ * @brief find a name among the entries of a directory sector with SSE2, one entry per compare
+ * @param dirs the entries of the sector
+ * @param i the first entry to compare
+ * @param count the number of entries in dirs
+ * @param key the name, laid out as a direntv6
+ * @param mask the bytes of an entry to compare, one bit per byte
+ * @return the position of the first used entry from i with this name; -1 if there is none
+ */
+static int direntv6_match_sse2(const struct direntv6 *dirs, int i, int count, const struct direntv6 *key, uint32_t mask){
+	__m128i key128 = _mm_loadu_si128((const __m128i *)key);
+	for(; i < count; ++i){
+		__m128i v = _mm_loadu_si128((const __m128i *)&dirs[i]);
+		uint32_t eq = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, key128));
+		if((eq & mask) == mask && dirs[i].d_inumber != 0) return i;
+	}
+	return -1;
+}
+#endif
+
+#if defined(DIRENTV6_AVX2)
+/**
+ * @brief find a name among the entries of a directory sector with AVX2, two entries per
+ *        compare. The function is built for AVX2 whatever the compiler flags, so it must
+ *        only be called when the CPU has it.
+ * @param dirs the entries of the sector
+ * @param count the number of entries in dirs
+ * @param key the name, laid out as a direntv6
+ * @param mask the bytes of an entry to compare, one bit per byte
+ * @return the position of the first used entry with this name; -1 if there is none
  */
-int direntv6_dirlookup_core(const struct unix_filesystem *u, uint16_t inr, const char *entry, size_t size){
+__attribute__((target("avx2")))
+static int direntv6_match_avx2(const struct direntv6 *dirs, int count, const struct direntv6 *key, uint32_t mask){
+	__m256i key256 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)key));
 	int i = 0;
-	while(entry[i] == PATH_TOKEN){
-		 ++i;
-		 --size;
-	 }//first, get rid of leading '/'
-		
-	if(size == 0){
-		return inr;
+	for(; i + 1 < count; i += 2){
+		__m256i v = _mm256_loadu_si256((const __m256i *)&dirs[i]);
+		uint32_t eq = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, key256));
+		if((eq & mask) == mask && dirs[i].d_inumber != 0) return i;
+		if(((eq >> 16) & mask) == mask && dirs[i+1].d_inumber != 0) return i + 1;
 	}
-	const char* clean_entry = &entry[i];		
-	char* ret = strchr(clean_entry, PATH_TOKEN);//ret points on the first '/' in the "cleaned" entry
+	return direntv6_match_sse2(dirs, i, count, key, mask);
+}
+#endif
+
+/**
+ * @brief find a name among the entries of a directory sector.
+ *        Each 16-byte entry is compared at once with a key holding the name
+ *        (and its '\0' if shorter than DIRENT_MAXLEN); the bytes of the inode
+ *        number and those after the '\0' are ignored.
+ *        Uses AVX2 (two entries per compare) when the CPU has it, which is checked
+ *        at run time, SSE2 otherwise, and direntv6_match_scalar on other targets.
+ * @param dirs the entries of the sector
+ * @param count the number of entries in dirs
+ * @param name the name to search (not necessarily null-terminated)
+ * @param len the length of name
+ * @return the position of the first used entry with this name; -1 if there is none
+ */
+int direntv6_match(const struct direntv6 *dirs, int count, const char *name, size_t len){
+#if defined(__SSE2__)
+	if(dirs == NULL || name == NULL || len == 0 || len > DIRENT_MAXLEN) return -1;
 	
-	char next_entry[MAXPATHLEN_UV6+1];
+	//build the key with the same layout as a direntv6, and the mask of the bytes to compare
+	struct direntv6 key;
+	memset(&key, 0, sizeof(key));
+	memcpy(key.d_name, name, len);
+	size_t cmp_len = len < DIRENT_MAXLEN ? len + 1 : DIRENT_MAXLEN;
+	uint32_t mask = ((UINT32_C(1) << cmp_len) - 1) << sizeof(key.d_inumber);
+#if defined(DIRENTV6_AVX2)
+	if(__builtin_cpu_supports("avx2")) return direntv6_match_avx2(dirs, count, &key, mask);
+#endif
+	return direntv6_match_sse2(dirs, 0, count, &key, mask);
+#else
+	return direntv6_match_scalar(dirs, count, name, len);
+#endif
+}
+
+/**
+ * @brief return the length of the name of a directory entry
+ * @param name the name, null-terminated unless it has DIRENT_MAXLEN chars
+ * @return the length of the name
+ */
+static size_t direntv6_namelen(const char *name){
+	size_t l = 0;
+	while(l < DIRENT_MAXLEN && name[l] != '\0') ++l;
+	return l;
+}
+
+/**
+ * @brief build the in-memory index of a directory by reading it once, without the cache
+ *        lock (the caller holds the lock of the directory); it is then put in the table
+ *        with dirindex_install
+ * @param d a directory reader just opened on the directory
+ * @return the new index; NULL if it could not be built
+ */
+static struct dirindex *direntv6_build_index(struct directory_reader *d){
+	struct dirindex *idx = dirindex_create(d->fv6.i_number);
+	if(idx == NULL) return NULL;
 	
-	if(ret != NULL){
-		strncpy(next_entry, ret, MAXPATHLEN_UV6+1);
-		ret[0] = '\0';//now, "clean_entry" just contain the name of the next thing to search
-	}else{
-		strcpy(next_entry, "");
+	struct direntv6 dirs[DIRENTRIES_PER_SECTOR];
+	int readBytes;
+	uint16_t slot = 0;
+	while((readBytes = filev6_readblock(&d->fv6, dirs)) > 0){
+		for(int i = 0; i < readBytes / (int)sizeof(struct direntv6); ++i, ++slot){
+			if(dirs[i].d_inumber == 0) continue;//free slot
+			if(dirindex_add(idx, dirs[i].d_name, direntv6_namelen(dirs[i].d_name), dirs[i].d_inumber, slot) < 0){
+				readBytes = ERR_NOMEM;
+				break;
+			}
+		}
+		if(readBytes < 0) break;
 	}
 	
+	if(readBytes < 0){
+		dirindex_destroy(idx);
+		return NULL;
+	}
+	return idx;
+}
+
+/**
+ * @brief find the inode number of a given name in a given directory, using the
+ *        index of the directory if it has one (or is large enough to get one)
+ * @param u a mounted filesystem
+ * @param inr the inode number of the directory
+ * @param name the name to search (not necessarily null-terminated)
+ * @param len the length of name
+ * @return the inode number on success; ERR_INODE_OUTOF_RANGE if the name is absent; <0 on error
+ */
+static int direntv6_find_entry(const struct unix_filesystem *u, uint16_t inr, const char *name, size_t len){
+	//such a name cannot be in a directory
+	if(len > DIRENT_MAXLEN) return ERR_INODE_OUTOF_RANGE;
+	
+	//an index is used (and may be evicted by other threads) only with the cache lock held
+	fslock_caches(u);
+	struct dirindex *idx = dirindex_get(u->dindex, inr);
+	int child = idx != NULL ? dirindex_find(idx, name, len, NULL) : 0;
+	fslock_caches_unlock(u);
+	if(idx != NULL) return child;
+	
 	struct directory_reader d;
-	char name[DIRENT_MAXLEN+1];
 	int err = direntv6_opendir(u, inr, &d);//Open the directory
 	if (err<0) return err;
 	
-	int success;
-	do{
-		success = direntv6_readdir(&d, name, &d.fv6.i_number);
-	}while(strcmp(name, clean_entry) != 0 && success == 1);//We check if the next file/dir in the entry exist
-	if (success<0) return success;
-	
-	if(strcmp(name, clean_entry) != 0)
-		return ERR_INODE_OUTOF_RANGE;//file with this name doesn't exist
-	else{
-		return direntv6_dirlookup_core(u, d.fv6.i_number, next_entry, strlen(next_entry));//we found, the next file/dir, recurse !
-	}	
+	//large directories are indexed once instead of being scanned at every lookup
+	if(inode_getsize(&d.fv6.i_node) > DIRINDEX_THRESHOLD * (int)sizeof(struct direntv6)){
+		idx = direntv6_build_index(&d);
+		if(idx != NULL){
+			fslock_caches(u);
+			idx = dirindex_install(u->dindex, idx);//another thread may have built one meanwhile
+			if(idx != NULL) child = dirindex_find(idx, name, len, NULL);
+			fslock_caches_unlock(u);
+			if(idx != NULL) return child;
+		}
+		
+		err = direntv6_opendir(u, inr, &d);//the index could not be built: scan from the beginning
+		if (err<0) return err;
+	}
+	
+	//compare the name with a whole sector of entries at once
+	struct direntv6 dirs[DIRENTRIES_PER_SECTOR];
+	int readBytes;
+	while((readBytes = filev6_readblock(&d.fv6, dirs)) > 0){
+		int i = direntv6_match(dirs, readBytes / (int)sizeof(struct direntv6), name, len);
+		if(i >= 0) return dirs[i].d_inumber;
+	}
+	return readBytes < 0 ? readBytes : ERR_INODE_OUTOF_RANGE;
 }
+
 /**
- * @brief get the inode number for the given path
+ * @brief get the inode number of one entry of a directory, through the dentry cache
  * @param u a mounted filesystem
- * @param inr the current of the subtree
- * @param entry the prefix to the subtree
+ * @param inr the inode number of the directory
+ * @param name the name of the entry (not necessarily null-terminated)
+ * @param len the length of name
+ * @return the inode number on success; <0 on error
+ */
+static int direntv6_lookup_name(const struct unix_filesystem *u, uint16_t inr, const char *name, size_t len){
+	//If the entry is in the dentry cache, there is no need to read the directory
+	fslock_caches(u);
+	int child = dcache_lookup(u->dcache, inr, name, len);
+	fslock_caches_unlock(u);
+	if(child != 0) return child;
+	
+	child = direntv6_find_entry(u, inr, name, len);
+	fslock_caches(u);
+	if(child == ERR_INODE_OUTOF_RANGE){
+		//remember the absence so that the next probe does not rescan the directory
+		dcache_insert_negative(u->dcache, inr, name, len);
+	}else if(child > 0){
+		dcache_insert(u->dcache, inr, name, len, (uint16_t)child);
+	}
+	fslock_caches_unlock(u);
+	return child;
+}
+
+/**
+ * @brief get the inode number for the first len chars of a path, starting from a given directory.
+ *        The path is walked one component at a time, without being copied nor modified.
+ * @param u a mounted filesystem
+ * @param inr the directory the path is relative to (e.g. ROOT_INUMBER or a cached ancestor)
+ * @param entry the path
+ * @param len the number of chars of entry to resolve
  * @return inr on success; <0 on error
  */
-int direntv6_dirlookup(const struct unix_filesystem *u, uint16_t inr, const char *entry){
+int direntv6_walk(const struct unix_filesystem *u, uint16_t inr, const char *entry, size_t len){
 	M_REQUIRE_NON_NULL(u);
 	M_REQUIRE_NON_NULL(entry);
 	
@@ -208,7 +499,89 @@ int direntv6_dirlookup(const struct unix_filesystem *u, uint16_t inr, const char
 		return ERR_IO;
 	}
 	
-	return direntv6_dirlookup_core(u, inr, entry, strlen(entry));
+	const char *end = entry + len;
+	const char *p = entry;
+	int current = inr;
+	while(p < end && *p != '\0'){
+		//skip the '/' between two components
+		if(*p == PATH_TOKEN){
+			++p;
+		}else{
+			const char *name = p;
+			while(p < end && *p != '\0' && *p != PATH_TOKEN) ++p;
+			
+			current = direntv6_lookup_name(u, (uint16_t)current, name, (size_t)(p - name));
+			if(current < 0) return current;
+		}
+	}
+	return current;
+}
+
+/**
+ * @brief get the inode number for the given path
+ * @param u a mounted filesystem
+ * @param inr the current of the subtree
+ * @param entry the prefix to the subtree
+ * @return inr on success; <0 on error
+ */
+int direntv6_dirlookup(const struct unix_filesystem *u, uint16_t inr, const char *entry){
+	M_REQUIRE_NON_NULL(entry);
+	return direntv6_walk(u, inr, entry, strlen(entry));
+}
+
+/**
+ * @brief scan a directory once to check that a name is absent from it and to
+ *        find the slot of a new entry (the first free one, or the end of the directory)
+ * @param u a mounted filesystem
+ * @param dir the opened directory (its offset is changed)
+ * @param name the name of the new entry
+ * @param len the length of name
+ * @param check_name 0 if the name is already known to be absent
+ * @param slot the slot of the new entry (OUT)
+ * @return 0 on success; ERR_FILENAME_ALREADY_EXISTS if the name is present; <0 on error
+ */
+static int direntv6_find_free_slot(const struct unix_filesystem *u, struct filev6 *dir, const char *name, size_t len,
+                                   int check_name, uint32_t *slot){
+	uint32_t nslots = inode_getsize(&dir->i_node) / sizeof(struct direntv6);
+	//all the slots before the hint are known to be used
+	fslock_caches(u);
+	uint32_t hint = dirindex_free_hint(u->dindex, dir->i_number);
+	fslock_caches_unlock(u);
+	*slot = nslots;
+	
+	if(nslots == 0 || (!check_name && hint >= nslots)) return 0;//no need to read the directory at all
+	
+	//without the name to check, the scan starts at the sector of the hint
+	uint32_t base = check_name ? 0 : hint - hint % DIRENTRIES_PER_SECTOR;
+	int err = filev6_lseek(dir, base * sizeof(struct direntv6));
+	if(err < 0) return err;
+	
+	struct direntv6 dirs[DIRENTRIES_PER_SECTOR];
+	int readBytes;
+	while((readBytes = filev6_readblock(dir, dirs)) > 0){
+		int n = readBytes / (int)sizeof(struct direntv6);
+		if(check_name && direntv6_match(dirs, n, name, len) >= 0) return ERR_FILENAME_ALREADY_EXISTS;
+		
+		for(int i = 0; i < n && *slot == nslots; ++i){
+			if(base + i >= hint && dirs[i].d_inumber == 0) *slot = base + i;
+		}
+		if(!check_name && *slot < nslots) return 0;
+		base += n;
+	}
+	return readBytes < 0 ? readBytes : 0;
+}
+
+/**
+ * @brief overwrite one entry of a directory in place
+ * @param u a mounted filesystem
+ * @param dir the opened directory
+ * @param slot the position of the entry in the directory
+ * @param d the new content of the entry
+ * @return 0 on success; <0 on error
+ */
+static int direntv6_write_slot(struct unix_filesystem *u, struct filev6 *dir, uint32_t slot, const struct direntv6 *d){
+	//the slot may lie in a hole, which then gets a sector
+	return filev6_writeat(u, dir, d, (int)sizeof(struct direntv6), (int32_t)(slot * sizeof(struct direntv6)));
 }
 
 /**
@@ -225,87 +598,271 @@ int direntv6_create(struct unix_filesystem *u, const char *entry, uint16_t mode)
 		debug_print("File system not mounted");
 		return ERR_IO;
 	}
-	unsigned int l = strlen(entry);
-	//if the given name doesn't begin with a '/' add it at the beginning of realPath
-	short unsigned int startByToken=1;
-	if (entry[0]!=PATH_TOKEN){
-		++l;
-		startByToken=0;
-	}
-	unsigned int lastToken = 0;
-	short unsigned int isToken = 0;
-	char realPath[l + 1];
-	unsigned int size = 0;
-	if (!startByToken){
-		realPath[0]=PATH_TOKEN;
-		++size;
-	}
-	//copy the entry ignoring multiple '/' in realPath
-	for (unsigned int i = 0; i < l && size < MAXPATHLEN_UV6; ++i){
-		if (!isToken || entry[i] != PATH_TOKEN){
-			if (entry[i] != PATH_TOKEN) isToken = 0;
-			else if (entry[i] == PATH_TOKEN){
-				isToken = 1;
-				lastToken = size;
-			}
-			realPath[size] = entry[i];
-			size++;
-		}
-	}
-	realPath[size] = '\0';
-	int nameSize = size - lastToken;
-	if (size-1==lastToken){//the name ends with a '/'
-		return ERR_BAD_PARAMETER;
-	}
 	
-	if (nameSize - 1 > DIRENT_MAXLEN || size > MAXPATHLEN_UV6){//name or path too long
-		return ERR_FILENAME_TOO_LONG;
-	}
+	//split the path into the parent and the name, without copying it
+	size_t l = strlen(entry);
+	if (l > MAXPATHLEN_UV6) return ERR_FILENAME_TOO_LONG;
+	const char *slash = strrchr(entry, PATH_TOKEN);
+	const char *name = slash == NULL ? entry : slash + 1;
+	size_t parent_len = (size_t)(name - entry);
+	size_t name_len = l - parent_len;
+	if (name_len == 0) return ERR_BAD_PARAMETER;//the name ends with a '/'
+	if (name_len > DIRENT_MAXLEN) return ERR_FILENAME_TOO_LONG;
 	
-	//getting the parent name
-	char parent[lastToken+1];
-	strncpy(parent, realPath, lastToken+1);
-	parent[lastToken]='\0';
+	//the parent is resolved only once
+	int parent_inr = direntv6_walk(u, ROOT_INUMBER, entry, parent_len);
+	if (parent_inr < 0) return ERR_BAD_PARAMETER;
 	
-	//getting the file name
-	char name[DIRENT_MAXLEN];
-	strncpy(name, realPath + lastToken + 1, DIRENT_MAXLEN);
+	return direntv6_create_in(u, (uint16_t)parent_inr, name, name_len, mode);
+}
+
+/**
+ * @brief create a new entry in a given directory, within an operation (see direntv6_create_in)
+ * @param u a mounted filesystem
+ * @param parent_inr the inode number of the parent directory
+ * @param name the name of the new entry (checked)
+ * @param name_len the length of name
+ * @param mode the mode of the new inode
+ * @return inr on success; <0 on error
+ */
+static int direntv6_add_entry(struct unix_filesystem *u, uint16_t parent_inr, const char *name, size_t name_len, uint16_t mode){
+	//open the parent, which must be a directory
+	struct directory_reader dir;
+	int err = direntv6_opendir(u, parent_inr, &dir);
+	if (err < 0) return err;
+	struct filev6 *fv6_parent = &dir.fv6;
+	
+	//the dentry cache or the index of the parent may already know whether the name exists
+	int check_name = 1;
+	int indexed = 0;
+	fslock_caches(u);
+	int known = dcache_lookup(u->dcache, parent_inr, name, name_len);
+	if (known == ERR_INODE_OUTOF_RANGE) check_name = 0;
 	
-	//tests if a file with the same name already exists
-	if(direntv6_dirlookup(u, ROOT_INUMBER, realPath) >= 0)
-		return ERR_FILENAME_ALREADY_EXISTS;
+	struct dirindex *idx = dirindex_get(u->dindex, parent_inr);
+	int build = known <= 0 && idx == NULL && inode_getsize(&fv6_parent->i_node) > DIRINDEX_THRESHOLD * (int)sizeof(struct direntv6);
+	if (known <= 0 && idx != NULL){
+		if (check_name && dirindex_find(idx, name, name_len, NULL) > 0) known = 1;
+		check_name = 0;
+		indexed = 1;
+	}
+	fslock_caches_unlock(u);
 	
-	//check if the parent directory exists
-	int parent_inr;
-	if ((parent_inr = direntv6_dirlookup(u, ROOT_INUMBER, parent)) < 0){
-		return ERR_BAD_PARAMETER;
+	//the parent is read without the cache lock, and its index installed then
+	idx = build ? direntv6_build_index(&dir) : NULL;
+	if (idx != NULL){
+		fslock_caches(u);
+		idx = dirindex_install(u->dindex, idx);
+		if (idx != NULL){
+			if (check_name && dirindex_find(idx, name, name_len, NULL) > 0) known = 1;
+			check_name = 0;
+			indexed = 1;
+		}
+		fslock_caches_unlock(u);
 	}
+	if (known > 0) return ERR_FILENAME_ALREADY_EXISTS;
+	
+	//a single scan (if any) checks the name and finds the slot of the new entry
+	uint32_t slot;
+	err = direntv6_find_free_slot(u, fv6_parent, name, name_len, check_name, &slot);
+	if (err < 0) return err;
+	
+	//the parent is about to change: drop what is cached about the name
+	fslock_caches(u);
+	dcache_invalidate(u->dcache, parent_inr, name, name_len);
+	fslock_caches_unlock(u);
 	
 	int inr = inode_alloc(u);
 	if (inr<0) return inr;
 	
-	int err;
-	
 	//We use filev6_create for the inode write
 	struct filev6 fv6;
 	fv6.i_number = (uint16_t)inr;
 	err = filev6_create(u, mode, &fv6);
 	if(err < 0) return err;
 	
-	//open the fv6 of the parent
-	struct filev6 fv6_parent;
-	err = filev6_open(u, (uint16_t)parent_inr, &fv6_parent);
-	if(err < 0) return err;
-	
-	nameSize = nameSize > DIRENT_MAXLEN ? DIRENT_MAXLEN : nameSize;
-	
 	//create the corresponding direntv6
 	struct direntv6 d;
+	memset(&d, 0, sizeof(d));
 	d.d_inumber = (uint16_t)inr;
-	strncpy(d.d_name, name, nameSize);
+	memcpy(d.d_name, name, name_len);
 	
-	//write the direntv6 to the parent
-	err = filev6_writebytes(u, &fv6_parent, &d, (int)sizeof(struct direntv6));
+	//reuse a free slot in place, or append the entry to the parent
+	if (slot < inode_getsize(&fv6_parent->i_node) / sizeof(struct direntv6)){
+		err = direntv6_write_slot(u, fv6_parent, slot, &d);
+	}else{
+		err = filev6_writebytes(u, fv6_parent, &d, (int)sizeof(struct direntv6));
+	}
 	if(err < 0) return err;
+	
+	//the new entry can be found without reading the parent again
+	fslock_caches(u);
+	dirindex_set_free_hint(u->dindex, parent_inr, slot + 1);
+	dcache_insert(u->dcache, parent_inr, name, name_len, (uint16_t)inr);
+	//the index may have been evicted meanwhile: it is looked up again
+	idx = indexed ? dirindex_get(u->dindex, parent_inr) : NULL;
+	if(idx != NULL && dirindex_add(idx, name, name_len, (uint16_t)inr, (uint16_t)slot) < 0)
+		dirindex_drop(u->dindex, parent_inr);//an incomplete index must not be used
+	fslock_caches_unlock(u);
 	return inr;
 }
+
+/**
+ * @brief create a new direntv6 with the given name and given mode in a given directory
+ * @param u a mounted filesystem
+ * @param parent_inr the inode number of the parent directory
+ * @param name the name of the new entry (not necessarily null-terminated)
+ * @param name_len the length of name
+ * @param mode the mode of the new inode
+ * @return inr on success; <0 on error
+ */
+int direntv6_create_in(struct unix_filesystem *u, uint16_t parent_inr, const char *name, size_t name_len, uint16_t mode){
+	M_REQUIRE_NON_NULL(u);
+	M_REQUIRE_NON_NULL(name);
+	if (u->f ==  NULL) {
+		debug_print("File system not mounted");
+		return ERR_IO;
+	}
+	if (name_len == 0 || memchr(name, PATH_TOKEN, name_len) != NULL) return ERR_BAD_PARAMETER;
+	if (name_len > DIRENT_MAXLEN) return ERR_FILENAME_TOO_LONG;
+	
+	//the new inode and the new entry reach the disk together
+	writeback_begin(u);
+	int inr = direntv6_add_entry(u, parent_inr, name, name_len, mode);
+	writeback_end(u);
+	return inr;
+}
+
+/**
+ * @brief remove an entry from a given directory, within an operation (see direntv6_unlink_in)
+ * @param u a mounted filesystem
+ * @param parent_inr the inode number of the parent directory
+ * @param name the name of the entry (checked)
+ * @param name_len the length of name
+ * @param dir 1 if the entry must be an empty directory (rmdir); 0 if it must not be a directory (unlink)
+ * @return the inode number of the removed entry on success; <0 on error
+ */
+static int direntv6_remove_entry(struct unix_filesystem *u, uint16_t parent_inr, const char *name, size_t name_len, int dir){
+	struct directory_reader d;
+	int err = direntv6_opendir(u, parent_inr, &d);
+	if (err < 0) return err;
+	
+	//the index of the parent knows the slot of the entry; otherwise the parent is scanned
+	int child = ERR_INODE_OUTOF_RANGE;
+	uint32_t slot = 0;
+	fslock_caches(u);
+	struct dirindex *idx = dirindex_get(u->dindex, parent_inr);
+	if (idx != NULL){
+		uint16_t islot = UINT16_MAX;
+		child = dirindex_find(idx, name, name_len, &islot);
+		slot = islot;
+	}
+	fslock_caches_unlock(u);
+	if (idx == NULL){
+		struct direntv6 dirs[DIRENTRIES_PER_SECTOR];
+		int readBytes;
+		while ((readBytes = filev6_readblock(&d.fv6, dirs)) > 0){
+			int n = readBytes / (int)sizeof(struct direntv6);
+			int i = direntv6_match(dirs, n, name, name_len);
+			if (i >= 0){
+				child = dirs[i].d_inumber;
+				slot += (uint32_t)i;
+				break;
+			}
+			slot += (uint32_t)n;
+		}
+		if (readBytes < 0) return readBytes;
+	}
+	if (child < 0) return child;
+	if (child == ROOT_INUMBER) return ERR_BAD_PARAMETER;
+	
+	//the kind of the entry must match the operation; a directory must be empty
+	struct directory_reader cd;
+	err = direntv6_opendir(u, (uint16_t)child, &cd);
+	if (err < 0 && err != ERR_INVALID_DIRECTORY_INODE) return err;
+	if (dir && err == ERR_INVALID_DIRECTORY_INODE) return err;
+	if (!dir && err == 0) return ERR_BAD_PARAMETER;
+	if (dir){
+		char cname[DIRENT_MAXLEN + 1];
+		uint16_t cinr;
+		err = direntv6_readdir(&cd, cname, &cinr);
+		if (err < 0) return err;
+		if (err > 0) return ERR_DIRECTORY_NOT_EMPTY;
+	}
+	
+	//the slot is freed in place
+	struct direntv6 empty;
+	memset(&empty, 0, sizeof(empty));
+	err = direntv6_write_slot(u, &d.fv6, slot, &empty);
+	if (err < 0) return err;
+	
+	fslock_caches(u);
+	dcache_invalidate(u->dcache, parent_inr, name, name_len);
+	idx = dirindex_get(u->dindex, parent_inr);
+	if (idx != NULL && dirindex_remove(idx, name, name_len) < 0) dirindex_drop(u->dindex, parent_inr);
+	//the freed slot is the first one a new entry can reuse
+	if (slot < dirindex_free_hint(u->dindex, parent_inr)) dirindex_set_free_hint(u->dindex, parent_inr, slot);
+	if (dir){
+		//the inode number may come back as another directory, or as a file
+		dcache_invalidate_dir(u->dcache, (uint16_t)child);
+		dirindex_drop(u->dindex, (uint16_t)child);
+		if (dirindex_free_hint(u->dindex, (uint16_t)child) > 0) dirindex_set_free_hint(u->dindex, (uint16_t)child, 0);
+	}
+	fslock_caches_unlock(u);
+	return child;
+}
+
+/**
+ * @brief remove an entry from a given directory; the inode of the entry is not freed
+ * @param u a mounted filesystem
+ * @param parent_inr the inode number of the parent directory
+ * @param name the name of the entry (not necessarily null-terminated)
+ * @param name_len the length of name
+ * @param dir 1 if the entry must be an empty directory (rmdir); 0 if it must not be a directory (unlink)
+ * @return the inode number of the removed entry on success; <0 on error
+ */
+int direntv6_unlink_in(struct unix_filesystem *u, uint16_t parent_inr, const char *name, size_t name_len, int dir){
+	M_REQUIRE_NON_NULL(u);
+	M_REQUIRE_NON_NULL(name);
+	if (u->f ==  NULL) {
+		debug_print("File system not mounted");
+		return ERR_IO;
+	}
+	if (name_len == 0 || name_len > DIRENT_MAXLEN) return ERR_INODE_OUTOF_RANGE;
+	
+	writeback_begin(u);
+	int child = direntv6_remove_entry(u, parent_inr, name, name_len, dir);
+	writeback_end(u);
+	return child;
+}
+
+/**
+ * @brief remove a file or an empty directory, and free its inode and its sectors
+ * @param u a mounted filesystem
+ * @param entry the path of the entry
+ * @param dir 1 to remove an empty directory (rmdir); 0 to remove a file (unlink)
+ * @return 0 on success; <0 on error
+ */
+int direntv6_unlink(struct unix_filesystem *u, const char *entry, int dir){
+	M_REQUIRE_NON_NULL(u);
+	M_REQUIRE_NON_NULL(entry);
+	
+	//split the path into the parent and the name, as direntv6_create does
+	size_t l = strlen(entry);
+	if (l > MAXPATHLEN_UV6) return ERR_FILENAME_TOO_LONG;
+	const char *slash = strrchr(entry, PATH_TOKEN);
+	const char *name = slash == NULL ? entry : slash + 1;
+	size_t parent_len = (size_t)(name - entry);
+	
+	int parent_inr = direntv6_walk(u, ROOT_INUMBER, entry, parent_len);
+	if (parent_inr < 0) return parent_inr;
+	
+	//the entry and the inode go away together
+	writeback_begin(u);
+	int inr = direntv6_unlink_in(u, (uint16_t)parent_inr, name, l - parent_len, dir);
+	struct filev6 fv6;
+	int err = inr < 0 ? inr : filev6_open(u, (uint16_t)inr, &fv6);
+	if (err == 0) err = filev6_delete(u, &fv6);
+	writeback_end(u);
+	return err;
+}
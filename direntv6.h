@@ -25,6 +25,15 @@ struct directory_reader {
 	struct direntv6 dirs[DIRENTRIES_PER_SECTOR];
 	int curr;
 	int last;
+	uint32_t slot; // position (in direntv6 units) of the next entry in the directory
+};
+
+struct direntv6_plus {
+	char name[DIRENT_MAXLEN+1]; // null-terminated name of the entry
+	uint16_t inr;               // inode number of the entry
+	uint32_t next;              // position of the entry after this one, as given by direntv6_telldir
+	int err;                    // 0 if inode was read; <0 error otherwise
+	struct inode inode;         // content of the inode of the entry
 };
 
 /**
@@ -45,6 +54,32 @@ int direntv6_opendir(const struct unix_filesystem *u, uint16_t inr, struct direc
  */
 int direntv6_readdir(struct directory_reader *d, char *name, uint16_t *child_inr);
 
+/**
+ * @brief move a directory reader to a given entry, reading at most one sector
+ * @param d the directory reader
+ * @param slot the position (in direntv6 units) of the next entry to read
+ * @return 0 on success; <0 on error
+ */
+int direntv6_seekdir(struct directory_reader *d, uint32_t slot);
+
+/**
+ * @brief return the position of the next entry a directory reader will read
+ * @param d the directory reader
+ * @return the position (in direntv6 units), to be given to direntv6_seekdir
+ */
+uint32_t direntv6_telldir(const struct directory_reader *d);
+
+/**
+ * @brief return the next directory entries together with the content of their inodes.
+ *        The inodes are read in the order of the inode table, so that each sector
+ *        of the table is read once per call however many entries it holds.
+ * @param d the directory reader
+ * @param entries array of at least max entries, filled in (OUT)
+ * @param max the maximal number of entries to return
+ * @return the number of entries returned (0 if there are no more entries to read); <0 on error
+ */
+int direntv6_readdirplus(struct directory_reader *d, struct direntv6_plus *entries, int max);
+
 /**
  * @brief debugging routine; print the a subtree (note: recursive)
  * @param u a mounted filesystem
@@ -63,6 +98,37 @@ int direntv6_print_tree(const struct unix_filesystem *u, uint16_t inr, const cha
  */
 int direntv6_dirlookup(const struct unix_filesystem *u, uint16_t inr, const char *entry);
 
+/**
+ * @brief get the inode number for the first len chars of a path, starting from a given directory
+ * @param u a mounted filesystem
+ * @param inr the directory the path is relative to (e.g. ROOT_INUMBER or a cached ancestor)
+ * @param entry the path (not modified)
+ * @param len the number of chars of entry to resolve
+ * @return inr on success; <0 on error
+ */
+int direntv6_walk(const struct unix_filesystem *u, uint16_t inr, const char *entry, size_t len);
+
+/**
+ * @brief find a name among the entries of a directory sector
+ * @param dirs the entries of the sector
+ * @param count the number of entries in dirs
+ * @param name the name to search (not necessarily null-terminated)
+ * @param len the length of name
+ * @return the position of the first used entry with this name; -1 if there is none
+ */
+int direntv6_match(const struct direntv6 *dirs, int count, const char *name, size_t len);
+
+/**
+ * @brief find a name among the entries of a directory sector, one entry at a time
+ *        (direntv6_match gives the same result, with SIMD where available)
+ * @param dirs the entries of the sector
+ * @param count the number of entries in dirs
+ * @param name the name to search (not necessarily null-terminated)
+ * @param len the length of name
+ * @return the position of the first used entry with this name; -1 if there is none
+ */
+int direntv6_match_scalar(const struct direntv6 *dirs, int count, const char *name, size_t len);
+
 /**
  * @brief create a new direntv6 with the given name and given mode
  * @param u a mounted filesystem
@@ -72,6 +138,37 @@ int direntv6_dirlookup(const struct unix_filesystem *u, uint16_t inr, const char
  */
 int direntv6_create(struct unix_filesystem *u, const char *entry, uint16_t mode);
 
+/**
+ * @brief create a new direntv6 with the given name and given mode in a given directory
+ * @param u a mounted filesystem
+ * @param parent_inr the inode number of the parent directory
+ * @param name the name of the new entry (not necessarily null-terminated)
+ * @param name_len the length of name
+ * @param mode the mode of the new inode
+ * @return inr on success; <0 on error
+ */
+int direntv6_create_in(struct unix_filesystem *u, uint16_t parent_inr, const char *name, size_t name_len, uint16_t mode);
+
+/**
+ * @brief remove an entry from a given directory; the inode of the entry is not freed
+ * @param u a mounted filesystem
+ * @param parent_inr the inode number of the parent directory
+ * @param name the name of the entry (not necessarily null-terminated)
+ * @param name_len the length of name
+ * @param dir 1 if the entry must be an empty directory (rmdir); 0 if it must not be a directory (unlink)
+ * @return the inode number of the removed entry on success; <0 on error
+ */
+int direntv6_unlink_in(struct unix_filesystem *u, uint16_t parent_inr, const char *name, size_t name_len, int dir);
+
+/**
+ * @brief remove a file or an empty directory, and free its inode and its sectors
+ * @param u a mounted filesystem
+ * @param entry the path of the entry
+ * @param dir 1 to remove an empty directory (rmdir); 0 to remove a file (unlink)
+ * @return 0 on success; <0 on error
+ */
+int direntv6_unlink(struct unix_filesystem *u, const char *entry, int dir);
+
 /**
  * @brief check if a directory reader is non-empty
  * @param d the directory reader
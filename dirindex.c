@@ -0,0 +1,284 @@
+#include <stdlib.h>
+#include <string.h>
+#include "dirindex.h"
+#include "error.h"
+
+#define DIRINDEX_MIN_CAPACITY 256
+
+/**
+ * @brief build the key of an entry, i.e. its name padded with '\0'
+ * @param name the name of the entry
+ * @param len the length of name
+ * @param key DIRENT_MAXLEN bytes filled with the padded name (OUT)
+ * @return 0 on success; -1 if the name cannot be a directory entry
+ */
+static int dirindex_make_key(const char *name, size_t len, char *key){
+	if(len == 0 || len > DIRENT_MAXLEN) return -1;
+	memset(key, 0, DIRENT_MAXLEN);
+	memcpy(key, name, len);
+	return 0;
+}
+
+/**
+ * @brief compute the bucket where the search of a given key starts (FNV-1a hash)
+ * @param idx the index
+ * @param key the padded name
+ * @return the index of the bucket
+ */
+static uint32_t dirindex_bucket(const struct dirindex *idx, const char *key){
+	uint32_t h = UINT32_C(2166136261);
+	for(int i = 0; i < DIRENT_MAXLEN && key[i] != '\0'; ++i){
+		h = (h ^ (uint8_t)key[i]) * UINT32_C(16777619);
+	}
+	return h & (idx->capacity - 1);
+}
+
+/**
+ * @brief return the bucket holding a given key, or the empty bucket where it would be inserted
+ * @param idx the index
+ * @param key the padded name
+ * @return a pointer to the bucket
+ */
+static struct dirindex_entry *dirindex_probe(const struct dirindex *idx, const char *key){
+	//linear probing; the table is never full thanks to dirindex_grow
+	uint32_t b = dirindex_bucket(idx, key);
+	while(idx->entries[b].inr != 0 && memcmp(idx->entries[b].name, key, DIRENT_MAXLEN) != 0){
+		b = (b + 1) & (idx->capacity - 1);
+	}
+	return &idx->entries[b];
+}
+
+/**
+ * @brief double the number of buckets of an index and rehash its entries
+ * @param idx the index
+ * @return 0 on success; <0 on error
+ */
+static int dirindex_grow(struct dirindex *idx){
+	struct dirindex_entry *old = idx->entries;
+	uint32_t old_capacity = idx->capacity;
+	uint32_t capacity = old_capacity ? 2 * old_capacity : DIRINDEX_MIN_CAPACITY;
+
+	struct dirindex_entry *entries = calloc(capacity, sizeof(struct dirindex_entry));
+	if(entries == NULL) return ERR_NOMEM;
+
+	idx->entries = entries;
+	idx->capacity = capacity;
+	for(uint32_t i = 0; i < old_capacity; ++i){
+		if(old[i].inr != 0) *dirindex_probe(idx, old[i].name) = old[i];
+	}
+	free(old);
+	return 0;
+}
+
+/**
+ * @brief free an index which is not in a table (or was evicted from it)
+ * @param idx the index (may be NULL)
+ */
+void dirindex_destroy(struct dirindex *idx){
+	if(idx != NULL){
+		free(idx->entries);
+		free(idx);
+	}
+}
+
+/**
+ * @brief allocate a new table without any index
+ * @return a pointer to the new table or NULL on failure
+ */
+struct dirindex_table *dirindex_alloc(void){
+	return calloc(1, sizeof(struct dirindex_table));
+}
+
+/**
+ * @brief free a table and all its indexes
+ * @param t the table
+ */
+void dirindex_free(struct dirindex_table *t){
+	if(t != NULL){
+		for(int i = 0; i < DIRINDEX_MAX_DIRS; ++i){
+			dirindex_destroy(t->dirs[i]);
+		}
+		free(t);
+	}
+}
+
+/**
+ * @brief return the index of a given directory, if any
+ * @param t the table (may be NULL)
+ * @param dir the inode number of the directory
+ * @return the index or NULL if the directory is not indexed
+ */
+struct dirindex *dirindex_get(struct dirindex_table *t, uint16_t dir){
+	if(t == NULL) return NULL;
+	for(int i = 0; i < DIRINDEX_MAX_DIRS; ++i){
+		if(t->dirs[i] != NULL && t->dirs[i]->dir == dir) return t->dirs[i];
+	}
+	return NULL;
+}
+
+/**
+ * @brief create an empty index for a given directory, outside of any table
+ *        (it is filled, then installed with dirindex_install)
+ * @param dir the inode number of the directory
+ * @return the new index or NULL on failure
+ */
+struct dirindex *dirindex_create(uint16_t dir){
+	struct dirindex *idx = calloc(1, sizeof(struct dirindex));
+	if(idx == NULL) return NULL;
+	idx->dir = dir;
+	if(dirindex_grow(idx) < 0){
+		free(idx);
+		return NULL;
+	}
+	return idx;
+}
+
+/**
+ * @brief put an index in a table, evicting another one if needed, unless the directory
+ *        got an index meanwhile: that one is kept and the given one is freed
+ * @param t the table
+ * @param idx an index made by dirindex_create
+ * @return the index of the directory in the table (NULL if t is NULL: idx is freed)
+ */
+struct dirindex *dirindex_install(struct dirindex_table *t, struct dirindex *idx){
+	struct dirindex *current = dirindex_get(t, idx->dir);
+	if(t == NULL || current != NULL){
+		dirindex_destroy(idx);
+		return current;
+	}
+
+	//Use a free place if there is one, otherwise evict in round-robin order
+	int i = 0;
+	while(i < DIRINDEX_MAX_DIRS && t->dirs[i] != NULL) ++i;
+	if(i == DIRINDEX_MAX_DIRS){
+		i = t->victim;
+		t->victim = (t->victim + 1) % DIRINDEX_MAX_DIRS;
+		dirindex_destroy(t->dirs[i]);
+	}
+	t->dirs[i] = idx;
+	return idx;
+}
+
+/**
+ * @brief remove and free the index of a given directory, if any
+ * @param t the table (may be NULL)
+ * @param dir the inode number of the directory
+ */
+void dirindex_drop(struct dirindex_table *t, uint16_t dir){
+	if(t == NULL) return;
+	for(int i = 0; i < DIRINDEX_MAX_DIRS; ++i){
+		if(t->dirs[i] != NULL && t->dirs[i]->dir == dir){
+			dirindex_destroy(t->dirs[i]);
+			t->dirs[i] = NULL;
+		}
+	}
+}
+
+/**
+ * @brief add an entry to an index
+ * @param idx the index
+ * @param name the name of the entry (not necessarily null-terminated)
+ * @param len the length of name
+ * @param inr the inode number of the entry
+ * @param slot the position of the entry in the directory
+ * @return 0 on success; <0 on error
+ */
+int dirindex_add(struct dirindex *idx, const char *name, size_t len, uint16_t inr, uint16_t slot){
+	M_REQUIRE_NON_NULL(idx);
+	M_REQUIRE_NON_NULL(name);
+	if(inr == 0) return ERR_BAD_PARAMETER;
+
+	char key[DIRENT_MAXLEN];
+	if(dirindex_make_key(name, len, key) < 0) return ERR_FILENAME_TOO_LONG;
+
+	//keep the load factor under 1/2
+	if(2 * (idx->count + 1) > idx->capacity){
+		int err = dirindex_grow(idx);
+		if(err < 0) return err;
+	}
+
+	struct dirindex_entry *e = dirindex_probe(idx, key);
+	if(e->inr == 0) ++idx->count;
+	e->inr = inr;
+	e->slot = slot;
+	memcpy(e->name, key, DIRENT_MAXLEN);
+	return 0;
+}
+
+/**
+ * @brief remove an entry from an index
+ * @param idx the index
+ * @param name the name of the entry (not necessarily null-terminated)
+ * @param len the length of name
+ * @return 0 on success; ERR_INODE_OUTOF_RANGE if absent
+ */
+int dirindex_remove(struct dirindex *idx, const char *name, size_t len){
+	M_REQUIRE_NON_NULL(idx);
+	M_REQUIRE_NON_NULL(name);
+	
+	char key[DIRENT_MAXLEN];
+	if(dirindex_make_key(name, len, key) < 0) return ERR_INODE_OUTOF_RANGE;
+	struct dirindex_entry *e = dirindex_probe(idx, key);
+	if(e->inr == 0) return ERR_INODE_OUTOF_RANGE;
+	
+	//no tombstone: the next entries of the run move back into the hole when
+	//it lies between their bucket and their place, so that probing still finds them
+	uint32_t mask = idx->capacity - 1;
+	uint32_t hole = (uint32_t)(e - idx->entries);
+	for(uint32_t b = (hole + 1) & mask; idx->entries[b].inr != 0; b = (b + 1) & mask){
+		uint32_t home = dirindex_bucket(idx, idx->entries[b].name);
+		if(((b - home) & mask) >= ((b - hole) & mask)){
+			idx->entries[hole] = idx->entries[b];
+			hole = b;
+		}
+	}
+	memset(&idx->entries[hole], 0, sizeof(struct dirindex_entry));
+	--idx->count;
+	return 0;
+}
+
+/**
+ * @brief find an entry in an index
+ * @param idx the index
+ * @param name the name of the entry (not necessarily null-terminated)
+ * @param len the length of name
+ * @param slot the position of the entry in the directory (OUT, may be NULL)
+ * @return the inode number of the entry; ERR_INODE_OUTOF_RANGE if absent
+ */
+int dirindex_find(const struct dirindex *idx, const char *name, size_t len, uint16_t *slot){
+	M_REQUIRE_NON_NULL(idx);
+	M_REQUIRE_NON_NULL(name);
+
+	char key[DIRENT_MAXLEN];
+	if(dirindex_make_key(name, len, key) < 0) return ERR_INODE_OUTOF_RANGE;
+
+	const struct dirindex_entry *e = dirindex_probe(idx, key);
+	if(e->inr == 0) return ERR_INODE_OUTOF_RANGE;
+	if(slot != NULL) *slot = e->slot;
+	return e->inr;
+}
+
+/**
+ * @brief return the free-slot hint of a directory
+ * @param t the table (may be NULL)
+ * @param dir the inode number of the directory
+ * @return a slot such that all the slots before it are known to be used (0 if nothing is known)
+ */
+uint32_t dirindex_free_hint(const struct dirindex_table *t, uint16_t dir){
+	if(t == NULL) return 0;
+	const struct dirindex_hint *h = &t->hints[dir & (DIRINDEX_HINTS - 1)];
+	return h->dir == dir ? h->free_slot : 0;
+}
+
+/**
+ * @brief set the free-slot hint of a directory
+ * @param t the table (may be NULL)
+ * @param dir the inode number of the directory
+ * @param slot a slot such that all the slots before it are used
+ */
+void dirindex_set_free_hint(struct dirindex_table *t, uint16_t dir, uint32_t slot){
+	if(t == NULL || slot > UINT16_MAX) return;
+	struct dirindex_hint *h = &t->hints[dir & (DIRINDEX_HINTS - 1)];
+	h->dir = dir;
+	h->free_slot = (uint16_t)slot;
+}
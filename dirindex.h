@@ -0,0 +1,145 @@
+#pragma once
+
+/**
+ * @file dirindex.h
+ * @brief in-memory hashed index of large directories: name -> (inode number, slot)
+ *
+ * An index is built the first time a directory larger than DIRINDEX_THRESHOLD
+ * entries is looked up, and is then kept up to date by direntv6_create.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "unixv6fs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DIRINDEX_THRESHOLD (4 * DIRENTRIES_PER_SECTOR) /* minimal number of entries of an indexed directory */
+#define DIRINDEX_MAX_DIRS 32                           /* maximal number of directories indexed at once */
+#define DIRINDEX_HINTS 256                             /* number of free-slot hints, must be a power of 2 */
+
+struct dirindex_entry {
+    uint16_t inr;                // inode number of the entry; 0 for an empty bucket
+    uint16_t slot;               // position of the entry in the directory (in direntv6 units)
+    char name[DIRENT_MAXLEN];    // name of the entry, padded with '\0'
+};
+
+struct dirindex {
+    uint16_t dir;                    // inode number of the indexed directory
+    uint32_t count;                  // number of entries in the index
+    uint32_t capacity;               // number of buckets, a power of 2
+    struct dirindex_entry *entries;  // open-addressing hash table
+};
+
+struct dirindex_hint {
+    uint16_t dir;                // inode number of the directory; 0 for an unused hint
+    uint16_t free_slot;          // all the slots of the directory before this one are used
+};
+
+struct dirindex_table {
+    struct dirindex *dirs[DIRINDEX_MAX_DIRS];       // indexes currently in memory (NULL if unused)
+    unsigned int victim;                            // next index to evict when the table is full
+    struct dirindex_hint hints[DIRINDEX_HINTS];     // free-slot hints of any directory, direct-mapped
+};
+
+/**
+ * @brief allocate a new table without any index
+ * @return a pointer to the new table or NULL on failure
+ */
+struct dirindex_table *dirindex_alloc(void);
+
+/**
+ * @brief free a table and all its indexes
+ * @param t the table
+ */
+void dirindex_free(struct dirindex_table *t);
+
+/**
+ * @brief return the index of a given directory, if any
+ * @param t the table (may be NULL)
+ * @param dir the inode number of the directory
+ * @return the index or NULL if the directory is not indexed
+ */
+struct dirindex *dirindex_get(struct dirindex_table *t, uint16_t dir);
+
+/**
+ * @brief create an empty index for a given directory, outside of any table
+ *        (it is filled, then installed with dirindex_install)
+ * @param dir the inode number of the directory
+ * @return the new index or NULL on failure
+ */
+struct dirindex *dirindex_create(uint16_t dir);
+
+/**
+ * @brief put an index in a table, evicting another one if needed, unless the directory
+ *        got an index meanwhile: that one is kept and the given one is freed
+ * @param t the table
+ * @param idx an index made by dirindex_create
+ * @return the index of the directory in the table (NULL if t is NULL: idx is freed)
+ */
+struct dirindex *dirindex_install(struct dirindex_table *t, struct dirindex *idx);
+
+/**
+ * @brief free an index which is not in a table (or was evicted from it)
+ * @param idx the index (may be NULL)
+ */
+void dirindex_destroy(struct dirindex *idx);
+
+/**
+ * @brief remove and free the index of a given directory, if any
+ * @param t the table (may be NULL)
+ * @param dir the inode number of the directory
+ */
+void dirindex_drop(struct dirindex_table *t, uint16_t dir);
+
+/**
+ * @brief add an entry to an index
+ * @param idx the index
+ * @param name the name of the entry (not necessarily null-terminated)
+ * @param len the length of name
+ * @param inr the inode number of the entry
+ * @param slot the position of the entry in the directory
+ * @return 0 on success; <0 on error
+ */
+int dirindex_add(struct dirindex *idx, const char *name, size_t len, uint16_t inr, uint16_t slot);
+
+/**
+ * @brief remove an entry from an index
+ * @param idx the index
+ * @param name the name of the entry (not necessarily null-terminated)
+ * @param len the length of name
+ * @return 0 on success; ERR_INODE_OUTOF_RANGE if absent
+ */
+int dirindex_remove(struct dirindex *idx, const char *name, size_t len);
+
+/**
+ * @brief find an entry in an index
+ * @param idx the index
+ * @param name the name of the entry (not necessarily null-terminated)
+ * @param len the length of name
+ * @param slot the position of the entry in the directory (OUT, may be NULL)
+ * @return the inode number of the entry; ERR_INODE_OUTOF_RANGE if absent
+ */
+int dirindex_find(const struct dirindex *idx, const char *name, size_t len, uint16_t *slot);
+
+/**
+ * @brief return the free-slot hint of a directory
+ * @param t the table (may be NULL)
+ * @param dir the inode number of the directory
+ * @return a slot such that all the slots before it are known to be used (0 if nothing is known)
+ */
+uint32_t dirindex_free_hint(const struct dirindex_table *t, uint16_t dir);
+
+/**
+ * @brief set the free-slot hint of a directory
+ * @param t the table (may be NULL)
+ * @param dir the inode number of the directory
+ * @param slot a slot such that all the slots before it are used
+ */
+void dirindex_set_free_hint(struct dirindex_table *t, uint16_t dir, uint32_t slot);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,11 +1,16 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
+#include <time.h>
 #include "filev6.h"
 #include "inode.h"
 #include "error.h"
 #include "unixv6fs.h"
 #include "sector.h"
+#include "fslock.h"
+#include "reclaim.h"
+#include "writeback.h"
 
 /**
  * @brief open up a file corresponding to a given inode; set offset to zero
@@ -29,10 +34,26 @@ int filev6_open(const struct unix_filesystem *u, uint16_t inr, struct filev6 *fv
 	fv6->u = u;
 	fv6->i_number = inr;
 	fv6->offset = 0;
+	fv6->map = NULL;
+	fv6->reserved = NULL;
+	fv6->nreserved = 0;
 	
 	return 0;
 }
 
+/**
+ * @brief identify the sector that corresponds to a given portion of a file, with its block map if it has one
+ * @param fv6 the filev6 (IN)
+ * @param file_sec_off the offset within the file (in sector-size units)
+ * @return >0: the sector on disk; 0: a hole; <0 error
+ */
+static int filev6_findsector(const struct filev6 *fv6, int32_t file_sec_off){
+	if(fv6->map != NULL && file_sec_off >= 0 && file_sec_off < fv6->map->nsectors){
+		return fv6->map->sectors[file_sec_off];
+	}
+	return inode_findsector(fv6->u, &fv6->i_node, file_sec_off);
+}
+
 /**
  * @brief read at most SECTOR_SIZE from the file at the current cursor
  * @param fv6 the filev6 (IN-OUT; offset will be changed)
@@ -55,11 +76,16 @@ int filev6_readblock(struct filev6 *fv6, void *buf){
 
 	if (fv6->offset+1 >= size) return 0;
 	
-	int sector = inode_findsector(fv6->u,&(fv6->i_node),fv6->offset/SECTOR_SIZE);
+	int sector = filev6_findsector(fv6, fv6->offset/SECTOR_SIZE);
 	if (sector<0) return sector; //sector < 0 iff an error is returned from inode_findsector
 	
-	int err = sector_read(fv6->u->f, (uint32_t)sector, buf);
-	if (err!=0) return err;
+	//a hole reads as zeros
+	if (sector == 0){
+		memset(buf, 0, SECTOR_SIZE);
+	}else{
+		int err = writeback_read(fv6->u, (uint32_t)sector, buf);
+		if (err!=0) return err;
+	}
 	
 	int readBytes = SECTOR_SIZE;
 	
@@ -72,6 +98,147 @@ int filev6_readblock(struct filev6 *fv6, void *buf){
 	return readBytes;
 }
 
+/**
+ * @brief read at most len bytes from the file at the current cursor, wherever it is in a sector
+ * @param fv6 the filev6 (IN-OUT; offset will be changed)
+ * @param buf points to len bytes of available memory (OUT)
+ * @param len the maximal number of bytes to read
+ * @return >0: the number of bytes of the file read; 0: end of file; <0 error
+ */
+int filev6_readbytes(struct filev6 *fv6, void *buf, int len){
+	M_REQUIRE_NON_NULL(fv6);
+	M_REQUIRE_NON_NULL(fv6->u);
+	M_REQUIRE_NON_NULL(buf);
+	if (len < 0) return ERR_BAD_PARAMETER;
+	
+	//never read past the end of the file
+	int32_t size = inode_getsize(&fv6->i_node);
+	if (fv6->offset >= size) return 0;
+	if (len > size - fv6->offset) len = size - fv6->offset;
+	
+	uint8_t *out = buf;
+	uint8_t sector_buf[SECTOR_SIZE];
+	int total = 0;
+	while (total < len){
+		int32_t in_sector = fv6->offset % SECTOR_SIZE;
+		int n = SECTOR_SIZE - in_sector < len - total ? SECTOR_SIZE - in_sector : len - total;
+		
+		int sector = filev6_findsector(fv6, fv6->offset / SECTOR_SIZE);
+		if (sector < 0) return total > 0 ? total : sector;
+		
+		//holes read as zeros; whole sectors go straight to the caller, partial ones through sector_buf
+		if (sector == 0){
+			memset(out + total, 0, n);
+		}else{
+			int err = writeback_read(fv6->u, (uint32_t)sector, n == SECTOR_SIZE ? out + total : sector_buf);
+			if (err < 0) return total > 0 ? total : err;
+			if (n != SECTOR_SIZE) memcpy(out + total, sector_buf + in_sector, n);
+		}
+		
+		total += n;
+		fv6->offset += n;
+	}
+	return total;
+}
+
+/**
+ * @brief describe where at most len bytes of the file from the current cursor lie on disk,
+ *        as runs of consecutive sectors (or of holes, with sector 0), without reading them
+ * @param fv6 the filev6 (IN-OUT; offset will be changed by the number of bytes described)
+ * @param len the maximal number of bytes to describe
+ * @param ext array of at least max extents (OUT)
+ * @param max the maximal number of extents
+ * @return the number of extents (0 at the end of the file); <0 on error
+ */
+int filev6_extents(struct filev6 *fv6, int len, struct filev6_extent *ext, int max){
+	M_REQUIRE_NON_NULL(fv6);
+	M_REQUIRE_NON_NULL(fv6->u);
+	M_REQUIRE_NON_NULL(ext);
+	if (len < 0 || max <= 0) return ERR_BAD_PARAMETER;
+	
+	int32_t size = inode_getsize(&fv6->i_node);
+	if (fv6->offset >= size) return 0;
+	if (len > size - fv6->offset) len = size - fv6->offset;
+	
+	int n = 0;
+	int done = 0;
+	while (done < len){
+		int32_t in_sector = fv6->offset % SECTOR_SIZE;
+		int bytes = SECTOR_SIZE - in_sector < len - done ? SECTOR_SIZE - in_sector : len - done;
+		int sector = filev6_findsector(fv6, fv6->offset / SECTOR_SIZE);
+		if (sector < 0) return n > 0 ? n : sector;
+		
+		//a sector following the previous one on disk (or a hole following a hole) extends the current run
+		if (n > 0 && (ext[n-1].offset + ext[n-1].size) % SECTOR_SIZE == 0
+		    && (sector == 0 ? ext[n-1].sector == 0 : ext[n-1].sector != 0
+		        && ext[n-1].sector + (uint32_t)((ext[n-1].offset + ext[n-1].size) / SECTOR_SIZE) == (uint32_t)sector)){
+			ext[n-1].size += bytes;
+		}else{
+			if (n == max) break;
+			ext[n].sector = (uint32_t)sector;
+			ext[n].offset = in_sector;
+			ext[n].size = bytes;
+			++n;
+		}
+		done += bytes;
+		fv6->offset += bytes;
+	}
+	return n;
+}
+
+/**
+ * @brief read the block map of a file once, so that reading the file no longer
+ *        reads its indirection sectors; the map is dropped when the file is written
+ * @param fv6 the filev6 (IN-OUT; map will be set)
+ * @return 0 on success; <0 on errror
+ */
+int filev6_map(struct filev6 *fv6){
+	M_REQUIRE_NON_NULL(fv6);
+	M_REQUIRE_NON_NULL(fv6->u);
+	filev6_unmap(fv6);
+	
+	int32_t size = inode_getsize(&fv6->i_node);
+	if (size > (ADDR_SMALL_LENGTH - 1) * ADDRESSES_PER_SECTOR * SECTOR_SIZE) return ERR_FILE_TOO_LARGE;
+	int32_t nsectors = (size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+	
+	struct filev6_map *map = malloc(sizeof(struct filev6_map) + nsectors * sizeof(uint16_t));
+	if (map == NULL) return ERR_NOMEM;
+	map->nsectors = nsectors;
+	
+	if (size <= ADDR_SMALL_LENGTH * SECTOR_SIZE){
+		memcpy(map->sectors, fv6->i_node.i_addr, nsectors * sizeof(uint16_t));
+	}else{
+		//each indirection sector is read once, for all the sectors it points to
+		uint16_t buffer[ADDRESSES_PER_SECTOR];
+		for (int32_t i = 0; i < nsectors; i += ADDRESSES_PER_SECTOR){
+			int32_t n = nsectors - i < ADDRESSES_PER_SECTOR ? nsectors - i : ADDRESSES_PER_SECTOR;
+			uint16_t ind = fv6->i_node.i_addr[i / ADDRESSES_PER_SECTOR];
+			if (ind == 0){//no indirection sector: all its sectors are holes
+				memset(map->sectors + i, 0, n * sizeof(uint16_t));
+				continue;
+			}
+			int err = writeback_read(fv6->u, ind, buffer);
+			if (err < 0){
+				free(map);
+				return err;
+			}
+			memcpy(map->sectors + i, buffer, n * sizeof(uint16_t));
+		}
+	}
+	fv6->map = map;
+	return 0;
+}
+
+/**
+ * @brief free the block map of a file, if any
+ * @param fv6 the filev6 (IN-OUT; map will be NULL)
+ */
+void filev6_unmap(struct filev6 *fv6){
+	if (fv6 == NULL) return;
+	free(fv6->map);
+	fv6->map = NULL;
+}
+
 /**
  * @brief change the current offset of the given file to the one specified
  * @param fv6 the filev6 (IN-OUT; offset will be changed)
@@ -98,6 +265,9 @@ int filev6_create(struct unix_filesystem *u, uint16_t mode, struct filev6 *fv6){
 	struct inode in;
 	memset(&in, 0, sizeof(struct inode));
 	in.i_mode = IALLOC | mode;
+	uint32_t now = (uint32_t)time(NULL);
+	inode_settime(in.i_atime, now);
+	inode_settime(in.i_mtime, now);
 	
 	int err = inode_write(u,fv6->i_number, &in);
 	if (err < 0) return err;
@@ -105,66 +275,247 @@ int filev6_create(struct unix_filesystem *u, uint16_t mode, struct filev6 *fv6){
 	fv6->i_node = in;
 	fv6->u = u;
 	fv6->offset = 0;
+	fv6->map = NULL;
+	fv6->reserved = NULL;
+	fv6->nreserved = 0;
 	return 0;
 }
 
 /**
- * @brief write a sector of data 
+ * @brief allocate a free sector in the block bitmap
  * @param u the filesystem (IN)
- * @param buf the data we want to write (IN)
- * @param remaining_len number of bytes we still have to write on disk
- * @param sector_number the number of the sector we have to write
- * @param offset the offset of the sector
- * @return the number of bytes written on the sector
+ * @return the sector on success; ERR_BITMAP_FULL if there is none
+ */
+static int filev6_alloc_sector(struct unix_filesystem *u){
+	int sector = -1;
+	for(int tries = 0; sector < 0 && tries < 2; ++tries){
+		//a full disk may have sectors freed by earlier operations, waiting for their batch
+		if(tries > 0 && writeback_release_now(u) <= 0) break;
+		
+		//finding and marking the sector must be atomic, or two threads could get the same one
+		fslock_bitmaps(u);
+		sector = bm_find_next(u->fbm);
+		if(sector >= 0) bm_set(u->fbm, (uint64_t)sector);
+		fslock_bitmaps_unlock(u);
+	}
+	return sector < 0 ? ERR_BITMAP_FULL : sector;
+}
+
+/**
+ * @brief get a sector for a file: one it reserved, if any, or a free one
+ * @param u the filesystem (IN)
+ * @param fv6 the filev6 (IN-OUT; its reserved sectors may change)
+ * @param ind 1 for an indirection sector, which is taken from the end of the reservation
+ *        so that the data sectors follow each other
+ * @return the sector on success; ERR_BITMAP_FULL if there is none
  */
- int filev6_writesector(struct unix_filesystem* u, void* buf, int remaining_len, uint16_t sector_number, int32_t offset){
-	int err;
-	int size = remaining_len + offset < SECTOR_SIZE ? remaining_len : SECTOR_SIZE - offset;
+static int filev6_take_sector(struct unix_filesystem *u, struct filev6 *fv6, int ind){
+	if(fv6->nreserved == 0) return filev6_alloc_sector(u);
+	if(!ind) return fv6->reserved[--fv6->nreserved];
 	
-	uint8_t buffer[SECTOR_SIZE];
+	int sector = fv6->reserved[0];
+	memmove(fv6->reserved, fv6->reserved + 1, (size_t)--fv6->nreserved * sizeof(uint16_t));
+	return sector;
+}
+
+/**
+ * @brief the indirection sector of a big file being written, kept in memory
+ *        until another one is needed (see filev6_ind_flush)
+ */
+struct filev6_ind {
+	int32_t k;                      //its index in i_addr, -1 if none is loaded
+	int dirty;                      //1 if tab must be written back
+	uint16_t tab[ADDRESSES_PER_SECTOR];
+};
+
+/**
+ * @brief write back the loaded indirection sector if it changed; an indirection
+ *        sector is only allocated here, once it points to a sector
+ * @param u the filesystem (IN)
+ * @param fv6 the filev6 (IN-OUT; i_addr may change)
+ * @param ind the loaded indirection sector (IN-OUT)
+ * @return 0 on success; <0 on error
+ */
+static int filev6_ind_flush(struct unix_filesystem *u, struct filev6 *fv6, struct filev6_ind *ind){
+	struct inode *in = &fv6->i_node;
+	if(!ind->dirty) return 0;
+	if(in->i_addr[ind->k] == 0){
+		int sector = filev6_take_sector(u, fv6, 1);
+		if(sector < 0) return sector;
+		in->i_addr[ind->k] = (uint16_t)sector;
+	}
+	ind->dirty = 0;
+	return writeback_write(u, in->i_addr[ind->k], ind->tab);
+}
+
+/**
+ * @brief load the indirection sector of the given sector of a big file
+ * @param u the filesystem (IN)
+ * @param fv6 the filev6 (IN-OUT; i_addr may change)
+ * @param ind the loaded indirection sector (IN-OUT)
+ * @param file_sec_off the offset within the file (in sector-size units)
+ * @return 0 on success; <0 on error
+ */
+static int filev6_ind_load(struct unix_filesystem *u, struct filev6 *fv6, struct filev6_ind *ind, int32_t file_sec_off){
+	struct inode *in = &fv6->i_node;
+	int32_t k = file_sec_off / ADDRESSES_PER_SECTOR;
+	if(ind->k == k) return 0;
+	int err = filev6_ind_flush(u, fv6, ind);
+	if(err < 0) return err;
 	
-	//if offset is not null, we will write on an already-written sector, so we have to read it first
-	if(offset != 0){
-		err = sector_read(u->f, sector_number, buffer);
+	//a missing indirection sector is a hole of ADDRESSES_PER_SECTOR sectors
+	ind->k = k;
+	if(in->i_addr[k] == 0){
+		memset(ind->tab, 0, sizeof(ind->tab));
+		return 0;
+	}
+	err = writeback_read(u, in->i_addr[k], ind->tab);
+	if(err < 0) ind->k = -1;
+	return err;
+}
+
+/**
+ * @brief get or set the address of a sector of a file, in the small or the big layout
+ * @param u the filesystem (IN)
+ * @param fv6 the filev6 (IN-OUT; i_addr may change)
+ * @param big 1 if the file uses indirection sectors
+ * @param ind the loaded indirection sector (IN-OUT)
+ * @param file_sec_off the offset within the file (in sector-size units)
+ * @param sector the new address, or -1 to leave it unchanged
+ * @return the address (0 for a hole); <0 on error
+ */
+static int filev6_addr(struct unix_filesystem *u, struct filev6 *fv6, int big, struct filev6_ind *ind,
+                       int32_t file_sec_off, int sector){
+	uint16_t *addr = &fv6->i_node.i_addr[file_sec_off];
+	if(big){
+		int err = filev6_ind_load(u, fv6, ind, file_sec_off);
+		if(err < 0) return err;
+		addr = &ind->tab[file_sec_off % ADDRESSES_PER_SECTOR];
+		if(sector >= 0 && *addr != sector) ind->dirty = 1;
+	}
+	if(sector >= 0) *addr = (uint16_t)sector;
+	return *addr;
+}
+
+/**
+ * @brief tell whether the given bytes are all zeros
+ * @param data the bytes (NULL stands for zeros)
+ * @param len the number of bytes
+ * @return 1 if they are; 0 otherwise
+ */
+static int filev6_is_zero(const uint8_t *data, int len){
+	if(data == NULL) return 1;
+	for(int i = 0; i < len; ++i){
+		if(data[i] != 0) return 0;
+	}
+	return 1;
+}
+
+/**
+ * @brief write bytes within one sector of a file; a hole only gets a sector
+ *        once bytes other than zeros are written to it
+ * @param u the filesystem (IN)
+ * @param fv6 the filev6 (IN-OUT; i_addr may change)
+ * @param big 1 if the file uses indirection sectors
+ * @param ind the loaded indirection sector (IN-OUT)
+ * @param file_sec_off the offset within the file (in sector-size units)
+ * @param sector the sector on disk, 0 for a hole
+ * @param offset the offset of the first byte within the sector
+ * @param data the bytes (NULL stands for zeros)
+ * @param len the number of bytes
+ * @return 1 if a sector was allocated; 0 if not; <0 on error
+ */
+static int filev6_put(struct unix_filesystem *u, struct filev6 *fv6, int big, struct filev6_ind *ind,
+                      int32_t file_sec_off, int sector, int32_t offset, const uint8_t *data, int len){
+	uint8_t buffer[SECTOR_SIZE];
+	int fresh = sector == 0;
+	if(fresh){
+		if(filev6_is_zero(data, len)) return 0;
+		sector = filev6_take_sector(u, fv6, 0);
+		if(sector < 0) return sector;
+		memset(buffer, 0, sizeof(buffer));
+	}else if(len < SECTOR_SIZE){
+		//a partial sector keeps the bytes around the new ones
+		int err = writeback_read(u, (uint32_t)sector, buffer);
 		if(err < 0) return err;
 	}
 	
-	//add the data to fill the sector
-	memcpy(buffer + offset, buf, size);
-	
-	//effectively write the filled sector
-	err = sector_write(u->f, sector_number, buffer);
+	if(data == NULL) memset(buffer + offset, 0, len);
+	else memcpy(buffer + offset, data, len);
+	//the sectors of a directory are metadata, those of a file are written at once
+	int err = fv6->i_node.i_mode & IFDIR ? writeback_write(u, (uint32_t)sector, buffer)
+	                                     : sector_write(u->f, (uint32_t)sector, buffer);
 	if(err < 0) return err;
 	
-	return size;
+	if(fresh){
+		err = filev6_addr(u, fv6, big, ind, file_sec_off, sector);
+		if(err < 0) return err;
+	}
+	return fresh;
 }
 
 /**
- * @brief pass from a small file to a big file with indirect sectors
+ * @brief append len bytes to a file; sectors of zeros are left as holes
  * @param u the filesystem (IN)
- * @param fv6 the filev6 (IN)
- * @return 0 on success, <0 on error
+ * @param fv6 the filev6 (IN-OUT; its inode is updated on disk too)
+ * @param data the bytes (NULL stands for zeros)
+ * @param len the number of bytes
+ * @return 0 on success; <0 on error
  */
-int smallfile_to_bigfile(struct unix_filesystem *u, struct filev6 *fv6, uint16_t current_sector){
-	//find the next unused sector
-	int sector = bm_find_next(u->fbm);
-	if (sector<0) return ERR_BITMAP_FULL;
-	
-	//write the sector numbers that were in i_addr to the new sector
-	uint16_t buffer[ADDRESSES_PER_SECTOR];
-	memset(buffer,0,ADDRESSES_PER_SECTOR);
-	memcpy(buffer,fv6->i_node.i_addr,ADDR_SMALL_LENGTH*sizeof(uint16_t));
-	
-	int err = sector_write(u->f,sector,buffer);
-	if (err<0) return err;
-	
-	//set all sectors pointed by i_addr to 0 except the first that is set to 'sector'
-	fv6->i_node.i_addr[0]=sector;
-	for (int i=1;i<ADDR_SMALL_LENGTH;++i)
-		fv6->i_node.i_addr[i]=0;
+static int filev6_append(struct unix_filesystem *u, struct filev6 *fv6, const uint8_t *data, int len){
+	int32_t inode_size = inode_getsize(&fv6->i_node);
+	
+	//the block map is about to change
+	filev6_unmap(fv6);
+	
+	//if inode is already too big OR will be too big, return ERR_FILE_TOO_LARGE
+	if(inode_size > (ADDR_SMALL_LENGTH -1) * ADDRESSES_PER_SECTOR * SECTOR_SIZE || 
+		inode_size + len > (ADDR_SMALL_LENGTH -1) * ADDRESSES_PER_SECTOR * SECTOR_SIZE) return ERR_FILE_TOO_LARGE;
+	
+	struct inode *in = &fv6->i_node;
+	struct filev6_ind ind;
+	ind.k = -1;
+	ind.dirty = 0;
+	int big = inode_size > ADDR_SMALL_LENGTH * SECTOR_SIZE;
+	
+	//If the file goes past 4Ko, its addresses move to the first indirection sector
+	//(which is only allocated if one of them is not a hole)
+	if(!big && inode_size + len > ADDR_SMALL_LENGTH * SECTOR_SIZE){
+		memset(ind.tab, 0, sizeof(ind.tab));
+		memcpy(ind.tab, in->i_addr, sizeof(in->i_addr));
+		ind.k = 0;
+		ind.dirty = !filev6_is_zero((const uint8_t *)in->i_addr, sizeof(in->i_addr));
+		memset(in->i_addr, 0, sizeof(in->i_addr));
+		big = 1;
+	}
+	
+	int done = 0;
+	while(done < len){
+		int32_t pos = inode_size + done;
+		int32_t sector_offset = pos % SECTOR_SIZE;
+		int n = SECTOR_SIZE - sector_offset < len - done ? SECTOR_SIZE - sector_offset : len - done;
 		
-	bm_set(u->fbm,sector);
-	return 0;
+		//only the last sector of the file may be completed, the others are new
+		int sector = 0;
+		if(sector_offset != 0){
+			sector = filev6_addr(u, fv6, big, &ind, pos / SECTOR_SIZE, -1);
+			if(sector < 0) return sector;
+		}
+		int err = filev6_put(u, fv6, big, &ind, pos / SECTOR_SIZE, sector, sector_offset,
+		                     data == NULL ? NULL : data + done, n);
+		if(err < 0) return err;
+		done += n;
+	}
+	
+	int err = filev6_ind_flush(u, fv6, &ind);
+	if(err < 0) return err;
+	
+	//We set the new size of the inode
+	err = inode_setsize(in, inode_size + len);
+	if(err < 0) return err;
+	
+	//Write the new inode to disk
+	return inode_write(u, fv6->i_number, in);
 }
 
 /**
@@ -179,129 +530,309 @@ int filev6_writebytes(struct unix_filesystem *u, struct filev6 *fv6, void *buf,
 	M_REQUIRE_NON_NULL(u);
 	M_REQUIRE_NON_NULL(fv6);
 	M_REQUIRE_NON_NULL(buf);
+	if(len < 0) return ERR_BAD_PARAMETER;
 	
-	int bytes_written = 0;
-	int err;
-	int32_t inode_size = inode_getsize(&fv6->i_node);
+	writeback_begin(u);
+	int err = filev6_append(u, fv6, buf, len);
+	//the date goes with the inode if the append changed it, lazily otherwise
+	if(err == 0 && len > 0) err = inode_touch(u, fv6->i_number, &fv6->i_node, INODE_MTIME);
+	writeback_end(u);
+	return err < 0 ? err : 0;
+}
+
+/**
+ * @brief reserve the sectors the bytes [offset, offset + len) of a file need: its holes in
+ *        that range, the sectors past its end and the indirection sectors it does not have yet;
+ *        as runs of consecutive sectors: they are marked used at once, but only written
+ *        when writes fill them; those left are released by filev6_unreserve
+ * @param u the filesystem (IN)
+ * @param fv6 the filev6 (IN-OUT; its reserved sectors are set)
+ * @param offset the offset of the first byte
+ * @param len the number of bytes
+ * @return 0 on success; <0 on errror (nothing more is reserved then)
+ */
+int filev6_fallocate(struct unix_filesystem *u, struct filev6 *fv6, int32_t offset, int32_t len){
+	M_REQUIRE_NON_NULL(u);
+	M_REQUIRE_NON_NULL(fv6);
+	if(len < 0 || offset < 0) return ERR_BAD_PARAMETER;
+	if(offset > (ADDR_SMALL_LENGTH - 1) * ADDRESSES_PER_SECTOR * SECTOR_SIZE - len) return ERR_FILE_TOO_LARGE;
+	if(len == 0) return 0;
 	
-	//if inode is already too big OR will be too big, return ERR_FILE_TOO_LARGE
-	if(inode_size > (ADDR_SMALL_LENGTH -1) * ADDRESSES_PER_SECTOR * SECTOR_SIZE || 
-		inode_size + len > (ADDR_SMALL_LENGTH -1) * ADDRESSES_PER_SECTOR * SECTOR_SIZE) return ERR_FILE_TOO_LARGE;
+	//the sectors past the end of the file, and the indirection sectors it does not have yet
+	int32_t end = offset + len;
+	int32_t size = inode_getsize(&fv6->i_node);
+	int32_t from = (size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+	int32_t to = (end + SECTOR_SIZE - 1) / SECTOR_SIZE;
+	int32_t need = to > from ? to - from : 0;
+	//and its holes among the bytes
+	for(int32_t k = offset / SECTOR_SIZE; k < from && k < to; ++k){
+		int sector = filev6_findsector(fv6, k);
+		if(sector < 0) return sector;
+		if(sector == 0) ++need;
+	}
+	if(end > ADDR_SMALL_LENGTH * SECTOR_SIZE){
+		for(int32_t k = 0; k < (to + ADDRESSES_PER_SECTOR - 1) / ADDRESSES_PER_SECTOR; ++k){
+			if(size <= ADDR_SMALL_LENGTH * SECTOR_SIZE || fv6->i_node.i_addr[k] == 0) ++need;
+		}
+	}
+	need -= fv6->nreserved;
+	if(need <= 0) return 0;
 	
-	//Values to handle sectors for small files
-	int32_t sector_number = inode_size / SECTOR_SIZE;
-	int32_t sector_offset = inode_size % SECTOR_SIZE;
-	
-	//Values to handle indirect sectors for big files
-	int32_t indirect_sector_number = sector_number / ADDRESSES_PER_SECTOR;
-	int32_t indirect_sector_offset = sector_number % ADDRESSES_PER_SECTOR;
-	
-	//First we try to write a sector entirely
-	if(sector_offset != 0){
-		uint16_t sec_num;
-		//Get the sector number that need to be completed
-		if(inode_size <= ADDR_SMALL_LENGTH * SECTOR_SIZE){//Small files
-			sec_num = fv6->i_node.i_addr[sector_number];
-			
-			//We completed the sector, now go to next one
-			++sector_number;
-		}else{//Big Files
-			uint16_t tab[ADDRESSES_PER_SECTOR];
-			err = sector_read(u->f, fv6->i_node.i_addr[indirect_sector_number], tab);
-			if(err != 0) return err;
-
-			sec_num = tab[indirect_sector_offset];
-			
-			//We completed the sector, now go to next one, in this case increment offset of indirect sector
-			++indirect_sector_offset;
+	//the new sectors go before those already reserved, which are used first
+	uint16_t *reserved = realloc(fv6->reserved, (size_t)(fv6->nreserved + need) * sizeof(uint16_t));
+	if(reserved == NULL) return ERR_NOMEM;
+	memmove(reserved + need, reserved, (size_t)fv6->nreserved * sizeof(uint16_t));
+	fv6->reserved = reserved;
+	
+	//the runs are taken under the lock, so that other writers do not get sectors in between
+	int err = 0;
+	int32_t n = 0;
+	fslock_bitmaps(u);
+	while(n < need){
+		uint64_t run;
+		int first = bm_find_run(u->fbm, (uint64_t)(need - n), &run);
+		if(first < 0){
+			err = ERR_BITMAP_FULL;
+			break;
 		}
-		
-		bytes_written = filev6_writesector(u, buf, len, sec_num, sector_offset);
-		if(bytes_written < 0) return bytes_written;
+		for(uint64_t i = 0; i < run; ++i){
+			bm_set(u->fbm, (uint64_t)first + i);
+			reserved[need - 1 - n++] = (uint16_t)(first + i);
+		}
+	}
+	if(err < 0) bm_clear_many(u->fbm, reserved + need - n, (size_t)n);
+	fslock_bitmaps_unlock(u);
+	
+	if(err < 0){
+		memmove(reserved, reserved + need, (size_t)fv6->nreserved * sizeof(uint16_t));
+		return err;
+	}
+	fv6->nreserved += need;
+	return 0;
+}
 
-		//Shift buf by number of written data
-		buf += bytes_written;
+/**
+ * @brief release the sectors reserved by filev6_fallocate which appends did not use
+ * @param u the filesystem (IN)
+ * @param fv6 the filev6 (IN-OUT; it has no reserved sector anymore)
+ */
+void filev6_unreserve(struct unix_filesystem *u, struct filev6 *fv6){
+	if(u == NULL || fv6 == NULL) return;
+	if(fv6->nreserved > 0){
+		fslock_bitmaps(u);
+		bm_clear_many(u->fbm, fv6->reserved, (size_t)fv6->nreserved);
+		fslock_bitmaps_unlock(u);
 	}
+	free(fv6->reserved);
+	fv6->reserved = NULL;
+	fv6->nreserved = 0;
+}
+
+/**
+ * @brief release the sectors of a file, gathered in a single list for the reclaimer
+ * @param u the filesystem (IN)
+ * @param data the data sectors (0 stands for no sector)
+ * @param ndata the number of data sectors
+ * @param ind the indirection sectors
+ * @param nind the number of indirection sectors
+ * @return 0 on success; <0 on error (the sectors then stay used until the next mount)
+ */
+static int filev6_free_sectors(struct unix_filesystem *u, const uint16_t *data, int32_t ndata,
+                               const uint16_t *ind, int32_t nind){
+	if(ndata + nind == 0) return 0;
+	uint16_t *sectors = malloc((size_t)(ndata + nind) * sizeof(uint16_t));
+	if(sectors == NULL) return ERR_NOMEM;
+	memcpy(sectors, data, (size_t)ndata * sizeof(uint16_t));
+	memcpy(sectors + ndata, ind, (size_t)nind * sizeof(uint16_t));
+	return writeback_release(u, sectors, (size_t)(ndata + nind));
+}
+
+/**
+ * @brief change the size of a file, within an operation (see filev6_truncate)
+ * @param u the filesystem (IN)
+ * @param fv6 the filev6 (IN-OUT; its inode is updated on disk too)
+ * @param size the new size of the file (in range)
+ * @return 0 on success; <0 on errror
+ */
+static int filev6_resize(struct unix_filesystem *u, struct filev6 *fv6, int32_t size){
+	int32_t old_size = inode_getsize(&fv6->i_node);
+	//growing: zeros are appended, which only leaves holes past the last sector
+	if(size == old_size) return 0;
+	if(size > old_size) return filev6_append(u, fv6, NULL, size - old_size);
 	
-	int nb_bytes;
-	//If there is still data to write, we are sure that we need to write in new sectors
-	while(bytes_written < len){
-		
-		//If at some point the file reach 4Ko, we need to pass to indirect sectors
-		if(inode_size + bytes_written == ADDR_SMALL_LENGTH * SECTOR_SIZE){
-			err = smallfile_to_bigfile(u, fv6, sector_number);
-			if (err<0) return err;
-			
-			//We went to indirected sectors, so the value of the current indirect sector is 0 and 
-			//since there are 8 addresses already, we adjust the offset properly
-			indirect_sector_number = 0;
-			indirect_sector_offset = ADDR_SMALL_LENGTH + 1;
+	//shrinking: the block map lists the sectors of the file
+	int err = filev6_map(fv6);
+	if(err < 0) return err;
+	const struct filev6_map *map = fv6->map;
+	struct inode *in = &fv6->i_node;
+	int32_t old_n = map->nsectors;
+	int32_t new_n = (size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+	int big = old_size > ADDR_SMALL_LENGTH * SECTOR_SIZE;
+	int32_t old_ind = big ? (old_n + ADDRESSES_PER_SECTOR - 1) / ADDRESSES_PER_SECTOR : 0;
+	uint16_t freed[ADDR_SMALL_LENGTH];//indirection sectors no longer used
+	int32_t nfreed = 0;
+	
+	if(big && size <= ADDR_SMALL_LENGTH * SECTOR_SIZE){
+		//back to the small layout: the addresses move from the first indirection sector to the inode
+		memcpy(freed, in->i_addr, old_ind * sizeof(uint16_t));
+		nfreed = old_ind;
+		memset(in->i_addr, 0, sizeof(in->i_addr));
+		memcpy(in->i_addr, map->sectors, new_n * sizeof(uint16_t));
+	}else if(big){
+		for(int32_t k = (new_n + ADDRESSES_PER_SECTOR - 1) / ADDRESSES_PER_SECTOR; k < old_ind; ++k){
+			freed[nfreed++] = in->i_addr[k];
+			in->i_addr[k] = 0;
 		}
-		
-		//Find a new sector to write the data
-		int sector = bm_find_next(u->fbm);
-		if(sector < 0) return ERR_BITMAP_FULL;
-		
-		if(inode_size + bytes_written <= ADDR_SMALL_LENGTH * SECTOR_SIZE){//Small files
-			fv6->i_node.i_addr[sector_number] = sector;
-			
-			//Write data on the new sector
-			nb_bytes = filev6_writesector(u, buf, len - bytes_written, sector, 0);
-			if(nb_bytes < 0) return nb_bytes;
-			
-			//update the sector number
-			++sector_number;
-		}else{//Big files
-			//if we have completed a sector with indirections, we need to create a new one
-			if(indirect_sector_offset >= ADDRESSES_PER_SECTOR){
-				++indirect_sector_number;//there ise a new indirection sector
-				indirect_sector_offset = 0;//offset back to zero
-				
-				//Find a new indirection sector
-				int new_indirection_sector = bm_find_next(u->fbm);
-				if(new_indirection_sector < 0) return new_indirection_sector;
-				
-				//Update the value in i_addr
-				fv6->i_node.i_addr[indirect_sector_number] = new_indirection_sector;
-				
-				bm_set(u->fbm, new_indirection_sector);
-			}
-
-			//we read the proper indirect sector
+		//the addresses past the end are holes again, for when the file grows back
+		int32_t last = (new_n - 1) / ADDRESSES_PER_SECTOR;
+		if(new_n % ADDRESSES_PER_SECTOR != 0 && in->i_addr[last] != 0){
 			uint16_t tab[ADDRESSES_PER_SECTOR];
-			err = sector_read(u->f, fv6->i_node.i_addr[indirect_sector_number], tab);
-			if(err < 0) return err;
-			
-			//Update at the right offset to indicate the new sector that will contain data
-			tab[indirect_sector_offset] = sector;
-			
-			//Write the updated indirection
-			err = sector_write(u->f, fv6->i_node.i_addr[indirect_sector_number], tab);
-			if(err < 0) return err;
-			
-			//Write data on the new sector
-			nb_bytes = filev6_writesector(u, buf, len - bytes_written, sector, 0);
-			if(nb_bytes < 0) return nb_bytes;
-			
-			//Update the offset by one
-			++indirect_sector_offset;
+			err = writeback_read(u, in->i_addr[last], tab);
+			if(err == 0){
+				memset(tab + new_n % ADDRESSES_PER_SECTOR, 0, (ADDRESSES_PER_SECTOR - new_n % ADDRESSES_PER_SECTOR) * sizeof(uint16_t));
+				err = writeback_write(u, in->i_addr[last], tab);
+			}
+			if(err < 0){
+				filev6_unmap(fv6);
+				return err;
+			}
 		}
+	}else{
+		for(int32_t k = new_n; k < old_n; ++k) in->i_addr[k] = 0;
+	}
+	
+	err = inode_setsize(in, size);
+	if(err == 0) err = inode_write(u, fv6->i_number, in);
+	if(err == 0){
+		//the sectors are released only once the inode no longer points to them
+		if(fv6->offset > size) fv6->offset = size;
+		err = filev6_free_sectors(u, map->sectors + new_n, old_n - new_n, freed, nfreed);
+	}
+	filev6_unmap(fv6);
+	return err;
+}
+
+/**
+ * @brief change the size of a file: new bytes are zeros, sectors past the new end are released
+ * @param u the filesystem (IN)
+ * @param fv6 the filev6 (IN-OUT; its inode is updated on disk too)
+ * @param size the new size of the file
+ * @return 0 on success; <0 on errror
+ */
+int filev6_truncate(struct unix_filesystem *u, struct filev6 *fv6, int32_t size){
+	M_REQUIRE_NON_NULL(u);
+	M_REQUIRE_NON_NULL(fv6);
+	if(size < 0) return ERR_BAD_PARAMETER;
+	if(size > (ADDR_SMALL_LENGTH - 1) * ADDRESSES_PER_SECTOR * SECTOR_SIZE) return ERR_FILE_TOO_LARGE;
+	
+	writeback_begin(u);
+	int changed = size != inode_getsize(&fv6->i_node);
+	int err = filev6_resize(u, fv6, size);
+	if(err == 0 && changed) err = inode_touch(u, fv6->i_number, &fv6->i_node, INODE_MTIME);
+	writeback_end(u);
+	return err < 0 ? err : 0;
+}
+
+/**
+ * @brief write bytes at a given offset of a file, within an operation (see filev6_writeat)
+ * @param u the filesystem (IN)
+ * @param fv6 the filev6 (IN-OUT; its inode is updated on disk too)
+ * @param data the data we want to write (IN)
+ * @param len the length of the bytes we want to write
+ * @param offset the offset in the file of the first byte to write (in range)
+ * @return 0 on success; <0 on errror
+ */
+static int filev6_overwrite(struct unix_filesystem *u, struct filev6 *fv6, const uint8_t *data, int len, int32_t offset){
+	int32_t size = inode_getsize(&fv6->i_node);
+	if(offset > size){
+		int err = filev6_resize(u, fv6, offset);
+		if(err < 0) return err;
+		size = offset;
+	}
+	
+	struct inode *in = &fv6->i_node;
+	struct filev6_ind ind;
+	ind.k = -1;
+	ind.dirty = 0;
+	int big = size > ADDR_SMALL_LENGTH * SECTOR_SIZE;
+	int allocated = 0;
+	int done = 0;
+	while(done < len && offset + done < size){
+		int32_t pos = offset + done;
+		int32_t in_sector = pos % SECTOR_SIZE;
+		int n = SECTOR_SIZE - in_sector;
+		if(n > len - done) n = len - done;
+		if(n > size - pos) n = size - pos;//the end of the last sector is appended below
 		
-		//Shift buffer and update values
-		bytes_written += nb_bytes;
-		buf += nb_bytes;
-		
-		//Update the i_addr and set the sector in the bitmap vector
-		bm_set(u->fbm, sector);
+		int sector = filev6_addr(u, fv6, big, &ind, pos / SECTOR_SIZE, -1);
+		if(sector < 0) return sector;
+		int err = filev6_put(u, fv6, big, &ind, pos / SECTOR_SIZE, sector, in_sector, data + done, n);
+		if(err < 0) return err;
+		allocated |= err;
+		done += n;
 	}
 	
-	//We set the new size of the inode
-	err = inode_setsize(&fv6->i_node, inode_size + len);
-	if(err < 0) return err;
+	//the inode only changes if a hole got a sector
+	if(allocated){
+		filev6_unmap(fv6);
+		int err = filev6_ind_flush(u, fv6, &ind);
+		if(err == 0) err = inode_write(u, fv6->i_number, in);
+		if(err < 0) return err;
+	}
 	
-	//Write the new inode to disk
-	err = inode_write(u, fv6->i_number, &fv6->i_node);
+	if(done < len) return filev6_append(u, fv6, data + done, len - done);
+	return 0;
+}
+
+/**
+ * @brief write len bytes at a given offset of a file: the bytes inside the file are
+ *        overwritten in place, the others are appended (after a hole if the offset
+ *        is past the end of the file)
+ * @param u the filesystem (IN)
+ * @param fv6 the filev6 (IN-OUT; its inode is updated on disk too)
+ * @param buf the data we want to write (IN)
+ * @param len the length of the bytes we want to write
+ * @param offset the offset in the file of the first byte to write
+ * @return 0 on success; <0 on errror
+ */
+int filev6_writeat(struct unix_filesystem *u, struct filev6 *fv6, const void *buf, int len, int32_t offset){
+	M_REQUIRE_NON_NULL(u);
+	M_REQUIRE_NON_NULL(fv6);
+	M_REQUIRE_NON_NULL(buf);
+	if(len < 0 || offset < 0) return ERR_BAD_PARAMETER;
+	if(offset > (ADDR_SMALL_LENGTH - 1) * ADDRESSES_PER_SECTOR * SECTOR_SIZE - len) return ERR_FILE_TOO_LARGE;
+	
+	writeback_begin(u);
+	int err = filev6_overwrite(u, fv6, buf, len, offset);
+	if(err == 0 && len > 0) err = inode_touch(u, fv6->i_number, &fv6->i_node, INODE_MTIME);
+	writeback_end(u);
+	return err < 0 ? err : 0;
+}
+
+/**
+ * @brief delete a file: its inode is freed and its sectors (data and indirection) are released
+ * @param u the filesystem (IN)
+ * @param fv6 the filev6 (IN-OUT; its inode is cleared)
+ * @return 0 on success; <0 on errror
+ */
+int filev6_delete(struct unix_filesystem *u, struct filev6 *fv6){
+	M_REQUIRE_NON_NULL(u);
+	M_REQUIRE_NON_NULL(fv6);
+	
+	filev6_unreserve(u, fv6);
+	int err = filev6_map(fv6);
 	if(err < 0) return err;
+	writeback_begin(u);
+	const struct filev6_map *map = fv6->map;
+	int32_t nind = inode_getsize(&fv6->i_node) > ADDR_SMALL_LENGTH * SECTOR_SIZE ?
+	               (map->nsectors + ADDRESSES_PER_SECTOR - 1) / ADDRESSES_PER_SECTOR : 0;
 	
-	return 0;
+	//the inode is freed first: the sectors are released only once nothing points to them
+	err = inode_free(u, fv6->i_number);
+	if(err == 0) err = filev6_free_sectors(u, map->sectors, map->nsectors, fv6->i_node.i_addr, nind);
+	writeback_end(u);
+	filev6_unmap(fv6);
+	memset(&fv6->i_node, 0, sizeof(struct inode));
+	fv6->offset = 0;
+	return err;
 }
@@ -15,11 +15,25 @@
 extern "C" {
 #endif
 
+struct filev6_map {
+    int32_t nsectors;                    // number of sectors of the file
+    uint16_t sectors[];                  // sector on disk of each sector of the file (0 for a hole)
+};
+
+struct filev6_extent {
+    uint32_t sector;                     // first sector on disk (0 for a hole)
+    int32_t offset;                      // offset of the first byte within that sector
+    int32_t size;                        // number of bytes, on consecutive sectors of the disk
+};
+
 struct filev6 {
     const struct unix_filesystem *u;     // the filesystem
     uint16_t i_number;                   // the inode number (on disk)
     struct inode i_node;                 // the content of the inode
     int32_t offset;                      // the current cursor within the file (in bytes)
+    struct filev6_map *map;              // the block map of the file, or NULL (see filev6_map)
+    uint16_t *reserved;                  // sectors reserved for the next appends, last one first (see filev6_fallocate)
+    int32_t nreserved;                   // number of sectors left in reserved
 };
 
 /**
@@ -47,6 +61,40 @@ int filev6_lseek(struct filev6 *fv6, int32_t offset);
  */
 int filev6_readblock(struct filev6 *fv6, void *buf);
 
+/**
+ * @brief read at most len bytes from the file at the current cursor, wherever it is in a sector
+ * @param fv6 the filev6 (IN-OUT; offset will be changed)
+ * @param buf points to len bytes of available memory (OUT)
+ * @param len the maximal number of bytes to read
+ * @return >0: the number of bytes of the file read; 0: end of file; <0 error
+ */
+int filev6_readbytes(struct filev6 *fv6, void *buf, int len);
+
+/**
+ * @brief describe where at most len bytes of the file from the current cursor lie on disk,
+ *        as runs of consecutive sectors, without reading them
+ * @param fv6 the filev6 (IN-OUT; offset will be changed by the number of bytes described)
+ * @param len the maximal number of bytes to describe
+ * @param ext array of at least max extents (OUT)
+ * @param max the maximal number of extents
+ * @return the number of extents (0 at the end of the file); <0 on error
+ */
+int filev6_extents(struct filev6 *fv6, int len, struct filev6_extent *ext, int max);
+
+/**
+ * @brief read the block map of a file once, so that reading the file no longer
+ *        reads its indirection sectors; the map is dropped when the file is written
+ * @param fv6 the filev6 (IN-OUT; map will be set)
+ * @return 0 on success; <0 on errror
+ */
+int filev6_map(struct filev6 *fv6);
+
+/**
+ * @brief free the block map of a file, if any
+ * @param fv6 the filev6 (IN-OUT; map will be NULL)
+ */
+void filev6_unmap(struct filev6 *fv6);
+
 /**
  * @brief create a new filev6
  * @param u the filesystem (IN)
@@ -67,6 +115,56 @@ int filev6_create(struct unix_filesystem *u, uint16_t mode, struct filev6 *fv6);
 int filev6_writebytes(struct unix_filesystem *u, struct filev6 *fv6, void *buf, int len);
 
 
+/**
+ * @brief write len bytes at a given offset of a file: the bytes inside the file are
+ *        overwritten in place, the others are appended (after a hole if the offset
+ *        is past the end of the file)
+ * @param u the filesystem (IN)
+ * @param fv6 the filev6 (IN-OUT; its inode is updated on disk too)
+ * @param buf the data we want to write (IN)
+ * @param len the length of the bytes we want to write
+ * @param offset the offset in the file of the first byte to write
+ * @return 0 on success; <0 on errror
+ */
+int filev6_writeat(struct unix_filesystem *u, struct filev6 *fv6, const void *buf, int len, int32_t offset);
+
+/**
+ * @brief change the size of a file: new bytes are zeros, sectors past the new end are released
+ * @param u the filesystem (IN)
+ * @param fv6 the filev6 (IN-OUT; its inode is updated on disk too)
+ * @param size the new size of the file
+ * @return 0 on success; <0 on errror
+ */
+int filev6_truncate(struct unix_filesystem *u, struct filev6 *fv6, int32_t size);
+
+/**
+ * @brief reserve the sectors the bytes [offset, offset + len) of a file need: its holes in
+ *        that range, the sectors past its end and the indirection sectors it does not have yet;
+ *        as runs of consecutive sectors: they are marked used at once, but only written
+ *        when writes fill them; those left are released by filev6_unreserve
+ * @param u the filesystem (IN)
+ * @param fv6 the filev6 (IN-OUT; its reserved sectors are set)
+ * @param offset the offset of the first byte
+ * @param len the number of bytes
+ * @return 0 on success; <0 on errror (nothing more is reserved then)
+ */
+int filev6_fallocate(struct unix_filesystem *u, struct filev6 *fv6, int32_t offset, int32_t len);
+
+/**
+ * @brief release the sectors reserved by filev6_fallocate which appends did not use
+ * @param u the filesystem (IN)
+ * @param fv6 the filev6 (IN-OUT; it has no reserved sector anymore)
+ */
+void filev6_unreserve(struct unix_filesystem *u, struct filev6 *fv6);
+
+/**
+ * @brief delete a file: its inode is freed and its sectors (data and indirection) are released
+ * @param u the filesystem (IN)
+ * @param fv6 the filev6 (IN-OUT; its inode is cleared)
+ * @return 0 on success; <0 on errror
+ */
+int filev6_delete(struct unix_filesystem *u, struct filev6 *fv6);
+
 #ifdef __cplusplus
 }
 #endif
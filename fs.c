@@ -5,40 +5,153 @@
   This program can be distributed under the terms of the GNU GPL.
   See the file COPYING.
 
-  gcc -Wall hello.c `pkg-config fuse --cflags --libs` -o hello
+  gcc -Wall hello_ll.c `pkg-config fuse3 --cflags --libs` -o hello_ll
 */
 
-#define FUSE_USE_VERSION 26
+/* The low-level API is used: the kernel designates files by their inode
+ * numbers (fuse_ino_t), which are the inode numbers of the disk, so no
+ * operation has to resolve a path. The root of FUSE (FUSE_ROOT_ID) and the
+ * root of the disk (ROOT_INUMBER) are both 1.
+ *
+ * Requests are served by several threads (unless -s is given). Each operation
+ * holds the lock of the inode it works on (see fslock.h): shared to read,
+ * exclusive to modify, so that readers of a file or a directory run in parallel.
+ *
+ * Writes are gathered in a buffer of the open file (see struct fs_file) and
+ * reach the disk in batches ending on a sector boundary, when the buffer is
+ * full, when the kernel flushes or syncs the file, or before the attributes or
+ * the content of the file are read.
+ */
+#define FUSE_USE_VERSION 32
 
-#include <fuse.h>
+#include <fuse_lowlevel.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/statvfs.h>
 #include "unixv6fs.h"
 #include "error.h"
 #include "mount.h"
 #include "inode.h"
 #include "filev6.h"
 #include "direntv6.h"
+#include "fslock.h"
+#include "bmblock.h"
+#include "writeback.h"
+
+#ifndef FALLOC_FL_KEEP_SIZE
+#define FALLOC_FL_KEEP_SIZE 0x01 /* as in <linux/falloc.h> */
+#endif
 
 struct unix_filesystem fs;
 
-static int fs_getattr(const char *path, struct stat *stbuf)
+/* Size of the write-back buffer of an open file */
+#define FS_WRITEBACK_SIZE (128 * SECTOR_SIZE)
+
+/* Delayed allocation (-o delalloc): the buffer of an open file grows instead of
+ * being written when it is full, so the bytes only reach the disk when they are
+ * flushed (or read); the sectors they need are then reserved at once, as one run
+ * of consecutive sectors (see filev6_fallocate), even when files are written
+ * side by side. A buffer is at most as large as the largest file, and all of them
+ * together grow by at most FS_DELALLOC_MAX bytes: past that, a full buffer is
+ * written as without delayed allocation.
+ */
+#define FS_KEY_DELALLOC 1
+static int fs_delalloc = 0;
+
+static const struct fuse_opt fs_opts[] = {
+	FUSE_OPT_KEY("delalloc", FS_KEY_DELALLOC),
+	FUSE_OPT_END
+};
+
+/* Largest file of the disk: seven indirection sectors */
+#define FS_MAX_FILE_SIZE ((ADDR_SMALL_LENGTH - 1) * ADDRESSES_PER_SECTOR * SECTOR_SIZE)
+
+/* Bytes the buffers of all the open files may hold past FS_WRITEBACK_SIZE each */
+#define FS_DELALLOC_MAX (16 * 1024 * 1024)
+static int32_t fs_delalloc_bytes = 0; // bytes taken out of FS_DELALLOC_MAX
+static pthread_mutex_t fs_delalloc_lock = PTHREAD_MUTEX_INITIALIZER; // protects fs_delalloc_bytes
+
+/* An open file: the file itself and the bytes written but not on the disk yet,
+ * protected by the lock of the inode.
+ */
+struct fs_file {
+	struct filev6 fv6;   // the file, with its block map
+	uint8_t *wbuf;       // write-back buffer of wb_size bytes (NULL until the first write)
+	int32_t wb_size;     // FS_WRITEBACK_SIZE, or more with delayed allocation
+	int32_t wb_off;      // offset in the file of the first buffered byte
+	int32_t wb_len;      // number of buffered bytes
+	struct fs_file *next; // next open file of the same inode
+};
+
+/* What the daemon knows about an inode the kernel holds a reference to */
+struct fs_inode {
+	uint64_t nlookup;    // number of lookups not forgotten yet by the kernel
+	int cached;          // 1 if the kernel may hold pages of the file read at the last open
+	struct inode opened; // content of the inode at the last open (valid if cached)
+	struct fs_file *files; // open files of the inode (protected by the lock of the inode)
+	int dirty;           // number of them with buffered bytes (protected by the lock of the inode)
+	int unlinked;        // 1 once removed from its directory: freed when forgotten and closed (idem)
+	uint16_t parent;     // directory the kernel last found it in, the ".." of a directory (0 if unknown)
+};
+
+static struct fs_inode *fs_inodes; // indexed by inode number
+static uint32_t fs_ninodes;        // number of elements of fs_inodes
+static pthread_mutex_t fs_inodes_lock = PTHREAD_MUTEX_INITIALIZER; // protects nlookup, cached, opened and parent
+
+static struct fuse_session *fs_session;
+
+/* Cache policy: validity (in seconds) of the names and attributes given to the
+ * kernel. An image mounted read-only (s_ronly) never changes, so the kernel
+ * keeps them (and the pages of the files) as long as it wants.
+ */
+#define FS_TIMEOUT 1.0
+#define FS_RONLY_TIMEOUT 86400.0
+
+static double fs_entry_timeout = FS_TIMEOUT;
+static double fs_attr_timeout = FS_TIMEOUT;
+
+/**
+ * @brief convert an internal error code into the errno FUSE expects
+ * @param err the internal error code (<0)
+ * @return the corresponding errno (>0)
+ */
+static int fs_errno(int err)
+{
+	switch(err){
+	case ERR_NOMEM: return ENOMEM;
+	case ERR_INODE_OUTOF_RANGE: return ENOENT;
+	case ERR_UNALLOCATED_INODE: return ENOENT;
+	case ERR_FILENAME_TOO_LONG: return ENAMETOOLONG;
+	case ERR_INVALID_DIRECTORY_INODE: return ENOTDIR;
+	case ERR_FILENAME_ALREADY_EXISTS: return EEXIST;
+	case ERR_BITMAP_FULL: return ENOSPC;
+	case ERR_NOT_ENOUGH_BLOCS: return ENOSPC;
+	case ERR_FILE_TOO_LARGE: return EFBIG;
+	case ERR_OFFSET_OUT_OF_RANGE: return EINVAL;
+	case ERR_BAD_PARAMETER: return EINVAL;
+	case ERR_DIRECTORY_NOT_EMPTY: return ENOTEMPTY;
+	default: return EIO;
+	}
+}
+
+/**
+ * @brief fill the attributes FUSE expects from the content of an inode
+ * @param inr the inode number
+ * @param inode the content of the inode
+ * @param stbuf the attributes (OUT)
+ */
+static void fs_fill_stat(uint16_t inr, const struct inode *inode, struct stat *stbuf)
 {
-	int inr = direntv6_dirlookup(&fs, ROOT_INUMBER, path);
-	if(inr < 0) return inr;
-	
-	struct inode inode;
-	int err = inode_read(&fs, (uint16_t)inr, &inode);
-	if(err < 0) return err;
-	
 	memset(stbuf, 0, sizeof(struct stat));
 	stbuf->st_mode = S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH;
-	
-	if(inode.i_mode & IFDIR){
+
+	if(inode->i_mode & IFDIR){
 		stbuf->st_mode = stbuf->st_mode | S_IFDIR;
 		stbuf->st_nlink = 2;
 	}
@@ -46,75 +159,934 @@ static int fs_getattr(const char *path, struct stat *stbuf)
 		stbuf->st_mode = stbuf->st_mode | S_IFREG;
 		stbuf->st_nlink = 1;
 	}
-	
-	stbuf->st_size = inode_getsize(&inode);
-	stbuf->st_blocks = inode_getsectorsize(&inode);
+
+	stbuf->st_size = inode_getsize(inode);
+	stbuf->st_blocks = inode_getsectorsize(inode);
 	stbuf->st_ino = inr;
 	stbuf->st_blksize = SECTOR_SIZE;
 	stbuf->st_uid = getuid();
 	stbuf->st_gid = getgid();
+	stbuf->st_atime = inode_gettime(inode->i_atime);
+	stbuf->st_mtime = inode_gettime(inode->i_mtime);
+	stbuf->st_ctime = stbuf->st_mtime;//not stored on the disk
+}
+
+/**
+ * @brief fill the answer to a lookup
+ * @param inr the inode number
+ * @param inode the content of the inode
+ * @param e the answer (OUT)
+ */
+static void fs_fill_entry(uint16_t inr, const struct inode *inode, struct fuse_entry_param *e)
+{
+	memset(e, 0, sizeof(*e));
+	e->ino = inr;
+	e->entry_timeout = fs_entry_timeout;
+	e->attr_timeout = fs_attr_timeout;
+	fs_fill_stat(inr, inode, &e->attr);
+}
+
+/**
+ * @brief count a reference the kernel takes on an inode (each entry it is given)
+ * @param inr the inode number
+ * @param parent the inode number of the directory of the entry
+ */
+static void fs_ref(uint16_t inr, fuse_ino_t parent)
+{
+	if(inr >= fs_ninodes) return;
+	pthread_mutex_lock(&fs_inodes_lock);
+	++fs_inodes[inr].nlookup;
+	//the directories have no ".." on the disk: a directory has a single entry, the one found here
+	fs_inodes[inr].parent = (uint16_t)parent;
+	pthread_mutex_unlock(&fs_inodes_lock);
+}
+
+/**
+ * @brief return the parent of a directory, as the kernel found it
+ * @param ino the inode number of the directory
+ * @return the inode number of its parent (the directory itself for the root, or if unknown)
+ */
+static fuse_ino_t fs_parent(fuse_ino_t ino)
+{
+	if(ino == ROOT_INUMBER || ino >= fs_ninodes) return ino;
+	pthread_mutex_lock(&fs_inodes_lock);
+	fuse_ino_t parent = fs_inodes[ino].parent;
+	pthread_mutex_unlock(&fs_inodes_lock);
+	return parent != 0 ? parent : ino;
+}
+
+/**
+ * @brief free an unlinked inode and its sectors, once the kernel forgot it and
+ *        no file is open on it any more (as a Unix kernel does with i_nlink and i_count)
+ * @param ino the inode number
+ */
+static void fs_reap(fuse_ino_t ino)
+{
+	if(ino >= fs_ninodes) return;
+	fslock_inode_write(&fs, (uint16_t)ino);
+	struct fs_inode *i = &fs_inodes[ino];
+	pthread_mutex_lock(&fs_inodes_lock);
+	int reap = i->unlinked && i->nlookup == 0 && i->files == NULL;
+	if(reap) i->cached = 0;
+	pthread_mutex_unlock(&fs_inodes_lock);
+	if(reap){
+		//the sectors of a large file are released in the background
+		struct filev6 fv6;
+		if(filev6_open(&fs, (uint16_t)ino, &fv6) == 0) (void)filev6_delete(&fs, &fv6);
+		i->unlinked = 0;
+	}
+	fslock_inode_unlock(&fs, (uint16_t)ino);
+}
+
+/**
+ * @brief drop references the kernel held on an inode
+ * @param ino the inode number
+ * @param nlookup the number of references to drop
+ */
+static void fs_forget_one(fuse_ino_t ino, uint64_t nlookup)
+{
+	if(ino >= fs_ninodes) return;
+	pthread_mutex_lock(&fs_inodes_lock);
+	struct fs_inode *i = &fs_inodes[ino];
+	i->nlookup = nlookup < i->nlookup ? i->nlookup - nlookup : 0;
+	int forgotten = i->nlookup == 0;
+	pthread_mutex_unlock(&fs_inodes_lock);
+	if(forgotten) fs_reap(ino);
+}
 
+/**
+ * @brief tell whether the pages the kernel cached for a file are still valid,
+ *        and remember the inode for the next open
+ * @param inr the inode number
+ * @param inode the content of the inode, just read by open
+ * @return 1 if the inode is unchanged since the last open (the pages can be kept); 0 otherwise
+ */
+static int fs_keep_cache(uint16_t inr, const struct inode *inode)
+{
+	if(inr >= fs_ninodes) return 0;
+	if(fs.s.s_ronly) return 1;
+	pthread_mutex_lock(&fs_inodes_lock);
+	struct fs_inode *i = &fs_inodes[inr];
+	//reading the file changes its i_atime, not its pages
+	struct inode now = *inode;
+	memcpy(now.i_atime, i->opened.i_atime, sizeof(now.i_atime));
+	int keep = i->cached && memcmp(&i->opened, &now, sizeof(now)) == 0;
+	i->opened = *inode;
+	i->cached = 1;
+	pthread_mutex_unlock(&fs_inodes_lock);
+	return keep;
+}
+
+/**
+ * @brief invalidation hook of the write path, to be called whenever the content
+ *        or the attributes of an inode change: its next open drops the pages of
+ *        the kernel.
+ * @param ino the inode number
+ * @param notify 1 if the change was not requested by the kernel (which then does not
+ *        know about it): the kernel is told at once. Must be 0 when called while
+ *        answering a request of the kernel on this inode, which could deadlock.
+ */
+static void fs_invalidate_inode(fuse_ino_t ino, int notify)
+{
+	if(ino < fs_ninodes){
+		pthread_mutex_lock(&fs_inodes_lock);
+		fs_inodes[ino].cached = 0;
+		pthread_mutex_unlock(&fs_inodes_lock);
+	}
+	if(notify && fs_session != NULL) fuse_lowlevel_notify_inval_inode(fs_session, ino, 0, 0);
+}
+
+/**
+ * @brief invalidation hook of the write path, to be called whenever an entry of a
+ *        directory is added or removed
+ * @param parent the inode number of the directory
+ * @param name the name of the entry
+ * @param notify 1 if the change was not requested by the kernel (see fs_invalidate_inode)
+ */
+static void fs_invalidate_entry(fuse_ino_t parent, const char *name, int notify)
+{
+	fs_invalidate_inode(parent, 0);
+	if(notify && fs_session != NULL) fuse_lowlevel_notify_inval_entry(fs_session, parent, name, strlen(name));
+}
+
+/**
+ * @brief give the new content of an inode to all its open files, after a write
+ *        (the inode must be locked exclusively)
+ * @param ino the inode number
+ * @param inode the new content of the inode
+ */
+static void fs_files_refresh(fuse_ino_t ino, const struct inode *inode)
+{
+	for(struct fs_file *f = fs_inodes[ino].files; f != NULL; f = f->next){
+		f->fv6.i_node = *inode;
+		filev6_unmap(&f->fv6);
+		(void)filev6_map(&f->fv6);//without its map, a file is read through its inode
+	}
+	fs_invalidate_inode(ino, 0);
+}
+
+/**
+ * @brief take bytes for a buffer out of those delayed allocation may still use
+ * @param want the number of bytes wanted
+ * @return the number of bytes taken, less than want (down to 0) if there are not enough
+ */
+static int32_t fs_delalloc_take(int32_t want)
+{
+	pthread_mutex_lock(&fs_delalloc_lock);
+	if(want > FS_DELALLOC_MAX - fs_delalloc_bytes) want = FS_DELALLOC_MAX - fs_delalloc_bytes;
+	fs_delalloc_bytes += want;
+	pthread_mutex_unlock(&fs_delalloc_lock);
+	return want;
+}
+
+/**
+ * @brief give back bytes taken by fs_delalloc_take
+ * @param len the number of bytes
+ */
+static void fs_delalloc_give(int32_t len)
+{
+	pthread_mutex_lock(&fs_delalloc_lock);
+	fs_delalloc_bytes -= len;
+	pthread_mutex_unlock(&fs_delalloc_lock);
+}
+
+/**
+ * @brief write the first buffered bytes of an open file to the disk
+ *        (the inode must be locked exclusively)
+ * @param ino the inode number
+ * @param f the open file
+ * @param len the number of bytes to write (at most f->wb_len)
+ * @return 0 on success; <0 on error (the bytes then stay in the buffer)
+ */
+static int fs_file_push(fuse_ino_t ino, struct fs_file *f, int32_t len)
+{
+	if(len <= 0) return 0;
+
+	//with delayed allocation, the sectors of the bytes are chosen now, all at once
+	//(those which cannot be reserved are allocated by the write, if it needs them)
+	if(fs_delalloc) (void)filev6_fallocate(&fs, &f->fv6, f->wb_off, len);
+	int err = filev6_writeat(&fs, &f->fv6, f->wbuf, len, f->wb_off);
+	if(err < 0) return err;
+
+	memmove(f->wbuf, f->wbuf + len, f->wb_len - len);
+	f->wb_off += len;
+	f->wb_len -= len;
+	if(f->wb_len == 0) --fs_inodes[ino].dirty;
+	//an empty buffer gives back the bytes it took to grow
+	if(f->wb_len == 0 && f->wb_size > FS_WRITEBACK_SIZE){
+		uint8_t *wbuf = realloc(f->wbuf, FS_WRITEBACK_SIZE);
+		if(wbuf != NULL) f->wbuf = wbuf;
+		fs_delalloc_give(f->wb_size - FS_WRITEBACK_SIZE);
+		f->wb_size = FS_WRITEBACK_SIZE;
+	}
+	fs_files_refresh(ino, &f->fv6.i_node);
 	return 0;
 }
 
-static int fs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
-			 off_t offset, struct fuse_file_info *fi)
+/**
+ * @brief write all the buffered bytes of the open files of an inode to the disk
+ *        (the inode must be locked exclusively)
+ * @param ino the inode number
+ * @return 0 on success; <0 on error
+ */
+static int fs_inode_push(fuse_ino_t ino)
+{
+	int ret = 0;
+	for(struct fs_file *f = fs_inodes[ino].files; f != NULL; f = f->next){
+		int err = fs_file_push(ino, f, f->wb_len);
+		if(err < 0) ret = err;
+	}
+	return ret;
+}
+
+/**
+ * @brief lock an inode to read it, once the bytes buffered for it are on the disk
+ * @param ino the inode number
+ * @return 0 on success; <0 on error (the inode is locked anyway)
+ */
+static int fs_lock_clean(fuse_ino_t ino)
+{
+	fslock_inode_read(&fs, (uint16_t)ino);
+	if(ino >= fs_ninodes || fs_inodes[ino].dirty == 0) return 0;
+
+	//the buffers are written under the exclusive lock, kept until the read is over
+	fslock_inode_unlock(&fs, (uint16_t)ino);
+	fslock_inode_write(&fs, (uint16_t)ino);
+	return fs_inode_push(ino);
+}
+
+static void fs_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+	//only the entry itself is searched: the kernel already resolved the parent
+	fslock_inode_read(&fs, (uint16_t)parent);
+	int inr = direntv6_walk(&fs, (uint16_t)parent, name, strlen(name));
+	fslock_inode_unlock(&fs, (uint16_t)parent);
+	if(inr < 0){
+		fuse_reply_err(req, fs_errno(inr));
+		return;
+	}
+
+	struct inode inode;
+	int err = fs_lock_clean((uint16_t)inr);
+	if(err == 0) err = inode_read(&fs, (uint16_t)inr, &inode);
+	fslock_inode_unlock(&fs, (uint16_t)inr);
+	if(err < 0){
+		fuse_reply_err(req, fs_errno(err));
+		return;
+	}
+
+	struct fuse_entry_param e;
+	fs_fill_entry((uint16_t)inr, &inode, &e);
+	if(fuse_reply_entry(req, &e) == 0) fs_ref((uint16_t)inr, parent);
+}
+
+static void fs_forget(fuse_req_t req, fuse_ino_t ino, uint64_t nlookup)
+{
+	fs_forget_one(ino, nlookup);
+	fuse_reply_none(req);
+}
+
+static void fs_forget_multi(fuse_req_t req, size_t count, struct fuse_forget_data *forgets)
+{
+	for(size_t i = 0; i < count; ++i){
+		fs_forget_one(forgets[i].ino, forgets[i].nlookup);
+	}
+	fuse_reply_none(req);
+}
+
+static void fs_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
 {
-	(void) offset;
 	(void) fi;
 
+	struct inode inode;
+	int err = fs_lock_clean(ino);
+	if(err == 0) err = inode_read(&fs, (uint16_t)ino, &inode);
+	fslock_inode_unlock(&fs, (uint16_t)ino);
+	if(err < 0){
+		fuse_reply_err(req, fs_errno(err));
+		return;
+	}
+
+	struct stat st;
+	fs_fill_stat((uint16_t)ino, &inode, &st);
+	fuse_reply_attr(req, &st, fs_attr_timeout);
+}
+
+/* Offset cookies of the entries: 1 and 2 stand for "." and "..", and the
+ * entry at slot n of the directory gets n + 3, so that a call resuming at
+ * cookie c starts reading at slot c - 2.
+ */
+#define FS_DOT_COOKIES 2
+
+/* Number of entries whose inodes are fetched at once by fs_do_readdir */
+#define FS_READDIR_BATCH (4 * DIRENTRIES_PER_SECTOR)
+
+/**
+ * @brief fill one page of a directory listing
+ * @param req the request
+ * @param ino the inode number of the directory
+ * @param size the size of the buffer of the kernel
+ * @param offset the cookie of the last entry returned by the previous call (0 for the first one)
+ * @param plus 1 to give the attributes of the entries (readdirplus), which the kernel
+ *        then holds a reference to; 0 otherwise
+ */
+static void fs_do_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, int plus)
+{
 	struct directory_reader d;
-	char name[DIRENT_MAXLEN+1];
-	int err = direntv6_dirlookup(&fs, ROOT_INUMBER, path);
-	if (err<0) return err;
-	uint16_t inr = err;
-	err = direntv6_opendir(&fs,inr,&d);
-	if (err<0) return err;
-		
-	filler(buf, ".", NULL, 0);
-	filler(buf, "..", NULL, 0);
-
-	int r = direntv6_nonempty(&d);
-	while (r){
-		//we change the condition of the loop r
-		r = direntv6_readdir(&d,name,&inr);
-		if (r<0) return r;
-		filler(buf,name,NULL,0);
+	int err = direntv6_opendir(&fs, (uint16_t)ino, &d);
+	if (err<0){
+		fuse_reply_err(req, fs_errno(err));
+		return;
 	}
-	return 0;
+
+	char *buf = malloc(size);
+	if (buf == NULL){
+		fuse_reply_err(req, ENOMEM);
+		return;
+	}
+	size_t pos = 0;
+	size_t len;
+	struct fuse_entry_param e;
+	memset(&e, 0, sizeof(e));
+
+	//"." and "..": the kernel does not take references on them, hence ino 0
+	e.attr.st_mode = S_IFDIR;
+	const char *dots[FS_DOT_COOKIES] = {".", ".."};
+	for (off_t c = offset; c < FS_DOT_COOKIES; ++c){
+		e.attr.st_ino = c == 0 ? ino : fs_parent(ino);
+		len = plus ? fuse_add_direntry_plus(req, buf + pos, size - pos, dots[c], &e, c + 1)
+		           : fuse_add_direntry(req, buf + pos, size - pos, dots[c], &e.attr, c + 1);
+		if (len > size - pos) goto full;
+		pos += len;
+	}
+	if (offset > FS_DOT_COOKIES){
+		err = direntv6_seekdir(&d, offset - FS_DOT_COOKIES);
+		if (err<0) goto error;
+	}
+
+	//the attributes come with the names, so that the inodes are read a sector at a time
+	struct direntv6_plus entries[FS_READDIR_BATCH];
+	int n;
+	while ((n = direntv6_readdirplus(&d, entries, FS_READDIR_BATCH)) > 0){
+		for (int i = 0; i < n; ++i){
+			if (entries[i].err < 0) continue;
+			off_t cookie = entries[i].next + FS_DOT_COOKIES;
+			if (plus){
+				//the reference is counted only once the entry fits in the buffer
+				fs_fill_entry(entries[i].inr, &entries[i].inode, &e);
+				len = fuse_add_direntry_plus(req, buf + pos, size - pos, entries[i].name, &e, cookie);
+				if (len > size - pos) goto full;
+				fs_ref(entries[i].inr, ino);
+			}else{
+				fs_fill_stat(entries[i].inr, &entries[i].inode, &e.attr);
+				len = fuse_add_direntry(req, buf + pos, size - pos, entries[i].name, &e.attr, cookie);
+				if (len > size - pos) goto full;
+			}
+			pos += len;
+		}
+	}
+	if (n<0 && pos == 0){
+		err = n;
+		goto error;
+	}
+
+full:
+	//the buffer of the kernel is full (or the directory is over): the next call resumes after the last entry
+	fuse_reply_buf(req, buf, pos);
+	free(buf);
+	return;
+
+error:
+	fuse_reply_err(req, fs_errno(err));
+	free(buf);
+}
+
+static void fs_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset,
+			 struct fuse_file_info *fi)
+{
+	(void) fi;
+	fslock_inode_read(&fs, (uint16_t)ino);
+	fs_do_readdir(req, ino, size, offset, 0);
+	fslock_inode_unlock(&fs, (uint16_t)ino);
+}
+
+static void fs_readdirplus(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset,
+			 struct fuse_file_info *fi)
+{
+	(void) fi;
+	fslock_inode_read(&fs, (uint16_t)ino);
+	fs_do_readdir(req, ino, size, offset, 1);
+	fslock_inode_unlock(&fs, (uint16_t)ino);
+}
+
+/**
+ * @brief return the open file of a handle given by the kernel
+ * @param fi the information of the kernel about the open file
+ * @return the file, opened by fs_open_file
+ */
+static struct fs_file *fs_handle(const struct fuse_file_info *fi)
+{
+	return (struct fs_file *)(uintptr_t)fi->fh;
+}
+
+/**
+ * @brief open a file for the kernel
+ * @param ino the inode number
+ * @param f where to put the open file (OUT)
+ * @return 0 on success; <0 on error (ERR_BAD_PARAMETER for a directory)
+ */
+static int fs_open_file(fuse_ino_t ino, struct fs_file **f)
+{
+	if(ino >= fs_ninodes) return ERR_INODE_OUTOF_RANGE;
+	*f = calloc(1, sizeof(struct fs_file));
+	if(*f == NULL) return ERR_NOMEM;
+
+	fslock_inode_write(&fs, (uint16_t)ino);
+	int err = filev6_open(&fs, (uint16_t)ino, &(*f)->fv6);
+	if(err == 0 && ((*f)->fv6.i_node.i_mode & IFDIR)) err = ERR_BAD_PARAMETER;
+	else if(err == 0) err = filev6_map(&(*f)->fv6);
+	if(err == 0){
+		(*f)->next = fs_inodes[ino].files;
+		fs_inodes[ino].files = *f;
+	}
+	fslock_inode_unlock(&fs, (uint16_t)ino);
+	if(err < 0){
+		free(*f);
+		*f = NULL;
+	}
+	return err;
 }
 
-static int fs_read(const char *path, char *buf, size_t size, off_t offset,
+/**
+ * @brief close a file opened by fs_open_file, writing its buffered bytes to the disk
+ * @param ino the inode number
+ * @param f the open file
+ * @return 0 on success; <0 on error (the file is closed anyway)
+ */
+static int fs_close_file(fuse_ino_t ino, struct fs_file *f)
+{
+	fslock_inode_write(&fs, (uint16_t)ino);
+	int err = fs_file_push(ino, f, f->wb_len);
+	if(f->wb_len > 0) --fs_inodes[ino].dirty;//the bytes which could not be written are lost
+	struct fs_file **p = &fs_inodes[ino].files;
+	while(*p != f) p = &(*p)->next;
+	*p = f->next;
+	fslock_inode_unlock(&fs, (uint16_t)ino);
+
+	filev6_unreserve(&fs, &f->fv6);
+	filev6_unmap(&f->fv6);
+	if(f->wb_size > FS_WRITEBACK_SIZE) fs_delalloc_give(f->wb_size - FS_WRITEBACK_SIZE);
+	free(f->wbuf);
+	free(f);
+	fs_reap(ino);
+	return err;
+}
+
+/* The inode and the block map of a file are read once, at open: reads then
+ * go straight to the sectors of the file.
+ */
+static void fs_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+	struct fs_file *f;
+	int err = fs_open_file(ino, &f);
+	if(err < 0){
+		fuse_reply_err(req, err == ERR_BAD_PARAMETER ? EISDIR : fs_errno(err));
+		return;
+	}
+
+	//the pages of the kernel stay valid as long as the file does not change
+	fi->keep_cache = fs_keep_cache((uint16_t)ino, &f->fv6.i_node);
+	fi->fh = (uintptr_t)f;
+	//the open was interrupted: release will never come
+	if(fuse_reply_open(req, fi) != 0) (void)fs_close_file(ino, f);
+}
+
+static void fs_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+	int err = fs_close_file(ino, fs_handle(fi));
+	fuse_reply_err(req, err < 0 ? fs_errno(err) : 0);
+}
+
+static void fs_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset,
 		      struct fuse_file_info *fi)
 {
+	//the buffered bytes of the file are written first: they must be read back
+	int err = fs_lock_clean(ino);
+	if(err < 0){
+		fslock_inode_unlock(&fs, (uint16_t)ino);
+		fuse_reply_err(req, fs_errno(err));
+		return;
+	}
+	//each request has its own cursor: requests on the same handle may run in parallel
+	struct filev6 fv6 = fs_handle(fi)->fv6;
+
+	//nothing to read past the end of the file
+	if(offset >= inode_getsize(&fv6.i_node)){
+		fslock_inode_unlock(&fs, (uint16_t)ino);
+		fuse_reply_buf(req, NULL, 0);
+		return;
+	}
+	err = filev6_lseek(&fv6, (int32_t)offset);
+	if(err < 0){
+		fslock_inode_unlock(&fs, (uint16_t)ino);
+		fuse_reply_err(req, fs_errno(err));
+		return;
+	}
+
+	//at most 'size' bytes are answered, whatever the size of the file
+	int32_t len = inode_getsize(&fv6.i_node) - fv6.offset;
+	if(size < (size_t)len) len = (int32_t)size;
+
+	//the date of the read stays in memory for a while (see inode_touch)
+	(void)inode_touch(&fs, (uint16_t)ino, &fv6.i_node, INODE_ATIME);
+
+	//the answer points at the runs of the file in the image, which libfuse
+	//copies (or splices) straight to the kernel, without reading them here
+	int max = len / SECTOR_SIZE + 2;
+	struct filev6_extent *ext = calloc(max, sizeof(struct filev6_extent));
+	struct fuse_bufvec *bufv = calloc(1, sizeof(struct fuse_bufvec) + max * sizeof(struct fuse_buf));
+	int n = ext == NULL || bufv == NULL ? ERR_NOMEM : filev6_extents(&fv6, len, ext, max);
+	//holes are answered from a single buffer of zeros, without reading the image
+	char *zeros = NULL;
+	for(int i = 0; i < n && zeros == NULL; ++i){
+		if(ext[i].sector == 0 && (zeros = calloc(1, len)) == NULL) n = ERR_NOMEM;
+	}
+	if(n < 0){
+		fuse_reply_err(req, fs_errno(n));
+	}else{
+		bufv->count = n;
+		for(int i = 0; i < n; ++i){
+			if(ext[i].sector == 0){
+				bufv->buf[i].flags = 0;
+				bufv->buf[i].mem = zeros;
+			}else{
+				bufv->buf[i].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK | FUSE_BUF_FD_RETRY;
+				bufv->buf[i].fd = fileno(fs.f);
+				bufv->buf[i].pos = (off_t)ext[i].sector * SECTOR_SIZE + ext[i].offset;
+			}
+			bufv->buf[i].size = ext[i].size;
+		}
+		//the data is read while replying: the inode stays locked until then
+		fuse_reply_data(req, bufv, FUSE_BUF_SPLICE_MOVE);
+	}
+	fslock_inode_unlock(&fs, (uint16_t)ino);
+	free(zeros);
+	free(ext);
+	free(bufv);
+}
+
+/**
+ * @brief write bytes to an open file, through its buffer (the inode must be locked exclusively)
+ * @param ino the inode number
+ * @param f the open file
+ * @param buf the bytes
+ * @param size the number of bytes
+ * @param off the offset in the file of the first byte
+ * @return the number of bytes taken, size unless an error stopped the write past some of them;
+ *         <0 on an error before any byte was taken
+ */
+static int fs_file_write(fuse_ino_t ino, struct fs_file *f, const char *buf, size_t size, off_t off)
+{
+	//the bytes buffered by the other open files were written before: they reach the disk first
+	int err = 0;
+	for(struct fs_file *g = fs_inodes[ino].files; g != NULL && err == 0; g = g->next){
+		if(g != f) err = fs_file_push(ino, g, g->wb_len);
+	}
+	//only a write following the buffered bytes is gathered with them
+	if(err == 0 && f->wb_len > 0 && off != f->wb_off + f->wb_len) err = fs_file_push(ino, f, f->wb_len);
+	if(err < 0) return err;
+
+	//a write as large as the buffer goes straight to the disk (unless its sectors are chosen later)
+	if(!fs_delalloc && f->wb_len == 0 && size >= FS_WRITEBACK_SIZE){
+		err = filev6_writeat(&fs, &f->fv6, buf, (int)size, (int32_t)off);
+		if(err < 0) return err;
+		fs_files_refresh(ino, &f->fv6.i_node);
+		return (int)size;
+	}
+
+	if(f->wbuf == NULL){
+		if((f->wbuf = malloc(FS_WRITEBACK_SIZE)) == NULL) return ERR_NOMEM;
+		f->wb_size = FS_WRITEBACK_SIZE;
+	}
+	//with delayed allocation, the buffer doubles so that the bytes do not fill it
+	//(the file cannot grow past FS_MAX_FILE_SIZE, nor can the buffer, and it only
+	//grows by the bytes left out of FS_DELALLOC_MAX)
+	if(fs_delalloc && f->wb_len + (int32_t)size >= f->wb_size && f->wb_size < FS_MAX_FILE_SIZE){
+		int32_t wb_size = f->wb_size;
+		while(wb_size <= f->wb_len + (int32_t)size) wb_size *= 2;
+		if(wb_size > FS_MAX_FILE_SIZE) wb_size = FS_MAX_FILE_SIZE;
+		int32_t grow = fs_delalloc_take(wb_size - f->wb_size);
+		if(grow > 0){
+			uint8_t *wbuf = realloc(f->wbuf, f->wb_size + grow);
+			if(wbuf == NULL){
+				fs_delalloc_give(grow);
+				return ERR_NOMEM;
+			}
+			f->wbuf = wbuf;
+			f->wb_size += grow;
+		}
+	}
+	int done = 0;
+	while(size > 0){
+		if(f->wb_len == 0){
+			f->wb_off = (int32_t)off;
+			++fs_inodes[ino].dirty;
+		}
+		size_t n = (size_t)(f->wb_size - f->wb_len);
+		if(n > size) n = size;
+		memcpy(f->wbuf + f->wb_len, buf, n);
+		f->wb_len += (int32_t)n;
+		buf += n;
+		off += n;
+		size -= n;
+		done += (int)n;
+
+		//a full buffer is written up to its last sector boundary: the rest waits for the next write
+		//(the bytes already in the buffer are taken: they stay there if it cannot be written)
+		if(f->wb_len == f->wb_size){
+			int32_t len = (f->wb_off + f->wb_len) / SECTOR_SIZE * SECTOR_SIZE - f->wb_off;
+			err = fs_file_push(ino, f, len > 0 ? len : f->wb_len);
+			if(err < 0) return done > 0 ? done : err;
+		}
+	}
+	return done;
+}
+
+static void fs_write(fuse_req_t req, fuse_ino_t ino, const char *buf, size_t size, off_t off,
+		       struct fuse_file_info *fi)
+{
+	if(off < 0 || off > FS_MAX_FILE_SIZE || size > (size_t)(FS_MAX_FILE_SIZE - off)){
+		fuse_reply_err(req, EFBIG);
+		return;
+	}
+
+	fslock_inode_write(&fs, (uint16_t)ino);
+	int done = fs_file_write(ino, fs_handle(fi), buf, size, off);
+	fslock_inode_unlock(&fs, (uint16_t)ino);
+	//a short write tells the kernel which bytes were taken: it comes back for the others
+	if(done < 0) fuse_reply_err(req, fs_errno(done));
+	else fuse_reply_write(req, (size_t)done);
+}
+
+/* Each close of a descriptor of the file: its buffered bytes are written */
+static void fs_flush(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+	struct fs_file *f = fs_handle(fi);
+	fslock_inode_write(&fs, (uint16_t)ino);
+	int err = fs_file_push(ino, f, f->wb_len);
+	fslock_inode_unlock(&fs, (uint16_t)ino);
+	fuse_reply_err(req, err < 0 ? fs_errno(err) : 0);
+}
+
+static void fs_fsync(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info *fi)
+{
+	(void) datasync;
 	(void) fi;
-	int inr = direntv6_dirlookup(&fs, ROOT_INUMBER, path);
-	if(inr < 0) return 0;
+	fslock_inode_write(&fs, (uint16_t)ino);
+	int err = fs_inode_push(ino);
+	fslock_inode_unlock(&fs, (uint16_t)ino);
+	if(err == 0) err = writeback_sync(&fs);
+	if(err == 0 && fsync(fileno(fs.f)) != 0) err = ERR_IO;
+	fuse_reply_err(req, err < 0 ? fs_errno(err) : 0);
+}
+
+/* The sectors are reserved for the open file, which fills them as it is
+ * written, the holes of the range included; without FALLOC_FL_KEEP_SIZE the
+ * file also gets its new size, the new bytes being holes until they are written.
+ */
+static void fs_fallocate(fuse_req_t req, fuse_ino_t ino, int mode, off_t offset,
+			 off_t length, struct fuse_file_info *fi)
+{
+	if(mode & ~FALLOC_FL_KEEP_SIZE){
+		fuse_reply_err(req, EOPNOTSUPP);
+		return;
+	}
+	if(offset < 0 || length <= 0){
+		fuse_reply_err(req, EINVAL);
+		return;
+	}
+	if(offset + length > FS_MAX_FILE_SIZE){
+		fuse_reply_err(req, EFBIG);
+		return;
+	}
+
+	//the buffered bytes are written first: they may fill some holes of the range
+	struct fs_file *f = fs_handle(fi);
+	int32_t len = (int32_t)(offset + length);
+	fslock_inode_write(&fs, (uint16_t)ino);
+	int err = fs_inode_push(ino);
+	if(err == 0) err = filev6_fallocate(&fs, &f->fv6, (int32_t)offset, (int32_t)length);
+	if(err == 0 && !(mode & FALLOC_FL_KEEP_SIZE) && len > inode_getsize(&f->fv6.i_node)){
+		err = filev6_truncate(&fs, &f->fv6, len);
+		if(err == 0) fs_files_refresh(ino, &f->fv6.i_node);
+	}
+	fslock_inode_unlock(&fs, (uint16_t)ino);
+	fuse_reply_err(req, err < 0 ? fs_errno(err) : 0);
+}
+
+/**
+ * @brief create a new entry in a directory and fill the answer to the kernel
+ * @param parent the inode number of the directory
+ * @param name the name of the entry
+ * @param mode the mode of the new inode (0 for a file, IFDIR for a directory)
+ * @param e the answer (OUT)
+ * @return 0 on success; <0 on error
+ */
+static int fs_new_entry(fuse_ino_t parent, const char *name, uint16_t mode, struct fuse_entry_param *e)
+{
+	fslock_inode_write(&fs, (uint16_t)parent);
+	int inr = direntv6_create_in(&fs, (uint16_t)parent, name, strlen(name), mode);
+	fslock_inode_unlock(&fs, (uint16_t)parent);
+	if(inr < 0) return inr;
+	fs_invalidate_entry(parent, name, 0);
+
+	struct inode inode;
+	fslock_inode_read(&fs, (uint16_t)inr);
+	int err = inode_read(&fs, (uint16_t)inr, &inode);
+	fslock_inode_unlock(&fs, (uint16_t)inr);
+	if(err < 0) return err;
+	fs_fill_entry((uint16_t)inr, &inode, e);
+	return 0;
+}
+
+static void fs_create(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode,
+			struct fuse_file_info *fi)
+{
+	(void) mode;
+	struct fuse_entry_param e;
+	struct fs_file *f = NULL;
+	int err = fs_new_entry(parent, name, 0, &e);
+	if(err == 0) err = fs_open_file(e.ino, &f);
+	if(err < 0){
+		fuse_reply_err(req, fs_errno(err));
+		return;
+	}
+
+	fi->keep_cache = fs_keep_cache((uint16_t)e.ino, &f->fv6.i_node);
+	fi->fh = (uintptr_t)f;
+	if(fuse_reply_create(req, &e, fi) == 0) fs_ref((uint16_t)e.ino, parent);
+	else (void)fs_close_file(e.ino, f);
+}
+
+static void fs_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode)
+{
+	(void) mode;
+	struct fuse_entry_param e;
+	int err = fs_new_entry(parent, name, IFDIR, &e);
+	if(err < 0) fuse_reply_err(req, fs_errno(err));
+	else if(fuse_reply_entry(req, &e) == 0) fs_ref((uint16_t)e.ino, parent);
+}
+
+/**
+ * @brief remove an entry from a directory; its inode is freed by fs_reap
+ * @param req the request
+ * @param parent the inode number of the directory
+ * @param name the name of the entry
+ * @param dir 1 for rmdir; 0 for unlink
+ */
+static void fs_remove(fuse_req_t req, fuse_ino_t parent, const char *name, int dir)
+{
+	//the directory is locked before the entry, which must not change meanwhile
+	fslock_inode_write(&fs, (uint16_t)parent);
+	int inr = direntv6_walk(&fs, (uint16_t)parent, name, strlen(name));
+	if(inr > 0){
+		uint16_t child = (uint16_t)inr;
+		fslock_inode_write(&fs, child);
+		inr = direntv6_unlink_in(&fs, (uint16_t)parent, name, strlen(name), dir);
+		if(inr > 0 && child < fs_ninodes) fs_inodes[child].unlinked = 1;
+		fslock_inode_unlock(&fs, child);
+	}
+	fslock_inode_unlock(&fs, (uint16_t)parent);
+	if(inr < 0){
+		fuse_reply_err(req, inr == ERR_BAD_PARAMETER && !dir ? EISDIR : fs_errno(inr));
+		return;
+	}
+
+	fs_invalidate_entry(parent, name, 0);
+	fs_reap(inr);
+	fuse_reply_err(req, 0);
+}
+
+static void fs_unlink(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+	fs_remove(req, parent, name, 0);
+}
+
+static void fs_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+	fs_remove(req, parent, name, 1);
+}
+
+/**
+ * @brief bring a date into the range of those an inode can store
+ * @param t a date, in seconds since 1970
+ * @return the date, clamped to 0..UINT32_MAX
+ */
+static uint32_t fs_date(time_t t)
+{
+	if(t < 0) return 0;
+	if((uint64_t)t > UINT32_MAX) return UINT32_MAX;
+	return (uint32_t)t;
+}
+
+/* The size and the dates can be changed: the other attributes are not stored on the disk */
+static void fs_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr, int to_set,
+			 struct fuse_file_info *fi)
+{
+	(void) fi;
+	if(ino >= fs_ninodes){
+		fuse_reply_err(req, ENOENT);
+		return;
+	}
 
 	struct filev6 fv6;
-	int err = filev6_open(&fs, inr, &fv6);
-	if(err < 0) return 0;
-	
-	if (!(fv6.i_node.i_mode & IALLOC)) return ERR_UNALLOCATED_INODE;
-	if (fv6.i_node.i_mode & IFDIR) return ERR_BAD_PARAMETER;
-	err = filev6_lseek(&fv6, offset);
-	if(err < 0) return 0;
-	
-	uint8_t tab[SECTOR_SIZE];
-	int readBytes = 0;
-	unsigned int total = 0;
-	while(total < size && (readBytes = filev6_readblock(&fv6, tab)) > 0){
-		//copy 'size' bytes of the fv6 to buf
-		memcpy(buf + total, tab, readBytes);
-		total += readBytes;
-	}
-	return total;
-}
-
-static struct fuse_operations available_ops = {
+	fslock_inode_write(&fs, (uint16_t)ino);
+	int err = fs_inode_push(ino);
+	if(err == 0) err = filev6_open(&fs, (uint16_t)ino, &fv6);
+	if(err == 0 && (to_set & FUSE_SET_ATTR_SIZE)){
+		if(fv6.i_node.i_mode & IFDIR) err = ERR_INVALID_DIRECTORY_INODE;
+		else if(attr->st_size < 0 || attr->st_size > FS_MAX_FILE_SIZE) err = ERR_FILE_TOO_LARGE;
+		else err = filev6_truncate(&fs, &fv6, (int32_t)attr->st_size);
+		if(err == 0) fs_files_refresh(ino, &fv6.i_node);
+	}
+	int what = (to_set & (FUSE_SET_ATTR_ATIME | FUSE_SET_ATTR_ATIME_NOW) ? INODE_ATIME : 0)
+		 | (to_set & (FUSE_SET_ATTR_MTIME | FUSE_SET_ATTR_MTIME_NOW) ? INODE_MTIME : 0);
+	if(err == 0 && what != 0){
+		uint32_t now = fs_date(time(NULL));
+		uint32_t atime = to_set & FUSE_SET_ATTR_ATIME_NOW ? now : fs_date(attr->st_atime);
+		uint32_t mtime = to_set & FUSE_SET_ATTR_MTIME_NOW ? now : fs_date(attr->st_mtime);
+		err = inode_settimes(&fs, (uint16_t)ino, &fv6.i_node, what, atime, mtime);
+		if(err == 0) fs_files_refresh(ino, &fv6.i_node);
+	}
+	fslock_inode_unlock(&fs, (uint16_t)ino);
+	if(err < 0){
+		fuse_reply_err(req, err == ERR_INVALID_DIRECTORY_INODE ? EISDIR : fs_errno(err));
+		return;
+	}
+
+	struct stat st;
+	fs_fill_stat((uint16_t)ino, &fv6.i_node, &st);
+	fuse_reply_attr(req, &st, fs_attr_timeout);
+}
+
+/* The free counts are kept up to date by the bitmaps: nothing is scanned */
+static void fs_statfs(fuse_req_t req, fuse_ino_t ino)
+{
+	(void) ino;
+	struct statvfs st;
+	memset(&st, 0, sizeof(st));
+	st.f_bsize = SECTOR_SIZE;
+	st.f_frsize = SECTOR_SIZE;
+	st.f_namemax = DIRENT_MAXLEN;
+
+	fslock_bitmaps(&fs);
+	st.f_blocks = fs.fbm->max - fs.fbm->min + 1;
+	st.f_bfree = fs.fbm->nfree;
+	st.f_files = fs.ibm->max - fs.ibm->min + 1;
+	st.f_ffree = fs.ibm->nfree;
+	fslock_bitmaps_unlock(&fs);
+	st.f_bavail = st.f_bfree;
+	st.f_favail = st.f_ffree;
+
+	fuse_reply_statfs(req, &st);
+}
+
+/**
+ * @brief initialize the connection: reads are answered from the image by splicing,
+ *        and writes come as large as the kernel allows (big writes are always
+ *        enabled by FUSE 3, up to max_write)
+ * @param userdata unused
+ * @param conn the capabilities of the kernel
+ */
+static void fs_init(void *userdata, struct fuse_conn_info *conn)
+{
+	(void) userdata;
+	if(conn->max_write < FS_WRITEBACK_SIZE) conn->max_write = FS_WRITEBACK_SIZE;
+	if(conn->capable & FUSE_CAP_SPLICE_WRITE) conn->want |= FUSE_CAP_SPLICE_WRITE;
+	if(conn->capable & FUSE_CAP_SPLICE_MOVE) conn->want |= FUSE_CAP_SPLICE_MOVE;
+}
+
+static struct fuse_lowlevel_ops available_ops = {
+	.init		= fs_init,
+	.lookup		= fs_lookup,
+	.forget		= fs_forget,
+	.forget_multi	= fs_forget_multi,
 	.getattr	= fs_getattr,
+	.setattr	= fs_setattr,
+	.mkdir		= fs_mkdir,
+	.unlink		= fs_unlink,
+	.rmdir		= fs_rmdir,
 	.readdir	= fs_readdir,
+	.readdirplus	= fs_readdirplus,
+	.open		= fs_open,
+	.release	= fs_release,
 	.read		= fs_read,
+	.write		= fs_write,
+	.flush		= fs_flush,
+	.fsync		= fs_fsync,
+	.fallocate	= fs_fallocate,
+	.create		= fs_create,
+	.statfs		= fs_statfs,
 };
 
 /* From https://github.com/libfuse/libfuse/wiki/Option-Parsing.
@@ -124,6 +1096,10 @@ static int arg_parse(void *data, const char *filename, int key, struct fuse_args
 {
     (void) data;
     (void) outargs;
+    if (key == FS_KEY_DELALLOC) {
+		fs_delalloc = 1;
+		return 0;
+    }
     if (key == FUSE_OPT_KEY_NONOPT && fs.f == NULL && filename != NULL) {
 		int err = mountv6(filename, &fs);
 		if (err<0){
@@ -138,10 +1114,62 @@ static int arg_parse(void *data, const char *filename, int key, struct fuse_args
 int main(int argc, char *argv[])
 {
 	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
-    int ret = fuse_opt_parse(&args, NULL, NULL, arg_parse);
-    if (ret == 0) {
-        ret = fuse_main(args.argc, args.argv, &available_ops, NULL);
-        (void)umountv6(&fs);
-    }
-    return ret;
+	struct fuse_cmdline_opts opts;
+	struct fuse_session *se;
+	int ret = 1;
+
+	//the first argument which is not an option is the disk, the second one the mount point
+	if (fuse_opt_parse(&args, NULL, fs_opts, arg_parse) != 0 || fuse_parse_cmdline(&args, &opts) != 0) return 1;
+	if (opts.show_help || opts.mountpoint == NULL || fs.f == NULL){
+		printf("usage: %s [options] <disk> <mountpoint>\n\n", argv[0]);
+		printf("    -o delalloc            choose the sectors of the written bytes when they are flushed\n\n");
+		fuse_cmdline_help();
+		fuse_lowlevel_help();
+		goto out;
+	}
+
+	//a read-only image is mounted read-only, and cached for long
+	if (fs.s.s_ronly){
+		fs_entry_timeout = FS_RONLY_TIMEOUT;
+		fs_attr_timeout = FS_RONLY_TIMEOUT;
+		if (fuse_opt_add_arg(&args, "-oro") != 0) goto out;
+	}
+
+	fs_ninodes = (uint32_t)fs.s.s_isize * INODES_PER_SECTOR;
+	fs_inodes = calloc(fs_ninodes, sizeof(struct fs_inode));
+	if (fs_inodes == NULL) goto out;
+
+	se = fuse_session_new(&args, &available_ops, sizeof(available_ops), NULL);
+	if (se == NULL) goto out;
+	fs_session = se;
+	if (fuse_set_signal_handlers(se) == 0){
+		if (fuse_session_mount(se, opts.mountpoint) == 0){
+			fuse_daemonize(opts.foreground);
+			if (opts.singlethread){
+				ret = fuse_session_loop(se);
+			}else{
+				struct fuse_loop_config config;
+				memset(&config, 0, sizeof(config));
+				config.clone_fd = opts.clone_fd;
+				config.max_idle_threads = opts.max_idle_threads;
+				ret = fuse_session_loop_mt(se, &config);
+			}
+			fuse_session_unmount(se);
+		}
+		fuse_remove_signal_handlers(se);
+	}
+	fs_session = NULL;
+	fuse_session_destroy(se);
+
+out:
+	//the inodes unlinked while the kernel still knew them are freed now
+	for (uint32_t ino = 0; fs_inodes != NULL && ino < fs_ninodes; ++ino){
+		struct filev6 fv6;
+		if (fs_inodes[ino].unlinked && filev6_open(&fs, (uint16_t)ino, &fv6) == 0) (void)filev6_delete(&fs, &fv6);
+	}
+	free(fs_inodes);
+	free(opts.mountpoint);
+	fuse_opt_free_args(&args);
+	(void)umountv6(&fs);
+	return ret;
 }
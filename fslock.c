@@ -0,0 +1,140 @@
+#include <stdlib.h>
+#include <pthread.h>
+#include "fslock.h"
+#include "mount.h"
+
+struct fslock {
+	uint32_t ninodes;            // number of elements of inodes
+	pthread_rwlock_t *inodes;    // one lock per inode
+	pthread_mutex_t caches;      // dentry cache and directory indexes
+	pthread_mutex_t bitmaps;     // block and inode bitmaps
+	pthread_mutex_t itable;      // sectors of the inode table
+};
+
+/**
+ * @brief allocate the locks of a filesystem
+ * @param ninodes the number of inodes of the filesystem
+ * @return the locks or NULL on failure
+ */
+struct fslock *fslock_alloc(uint32_t ninodes){
+	struct fslock *l = calloc(1, sizeof(struct fslock));
+	if(l == NULL) return NULL;
+	l->inodes = calloc(ninodes ? ninodes : 1, sizeof(pthread_rwlock_t));
+	if(l->inodes == NULL){
+		free(l);
+		return NULL;
+	}
+	l->ninodes = ninodes;
+	for(uint32_t i = 0; i < ninodes; ++i){
+		pthread_rwlock_init(&l->inodes[i], NULL);
+	}
+	pthread_mutex_init(&l->caches, NULL);
+	pthread_mutex_init(&l->bitmaps, NULL);
+	pthread_mutex_init(&l->itable, NULL);
+	return l;
+}
+
+/**
+ * @brief free the locks of a filesystem
+ * @param l the locks (may be NULL)
+ */
+void fslock_free(struct fslock *l){
+	if(l == NULL) return;
+	for(uint32_t i = 0; i < l->ninodes; ++i){
+		pthread_rwlock_destroy(&l->inodes[i]);
+	}
+	pthread_mutex_destroy(&l->caches);
+	pthread_mutex_destroy(&l->bitmaps);
+	pthread_mutex_destroy(&l->itable);
+	free(l->inodes);
+	free(l);
+}
+
+/**
+ * @brief return the lock of an inode
+ * @param u the filesystem
+ * @param inr the inode number
+ * @return the lock; NULL if the filesystem has no locks or the inode is out of range
+ */
+static pthread_rwlock_t *fslock_inode(const struct unix_filesystem *u, uint16_t inr){
+	if(u == NULL || u->locks == NULL || inr >= u->locks->ninodes) return NULL;
+	return &u->locks->inodes[inr];
+}
+
+/**
+ * @brief lock an inode for reading (shared)
+ * @param u the filesystem
+ * @param inr the inode number
+ */
+void fslock_inode_read(const struct unix_filesystem *u, uint16_t inr){
+	pthread_rwlock_t *l = fslock_inode(u, inr);
+	if(l != NULL) pthread_rwlock_rdlock(l);
+}
+
+/**
+ * @brief lock an inode for writing (exclusive)
+ * @param u the filesystem
+ * @param inr the inode number
+ */
+void fslock_inode_write(const struct unix_filesystem *u, uint16_t inr){
+	pthread_rwlock_t *l = fslock_inode(u, inr);
+	if(l != NULL) pthread_rwlock_wrlock(l);
+}
+
+/**
+ * @brief release the lock of an inode, shared or exclusive
+ * @param u the filesystem
+ * @param inr the inode number
+ */
+void fslock_inode_unlock(const struct unix_filesystem *u, uint16_t inr){
+	pthread_rwlock_t *l = fslock_inode(u, inr);
+	if(l != NULL) pthread_rwlock_unlock(l);
+}
+
+/**
+ * @brief lock the dentry cache and the directory indexes
+ * @param u the filesystem
+ */
+void fslock_caches(const struct unix_filesystem *u){
+	if(u != NULL && u->locks != NULL) pthread_mutex_lock(&u->locks->caches);
+}
+
+/**
+ * @brief unlock the dentry cache and the directory indexes
+ * @param u the filesystem
+ */
+void fslock_caches_unlock(const struct unix_filesystem *u){
+	if(u != NULL && u->locks != NULL) pthread_mutex_unlock(&u->locks->caches);
+}
+
+/**
+ * @brief lock the block and inode bitmaps
+ * @param u the filesystem
+ */
+void fslock_bitmaps(const struct unix_filesystem *u){
+	if(u != NULL && u->locks != NULL) pthread_mutex_lock(&u->locks->bitmaps);
+}
+
+/**
+ * @brief unlock the block and inode bitmaps
+ * @param u the filesystem
+ */
+void fslock_bitmaps_unlock(const struct unix_filesystem *u){
+	if(u != NULL && u->locks != NULL) pthread_mutex_unlock(&u->locks->bitmaps);
+}
+
+/**
+ * @brief lock the inode table, around the read-modify-write of one of its sectors
+ * @param u the filesystem
+ */
+void fslock_itable(const struct unix_filesystem *u){
+	if(u != NULL && u->locks != NULL) pthread_mutex_lock(&u->locks->itable);
+}
+
+/**
+ * @brief unlock the inode table
+ * @param u the filesystem
+ */
+void fslock_itable_unlock(const struct unix_filesystem *u){
+	if(u != NULL && u->locks != NULL) pthread_mutex_unlock(&u->locks->itable);
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+/**
+ * @file fslock.h
+ * @brief locks making a mounted filesystem usable by several threads at once
+ *
+ * Locking scheme, to be taken in this order:
+ *  1. one reader-writer lock per inode, taken by the users of the library
+ *     (e.g. the FUSE daemon) around each operation: shared to read a file or
+ *     list a directory, exclusive to modify them. A directory is locked before
+ *     the inodes it contains.
+ *  2. the cache lock, taken inside the library around the dentry cache and the
+ *     directory indexes (which readers modify too).
+ *  3. the bitmap lock, taken inside the library around each allocation or
+ *     release in the block and inode bitmaps.
+ *  4. the inode table lock, taken inside inode_write, since several inodes
+ *     share a sector of the table.
+ * Sector I/O itself needs no lock: it does not use the cursor of the file.
+ * All the functions accept a filesystem without locks (u->locks == NULL),
+ * e.g. in single-threaded tools, and then do nothing.
+ */
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct unix_filesystem;
+struct fslock;
+
+/**
+ * @brief allocate the locks of a filesystem
+ * @param ninodes the number of inodes of the filesystem
+ * @return the locks or NULL on failure
+ */
+struct fslock *fslock_alloc(uint32_t ninodes);
+
+/**
+ * @brief free the locks of a filesystem
+ * @param l the locks (may be NULL)
+ */
+void fslock_free(struct fslock *l);
+
+/**
+ * @brief lock an inode for reading (shared)
+ * @param u the filesystem
+ * @param inr the inode number
+ */
+void fslock_inode_read(const struct unix_filesystem *u, uint16_t inr);
+
+/**
+ * @brief lock an inode for writing (exclusive)
+ * @param u the filesystem
+ * @param inr the inode number
+ */
+void fslock_inode_write(const struct unix_filesystem *u, uint16_t inr);
+
+/**
+ * @brief release the lock of an inode, shared or exclusive
+ * @param u the filesystem
+ * @param inr the inode number
+ */
+void fslock_inode_unlock(const struct unix_filesystem *u, uint16_t inr);
+
+/**
+ * @brief lock the dentry cache and the directory indexes
+ * @param u the filesystem
+ */
+void fslock_caches(const struct unix_filesystem *u);
+
+/**
+ * @brief unlock the dentry cache and the directory indexes
+ * @param u the filesystem
+ */
+void fslock_caches_unlock(const struct unix_filesystem *u);
+
+/**
+ * @brief lock the block and inode bitmaps
+ * @param u the filesystem
+ */
+void fslock_bitmaps(const struct unix_filesystem *u);
+
+/**
+ * @brief unlock the block and inode bitmaps
+ * @param u the filesystem
+ */
+void fslock_bitmaps_unlock(const struct unix_filesystem *u);
+
+/**
+ * @brief lock the inode table, around the read-modify-write of one of its sectors
+ * @param u the filesystem
+ */
+void fslock_itable(const struct unix_filesystem *u);
+
+/**
+ * @brief unlock the inode table
+ * @param u the filesystem
+ */
+void fslock_itable_unlock(const struct unix_filesystem *u);
+
+#ifdef __cplusplus
+}
+#endif
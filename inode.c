@@ -1,10 +1,13 @@
 #include <stdio.h>
 #include <string.h>
 #include <inttypes.h>
+#include <time.h>
 #include "unixv6fs.h"
 #include "inode.h"
 #include "error.h"
 #include "sector.h"
+#include "fslock.h"
+#include "writeback.h"
 
 
 /**
@@ -26,7 +29,7 @@ int inode_scan_print(const struct unix_filesystem *u){
 	//Read all the sectors containing the inodes
 	for (size_t i = 0;i < (u->s.s_isize); ++i){
 		//Read a sector and put it in the inodes tab
-		int err_read = sector_read(u->f, (uint32_t)u->s.s_inode_start+i, inode_tab);
+		int err_read = inode_read_sector(u, (uint32_t)i, inode_tab);
 		if(err_read < 0) return err_read;
 		
 		//Print the inodes of the current sector, with respect to the format asked
@@ -87,7 +90,7 @@ int inode_read(const struct unix_filesystem *u, uint16_t inr, struct inode *inod
 	if (inr >= inode_number || inr < (uint16_t)ROOT_INUMBER) return ERR_INODE_OUTOF_RANGE;
 	
 	//Read the sector and return the error if there is a error in sector_read
-	int r = sector_read(u->f, (uint32_t)((u->s.s_inode_start) + inr/INODES_PER_SECTOR), inode_tab);
+	int r = inode_read_sector(u, inr / INODES_PER_SECTOR, inode_tab);
 	if (r < 0) return r;
 	
 	//Check if the inode is allocated
@@ -98,6 +101,19 @@ int inode_read(const struct unix_filesystem *u, uint16_t inr, struct inode *inod
 	return 0;
 }
 
+/**
+ * @brief read a sector of the inode table, as it is in memory if it was written since the mount
+ * @param u the filesystem (IN)
+ * @param i the index of the sector within the inode table
+ * @param inode_tab INODES_PER_SECTOR inodes (OUT)
+ * @return 0 on success; <0 on error
+ */
+int inode_read_sector(const struct unix_filesystem *u, uint32_t i, struct inode *inode_tab){
+	M_REQUIRE_NON_NULL(u);
+	M_REQUIRE_NON_NULL(inode_tab);
+	return writeback_read(u, u->s.s_inode_start + i, inode_tab);
+}
+
 /**
  * @brief write the content of an inode to disk
  * @param u the filesystem (IN)
@@ -119,12 +135,21 @@ int inode_write(struct unix_filesystem *u, uint16_t inr, struct inode *inode){
 	uint16_t inode_number = u->s.s_isize * INODES_PER_SECTOR;
 	if (inr >= inode_number) return ERR_INODE_OUTOF_RANGE;
 
+	//with a journal, the sector is written later with the other changes of its inodes (see writeback.h)
+	if (u->writeback != NULL) return writeback_inode(u, inr, inode);
+
 	//Read the sector and return the error if there is a error in sector_read
+	//(the 15 other inodes of the sector must not be changed meanwhile)
+	fslock_itable(u);
 	int err = sector_read(u->f, ((u->s.s_inode_start) + inr/INODES_PER_SECTOR), inode_tab);
-	if (err < 0) return err;
+	if (err < 0){
+		fslock_itable_unlock(u);
+		return err;
+	}
 
 	inode_tab[inr % INODES_PER_SECTOR] = *inode;
 	err = sector_write(u->f, ((u->s.s_inode_start) + inr/INODES_PER_SECTOR), inode_tab);
+	fslock_itable_unlock(u);
 	if (err < 0) return err;
 		
 	return 0;
@@ -135,7 +160,7 @@ int inode_write(struct unix_filesystem *u, uint16_t inr, struct inode *inode){
  * @param u the filesystem (IN)
  * @param inode the inode (IN)
  * @param file_sec_off the offset within the file (in sector-size units)
- * @return >0: the sector on disk; <0 error
+ * @return >0: the sector on disk; 0: a hole; <0 error
  */
 int inode_findsector(const struct unix_filesystem *u, const struct inode *i, int32_t file_sec_off){
 	M_REQUIRE_NON_NULL(u);
@@ -164,7 +189,10 @@ int inode_findsector(const struct unix_filesystem *u, const struct inode *i, int
 	}else{
 		uint16_t buffer[ADDRESSES_PER_SECTOR];
 		
-		int err = sector_read(u->f, i->i_addr[file_sec_off/ ADDRESSES_PER_SECTOR], buffer);
+		//no indirection sector: all the sectors it would point to are holes
+		if(i->i_addr[file_sec_off / ADDRESSES_PER_SECTOR] == 0) return 0;
+		
+		int err = writeback_read(u, i->i_addr[file_sec_off/ ADDRESSES_PER_SECTOR], buffer);
 		if(err != 0){
 			return err;
 		}else{
@@ -179,14 +207,33 @@ int inode_findsector(const struct unix_filesystem *u, const struct inode *i, int
  * @return the inode number of the new inode or error code on error
  */
 int inode_alloc(struct unix_filesystem *u){
+	fslock_bitmaps(u);
 	int inr = bm_find_next(u->ibm);
+	if(inr >= 0) bm_set(u->ibm, (uint64_t)inr);
+	fslock_bitmaps_unlock(u);
 	
-	if(inr < 0){
-		return ERR_NOMEM;
-	}else{
-		bm_set(u->ibm, (uint64_t)inr);
-		return inr;
-	}
+	return inr < 0 ? ERR_NOMEM : inr;
+}
+
+/**
+ * @brief free an inode: it is cleared on disk, then made available to inode_alloc
+ * @param u the filesystem (IN)
+ * @param inr the inode number of the inode to free
+ * @return 0 on success; <0 on error
+ */
+int inode_free(struct unix_filesystem *u, uint16_t inr){
+	M_REQUIRE_NON_NULL(u);
+	if(inr == ROOT_INUMBER) return ERR_BAD_PARAMETER;
+	
+	struct inode inode;
+	memset(&inode, 0, sizeof(inode));
+	int err = inode_write(u, inr, &inode);
+	if(err < 0) return err;
+	
+	fslock_bitmaps(u);
+	bm_clear(u->ibm, inr);
+	fslock_bitmaps_unlock(u);
+	return 0;
 }
 
 /** 
@@ -202,3 +249,66 @@ int inode_setsize(struct inode *inode, int new_size){
 	inode->i_size0 = (new_size >> 16) & 0xFF;
 	return 0;
 }
+
+/**
+ * @brief record that a file was read or written now, in its inode in memory:
+ *        the inode reaches the disk with the next change of its sector, after
+ *        WRITEBACK_LAZY_AGE seconds or at umount (see writeback_touch).
+ *        As with relatime, a read only changes i_atime if the file was written
+ *        since it was last read, or if i_atime is INODE_RELATIME seconds old.
+ *        A read-only filesystem (s_ronly) is left unchanged.
+ * @param u the filesystem (IN)
+ * @param inr the inode number
+ * @param inode the content of the inode, whose dates are changed (IN/OUT)
+ * @param what INODE_ATIME, INODE_MTIME or both
+ * @return 1 if the inode changed; 0 if not; <0 on error
+ */
+int inode_touch(struct unix_filesystem *u, uint16_t inr, struct inode *inode, int what){
+	M_REQUIRE_NON_NULL(u);
+	M_REQUIRE_NON_NULL(inode);
+	if (u->s.s_ronly) return 0;
+	//the caller's inode may be older than the copy in memory (another handle read the file since)
+	if (u->writeback != NULL) {
+		int err = writeback_dates(u, inr, inode);
+		if (err < 0) return err;
+	}
+	
+	uint32_t now = (uint32_t)time(NULL);
+	int changed = 0;
+	if ((what & INODE_MTIME) && inode_gettime(inode->i_mtime) != now){
+		inode_settime(inode->i_mtime, now);
+		changed = 1;
+	}
+	uint32_t atime = inode_gettime(inode->i_atime);
+	if ((what & INODE_ATIME) && atime != now
+	    && (atime <= inode_gettime(inode->i_mtime) || now - atime >= INODE_RELATIME)){
+		inode_settime(inode->i_atime, now);
+		changed = 1;
+	}
+	if (!changed) return 0;
+	
+	//the dates alone do not make the sector dirty
+	int err = u->writeback != NULL ? writeback_touch(u, inr, inode) : inode_write(u, inr, inode);
+	return err < 0 ? err : 1;
+}
+
+/**
+ * @brief set the dates of an inode to given ones, as utimensat does: unlike with
+ *        inode_touch or inode_write, an earlier date replaces a later one
+ * @param u the filesystem (IN)
+ * @param inr the inode number
+ * @param inode the content of the inode, whose dates are changed (IN/OUT)
+ * @param what INODE_ATIME, INODE_MTIME or both
+ * @param atime the new i_atime, in seconds since 1970 (if what has INODE_ATIME)
+ * @param mtime the new i_mtime, in seconds since 1970 (if what has INODE_MTIME)
+ * @return 0 on success; <0 on error
+ */
+int inode_settimes(struct unix_filesystem *u, uint16_t inr, struct inode *inode, int what, uint32_t atime, uint32_t mtime){
+	M_REQUIRE_NON_NULL(u);
+	M_REQUIRE_NON_NULL(inode);
+	if (inr >= u->s.s_isize * INODES_PER_SECTOR) return ERR_INODE_OUTOF_RANGE;
+	
+	if (what & INODE_ATIME) inode_settime(inode->i_atime, atime);
+	if (what & INODE_MTIME) inode_settime(inode->i_mtime, mtime);
+	return u->writeback != NULL ? writeback_settimes(u, inr, inode) : inode_write(u, inr, inode);
+}
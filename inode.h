@@ -51,6 +51,35 @@ static inline int32_t inode_getsectorsize(const struct inode *inode)
     return (i_size ? ((i_size - 1) / SECTOR_SIZE + 1) * SECTOR_SIZE + 1 : 1);
 }
 
+/**
+ * @brief Return a date of an inode (i_atime or i_mtime), in seconds since 1970.
+ *        Like the size, it is stored in two 16-bit words, the high one first.
+ *
+ * @param time the date, as stored in the inode
+ * @return the date
+ */
+static inline uint32_t inode_gettime(const uint16_t time[2])
+{
+    return ((uint32_t)time[0] << 16) | time[1];
+}
+
+/**
+ * @brief Store a date in an inode (i_atime or i_mtime)
+ *
+ * @param time the date, as stored in the inode (OUT)
+ * @param t the date, in seconds since 1970
+ */
+static inline void inode_settime(uint16_t time[2], uint32_t t)
+{
+    time[0] = (uint16_t)(t >> 16);
+    time[1] = (uint16_t)(t & 0xFFFF);
+}
+
+/* What inode_touch records */
+#define INODE_ATIME 1                /* the file was read */
+#define INODE_MTIME 2                /* the file was written */
+#define INODE_RELATIME (24 * 3600)   /* age (in seconds) past which a read updates i_atime anyway */
+
 /**
  * @brief set the size of a given inode to the given size
  * @param inode the inode
@@ -87,7 +116,7 @@ int inode_read(const struct unix_filesystem *u, uint16_t inr, struct inode *inod
  * @param u the filesystem (IN)
  * @param inode the inode (IN)
  * @param file_sec_off the offset within the file (in sector-size units)
- * @return >0: the sector on disk; <0 error
+ * @return >0: the sector on disk; 0: a hole; <0 error
  */
 int inode_findsector(const struct unix_filesystem *u, const struct inode *i, int32_t file_sec_off);
 
@@ -98,6 +127,51 @@ int inode_findsector(const struct unix_filesystem *u, const struct inode *i, int
  */
 int inode_alloc(struct unix_filesystem *u);
 
+/**
+ * @brief free an inode: it is cleared on disk, then made available to inode_alloc
+ * @param u the filesystem (IN)
+ * @param inr the inode number of the inode to free
+ * @return 0 on success; <0 on error
+ */
+int inode_free(struct unix_filesystem *u, uint16_t inr);
+
+/**
+ * @brief read a sector of the inode table, as it is in memory if it was written since the mount
+ * @param u the filesystem (IN)
+ * @param i the index of the sector within the inode table
+ * @param inode_tab INODES_PER_SECTOR inodes (OUT)
+ * @return 0 on success; <0 on error
+ */
+int inode_read_sector(const struct unix_filesystem *u, uint32_t i, struct inode *inode_tab);
+
+/**
+ * @brief record that a file was read or written now, in its inode in memory:
+ *        the inode reaches the disk with the next change of its sector, after
+ *        WRITEBACK_LAZY_AGE seconds or at umount (see writeback_touch).
+ *        As with relatime, a read only changes i_atime if the file was written
+ *        since it was last read, or if i_atime is INODE_RELATIME seconds old.
+ *        A read-only filesystem (s_ronly) is left unchanged.
+ * @param u the filesystem (IN)
+ * @param inr the inode number
+ * @param inode the content of the inode, whose dates are changed (IN/OUT)
+ * @param what INODE_ATIME, INODE_MTIME or both
+ * @return 1 if the inode changed; 0 if not; <0 on error
+ */
+int inode_touch(struct unix_filesystem *u, uint16_t inr, struct inode *inode, int what);
+
+/**
+ * @brief set the dates of an inode to given ones, as utimensat does: unlike with
+ *        inode_touch or inode_write, an earlier date replaces a later one
+ * @param u the filesystem (IN)
+ * @param inr the inode number
+ * @param inode the content of the inode, whose dates are changed (IN/OUT)
+ * @param what INODE_ATIME, INODE_MTIME or both
+ * @param atime the new i_atime, in seconds since 1970 (if what has INODE_ATIME)
+ * @param mtime the new i_mtime, in seconds since 1970 (if what has INODE_MTIME)
+ * @return 0 on success; <0 on error
+ */
+int inode_settimes(struct unix_filesystem *u, uint16_t inr, struct inode *inode, int what, uint32_t atime, uint32_t mtime);
+
 /**
  * @brief write the content of an inode to disk
  * @param u the filesystem (IN)
@@ -0,0 +1,225 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "journal.h"
+#include "mount.h"
+#include "sector.h"
+#include "error.h"
+
+#define JOURNAL_MAGIC 0x4a563655u  /* "U6VJ" */
+#define JOURNAL_MAX_RECORDS ((SECTOR_SIZE - 3 * sizeof(uint32_t) - sizeof(uint16_t)) / sizeof(uint16_t))
+
+/*
+ * first sector of a transaction, followed by the n sectors it writes
+ */
+struct journal_header {
+	uint32_t magic;                          // JOURNAL_MAGIC, 0 in an empty half
+	uint32_t seq;                            // number of the transaction, the last one is replayed
+	uint32_t checksum;                       // of seq, n, sectors and the content of the sectors
+	uint16_t n;                              // number of sectors written by the transaction
+	uint16_t sectors[JOURNAL_MAX_RECORDS];   // where each of them goes
+};
+
+struct journal {
+	FILE *f;                     // open file of the virtual disk
+	uint32_t start;              // first sector of the journal
+	uint32_t half;               // sectors in each half: a header and at most half - 1 sectors
+	uint32_t seq;                // number of the last transaction written
+	uint8_t *buf;                // a transaction, as it is written
+};
+
+/**
+ * @brief size of each half of a journal
+ * @param size the size of the journal, in sectors
+ * @return the number of sectors of a half: a header and the sectors it can list
+ */
+static uint32_t journal_half(uint16_t size){
+	uint32_t half = size / 2u;
+	return half - 1 > JOURNAL_MAX_RECORDS ? JOURNAL_MAX_RECORDS + 1 : half;
+}
+
+/**
+ * @brief checksum of a transaction (FNV-1a), so that a torn one is never replayed
+ * @param h its header
+ * @param data the content of its sectors
+ * @return the checksum
+ */
+static uint32_t journal_checksum(const struct journal_header *h, const uint8_t *data){
+	uint32_t c = 2166136261u;
+	const uint8_t *p[3] = {(const uint8_t *)&h->seq, (const uint8_t *)h->sectors, data};
+	size_t len[3] = {sizeof(h->seq), h->n * sizeof(uint16_t), (size_t)h->n * SECTOR_SIZE};
+	for(int k = 0; k < 3; ++k){
+		for(size_t i = 0; i < len[k]; ++i){
+			c = (c ^ p[k][i]) * 16777619u;
+		}
+	}
+	return c ^ h->n;
+}
+
+/**
+ * @brief read the transaction stored in a half of the journal into j->buf
+ * @param j the journal
+ * @param half 0 or 1
+ * @return 1 if it is complete; 0 if the half is empty or torn; <0 on error
+ */
+static int journal_load(struct journal *j, uint32_t half){
+	struct journal_header *h = (struct journal_header *)j->buf;
+	uint32_t first = j->start + half * j->half;
+	int err = sector_read(j->f, first, h);
+	if(err < 0) return err;
+	if(h->magic != JOURNAL_MAGIC || h->n == 0 || h->n >= j->half) return 0;
+
+	for(uint32_t i = 1; i <= h->n; ++i){
+		err = sector_read(j->f, first + i, j->buf + i * SECTOR_SIZE);
+		if(err < 0) return 0;//a transaction cut by the end of the disk is torn
+	}
+	return journal_checksum(h, j->buf + SECTOR_SIZE) == h->checksum;
+}
+
+/**
+ * @brief write the empty journal of a new filesystem
+ * @param f open file of the virtual disk
+ * @param s the superblock of the filesystem (its journal may be empty)
+ * @return 0 on success; <0 on error
+ */
+int journal_format(FILE *f, const struct superblock *s){
+	M_REQUIRE_NON_NULL(f);
+	M_REQUIRE_NON_NULL(s);
+	if(s->s_journal_size == 0) return 0;
+
+	uint8_t empty[SECTOR_SIZE];
+	memset(empty, 0, sizeof(empty));
+	int err = sector_write(f, s->s_journal_start, empty);
+	if(err == 0) err = sector_write(f, s->s_journal_start + journal_half(s->s_journal_size), empty);
+	return err;
+}
+
+/**
+ * @brief open the journal of a filesystem, and replay its last complete transaction
+ * @param u the filesystem, whose superblock is read; u->journal is set
+ *        (NULL if the filesystem has no journal)
+ * @return 0 on success; <0 on error
+ */
+int journal_open(struct unix_filesystem *u){
+	M_REQUIRE_NON_NULL(u);
+	u->journal = NULL;
+	//older filesystems have no journal: their superblock is padded with zeros
+	if(u->s.s_journal_size == 0) return 0;
+	if(u->s.s_journal_size < 4 || u->s.s_journal_start < u->s.s_inode_start + u->s.s_isize
+	   || u->s.s_journal_start + u->s.s_journal_size > u->s.s_block_start) return ERR_BAD_PARAMETER;
+
+	struct journal *j = calloc(1, sizeof(struct journal));
+	if(j == NULL) return ERR_NOMEM;
+	j->f = u->f;
+	j->start = u->s.s_journal_start;
+	j->half = journal_half(u->s.s_journal_size);
+	j->buf = malloc((size_t)j->half * SECTOR_SIZE);
+	if(j->buf == NULL){
+		free(j);
+		return ERR_NOMEM;
+	}
+
+	//find the last complete transaction: the other half is older, or torn
+	int last = -1;
+	for(uint32_t half = 0; half < 2; ++half){
+		int err = journal_load(j, half);
+		if(err < 0){
+			journal_free(j);
+			return err;
+		}
+		uint32_t seq = ((struct journal_header *)j->buf)->seq;
+		if(err > 0 && (last < 0 || seq > j->seq)){
+			last = (int)half;
+			j->seq = seq;
+		}
+	}
+
+	//its sectors may not all have been written in place before the crash
+	int err = 0;
+	if(last >= 0 && journal_load(j, (uint32_t)last) > 0){
+		const struct journal_header *h = (const struct journal_header *)j->buf;
+		for(uint16_t i = 0; i < h->n && err == 0; ++i){
+			uint16_t sector = h->sectors[i];
+			if(sector < u->s.s_inode_start || sector >= u->s.s_fsize
+			   || (sector >= j->start && sector < j->start + 2 * j->half)) continue;
+			err = sector_write(u->f, sector, j->buf + (i + 1) * SECTOR_SIZE);
+		}
+		if(err == 0 && fsync(fileno(u->f)) != 0) err = ERR_IO;
+	}
+	if(err < 0){
+		journal_free(j);
+		return err;
+	}
+	u->journal = j;
+	return 0;
+}
+
+/**
+ * @brief number of sectors a transaction can hold: a batch must not be larger
+ * @param j the journal
+ * @return the number of sectors (0 if j is NULL)
+ */
+size_t journal_capacity(const struct journal *j){
+	return j == NULL ? 0 : j->half - 1;
+}
+
+/**
+ * @brief write a batch of metadata sectors in the journal, as one transaction, and wait until it is on the disk
+ * @param j the journal
+ * @param n the number of sectors, at most journal_capacity(j)
+ * @param sectors where each sector goes
+ * @param data the content of the sectors, SECTOR_SIZE bytes each, one after the other
+ * @return 0 on success; <0 on error
+ */
+int journal_commit(struct journal *j, size_t n, const uint16_t *sectors, const uint8_t *data){
+	M_REQUIRE_NON_NULL(j);
+	if(n == 0) return 0;
+	M_REQUIRE_NON_NULL(sectors);
+	M_REQUIRE_NON_NULL(data);
+	//only the last transaction is replayed: a batch split in two would not be atomic
+	if(n > journal_capacity(j)) return ERR_BAD_PARAMETER;
+
+	struct journal_header *h = (struct journal_header *)j->buf;
+	memset(h, 0, SECTOR_SIZE);
+	h->magic = JOURNAL_MAGIC;
+	h->seq = j->seq + 1;
+	h->n = (uint16_t)n;
+	memcpy(h->sectors, sectors, n * sizeof(uint16_t));
+	memcpy(j->buf + SECTOR_SIZE, data, n * SECTOR_SIZE);
+	h->checksum = journal_checksum(h, j->buf + SECTOR_SIZE);
+
+	//the transactions alternate between the halves: the last complete one stays intact
+	size_t len = (n + 1) * SECTOR_SIZE;
+	off_t pos = (off_t)SECTOR_SIZE * (j->start + (h->seq % 2) * j->half);
+	if(pwrite(fileno(j->f), j->buf, len, pos) != (ssize_t)len) return ERR_IO;
+	if(fsync(fileno(j->f)) != 0) return ERR_IO;
+	++j->seq;
+	return 0;
+}
+
+/**
+ * @brief mark the journal empty, once all its transactions are written in place
+ * @param j the journal (may be NULL)
+ * @return 0 on success; <0 on error
+ */
+int journal_clean(struct journal *j){
+	if(j == NULL) return 0;
+	//the sectors written in place must be on the disk before their transactions are dropped
+	if(fsync(fileno(j->f)) != 0) return ERR_IO;
+	//both halves: an older transaction must not be replayed after a newer one was dropped
+	memset(j->buf, 0, SECTOR_SIZE);
+	int err = sector_write(j->f, j->start, j->buf);
+	if(err == 0) err = sector_write(j->f, j->start + j->half, j->buf);
+	if(err == 0 && fsync(fileno(j->f)) != 0) err = ERR_IO;
+	return err;
+}
+
+/**
+ * @brief free the journal (the disk is left as it is)
+ * @param j the journal (may be NULL)
+ */
+void journal_free(struct journal *j){
+	if(j == NULL) return;
+	free(j->buf);
+	free(j);
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+/**
+ * @file journal.h
+ * @brief write-ahead journal of the metadata
+ *
+ * The sectors of the inode table, of the directories and the indirection
+ * sectors are not written in place as they change: they wait in memory (see
+ * writeback.h) and are written by batches. Each batch is first written in
+ * the journal, a region of the disk set up by mountv6_mkfs between the inode
+ * table and the data, as one transaction: a header listing the sectors,
+ * followed by their new content, in a single sequential write and a single
+ * fsync. Only then are the sectors written in place. The journal has two
+ * halves used in turn, so that a transaction being written never overwrites
+ * the last complete one; a checksum tells a complete transaction from a torn
+ * one. On mount, the last complete transaction is written in place again
+ * (the writes are idempotent), which brings the metadata back to a state
+ * between two batches; the bitmaps are then rebuilt from it as before.
+ *
+ * The data of the files is still written in place at once, before the batch
+ * which refers to it; the sectors freed by a batch are only released once it
+ * is in the journal, so that they cannot be reused by a file before.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stddef.h>
+#include "unixv6fs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define JOURNAL_SECTORS 500        /* size of the journal set up by mountv6_mkfs: two halves of 250 */
+#define JOURNAL_MIN_DATA 1000      /* data sectors a disk must have besides the journal for mountv6_mkfs to set one up */
+
+struct unix_filesystem;
+struct journal;
+
+/**
+ * @brief write the empty journal of a new filesystem
+ * @param f open file of the virtual disk
+ * @param s the superblock of the filesystem (its journal may be empty)
+ * @return 0 on success; <0 on error
+ */
+int journal_format(FILE *f, const struct superblock *s);
+
+/**
+ * @brief open the journal of a filesystem, and replay its last complete transaction
+ * @param u the filesystem, whose superblock is read; u->journal is set
+ *        (NULL if the filesystem has no journal)
+ * @return 0 on success; <0 on error
+ */
+int journal_open(struct unix_filesystem *u);
+
+/**
+ * @brief number of sectors a transaction can hold: a batch must not be larger
+ * @param j the journal
+ * @return the number of sectors (0 if j is NULL)
+ */
+size_t journal_capacity(const struct journal *j);
+
+/**
+ * @brief write a batch of metadata sectors in the journal, as one transaction, and wait until it is on the disk
+ * @param j the journal
+ * @param n the number of sectors, at most journal_capacity(j)
+ * @param sectors where each sector goes
+ * @param data the content of the sectors, SECTOR_SIZE bytes each, one after the other
+ * @return 0 on success; <0 on error
+ */
+int journal_commit(struct journal *j, size_t n, const uint16_t *sectors, const uint8_t *data);
+
+/**
+ * @brief mark the journal empty, once all its transactions are written in place
+ * @param j the journal (may be NULL)
+ * @return 0 on success; <0 on error
+ */
+int journal_clean(struct journal *j);
+
+/**
+ * @brief free the journal (the disk is left as it is)
+ * @param j the journal (may be NULL)
+ */
+void journal_free(struct journal *j);
+
+#ifdef __cplusplus
+}
+#endif
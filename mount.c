@@ -1,11 +1,20 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include <inttypes.h>
 #include "mount.h"
 #include "error.h"
 #include "sector.h"
 #include "bmblock.h"
 #include "inode.h"
+#include "dcache.h"
+#include "dirindex.h"
+#include "fslock.h"
+#include "reclaim.h"
+#include "writeback.h"
+#include "journal.h"
 
 void fill_ibm(struct unix_filesystem *u);
 void fill_fbm(struct unix_filesystem *u);
@@ -44,8 +53,19 @@ int mountv6(const char *filename, struct unix_filesystem *u){
 	//Write the superblock
 	memcpy(&u->s, buffer, SECTOR_SIZE);
 	
+	//the last batch of metadata written before a crash is completed before anything is read
+	int err = journal_open(u);
+	if(err < 0) return err;
+	
 	u->fbm = bm_alloc(u->s.s_block_start + 1, u->s.s_fsize - 1);
 	u->ibm = bm_alloc(u->s.s_inode_start, u->s.s_isize * INODES_PER_SECTOR - 1);
+	u->dcache = dcache_alloc();
+	u->dindex = dirindex_alloc();
+	u->locks = fslock_alloc((uint32_t)u->s.s_isize * INODES_PER_SECTOR);
+	u->reclaim = reclaim_alloc();
+	u->writeback = writeback_alloc(u);
+	if(u->fbm == NULL || u->ibm == NULL || u->dcache == NULL || u->dindex == NULL || u->locks == NULL || u->reclaim == NULL
+	   || u->writeback == NULL) return ERR_NOMEM;
 	fill_ibm(u);
 	fill_fbm(u);
 	
@@ -87,23 +107,24 @@ void fill_fbm(struct unix_filesystem *u){
 			int err = sector_read(u->f, u->s.s_inode_start+i, inode_tab);
 			if(err == 0){
 				for(unsigned int j = 0; j < INODES_PER_SECTOR; ++j){
-					offset = 0;
 					inode_size = inode_getsize(&inode_tab[j]);
 					
-					while((sector = inode_findsector(u, &inode_tab[j], offset)) > 0){
+					//holes (sector 0) have no sector to mark, the sectors after them do
+					for(offset = 0; offset * SECTOR_SIZE < inode_size; ++offset){
+						sector = inode_findsector(u, &inode_tab[j], offset);
+						if(sector < 0) break;
 						
 						//If size is too big, then it uses indirect sectors
 						if(inode_size > ADDR_SMALL_LENGTH * SECTOR_SIZE){
 							addr = offset / ADDRESSES_PER_SECTOR;
 							
 							//Handle indirect sectors
-							if(addr >= 0 && addr < ADDR_SMALL_LENGTH)
+							if(addr >= 0 && addr < ADDR_SMALL_LENGTH && inode_tab[j].i_addr[addr] != 0)
 								bm_set(u->fbm, inode_tab[j].i_addr[addr]);
 
 						}
 						
-						bm_set(u->fbm, sector);
-						++offset;
+						if(sector > 0) bm_set(u->fbm, sector);
 					}
 				}
 			}
@@ -143,13 +164,23 @@ void mountv6_print_superblock(const struct unix_filesystem *u){
  */
 int umountv6(struct unix_filesystem *u){
 	M_REQUIRE_NON_NULL(u);
+	//the metadata changed in memory reaches the disk first; then nothing is left to replay
+	int err = writeback_sync(u);
+	if(err == 0) err = journal_clean(u->journal);
+	writeback_free(u->writeback);
+	journal_free(u->journal);
+	//the sectors still to release need the bitmap and the locks
+	reclaim_free(u->reclaim);
 	bm_free(u->ibm);
 	bm_free(u->fbm);
+	dcache_free(u->dcache);
+	dirindex_free(u->dindex);
+	fslock_free(u->locks);
 	if(fclose(u->f) != 0){
 		debug_print("Cannot unmount the file system\n");
 		return ERR_IO;
 	}
-	return 0;
+	return err;
 }
 
 /**
@@ -158,6 +189,18 @@ int umountv6(struct unix_filesystem *u){
  * @param num_inodes the total number of inodes
  */
 int mountv6_mkfs(const char *filename, uint16_t num_blocks, uint16_t num_inodes){
+	return mountv6_mkfs_opts(filename, num_blocks, num_inodes, 0);
+}
+
+/**
+ * @brief create a new filesystem, with options
+ * @param filename the image file, created or overwritten
+ * @param num_blocks the total number of blocks (= max size of disk), in sectors
+ * @param num_inodes the total number of inodes
+ * @param flags 0 or MKFS_LAZY_ITABLE
+ * @return 0 on success; <0 on error
+ */
+int mountv6_mkfs_opts(const char *filename, uint16_t num_blocks, uint16_t num_inodes, int flags){
 	M_REQUIRE_NON_NULL(filename);
 	
 	//Creation of the superblock
@@ -175,51 +218,44 @@ int mountv6_mkfs(const char *filename, uint16_t num_blocks, uint16_t num_inodes)
 		return ERR_NOT_ENOUGH_BLOCS;
 		
 	s.s_inode_start = SUPERBLOCK_SECTOR + 1;
-	s.s_block_start = s.s_inode_start + s.s_isize;
-	
-	//Create the new file
-	FILE* file = fopen(filename, "wb");
-	if(file == NULL) return ERR_IO;
-	
-	//Create and write the bootblock sector
-	uint8_t bootblock[SECTOR_SIZE];
-	memset(bootblock, 0, SECTOR_SIZE);
-	bootblock[BOOTBLOCK_MAGIC_NUM_OFFSET] = BOOTBLOCK_MAGIC_NUM;
-	int err = sector_write(file, BOOTBLOCK_SECTOR, bootblock);
-	if(err < 0){
-		fclose(file);
-		return err;
-	}
+	//the journal lies between the inodes and the data, on disks large enough not to miss its room
+	s.s_journal_start = s.s_inode_start + s.s_isize;
+	if(num_blocks >= s.s_journal_start + JOURNAL_SECTORS + JOURNAL_MIN_DATA) s.s_journal_size = JOURNAL_SECTORS;
+	s.s_block_start = s.s_journal_start + s.s_journal_size;
 	
-	//Write the superblock
-	err = sector_write(file, SUPERBLOCK_SECTOR, &s);
-	if(err < 0){
-		fclose(file);
-		return err;
-	}
+	//the bootblock, the superblock and the inode table are built in memory and written at once;
+	//with a lazy inode table, only its first sector (the root) is: the others read as zeros
+	uint32_t nsectors = flags & MKFS_LAZY_ITABLE ? s.s_inode_start + 1 : s.s_journal_start;
+	uint8_t *head = calloc(nsectors, SECTOR_SIZE);
+	if(head == NULL) return ERR_NOMEM;
 	
-	struct inode inode_tab[INODES_PER_SECTOR];
-	memset(inode_tab, 0, SECTOR_SIZE);
+	head[BOOTBLOCK_SECTOR * SECTOR_SIZE + BOOTBLOCK_MAGIC_NUM_OFFSET] = BOOTBLOCK_MAGIC_NUM;
+	memcpy(head + SUPERBLOCK_SECTOR * SECTOR_SIZE, &s, SECTOR_SIZE);
 	
-	//Create and write root inode
-	struct inode root;
-	memset(&root, 0, sizeof(struct inode));
-	root.i_mode = IFDIR | IALLOC;
-	inode_tab[ROOT_INUMBER] = root;
-	err = sector_write(file, s.s_inode_start, inode_tab);
+	//the root inode
+	struct inode *inode_tab = (struct inode *)(head + s.s_inode_start * SECTOR_SIZE);
+	inode_tab[ROOT_INUMBER].i_mode = IFDIR | IALLOC;
+	uint32_t now = (uint32_t)time(NULL);
+	inode_settime(inode_tab[ROOT_INUMBER].i_atime, now);
+	inode_settime(inode_tab[ROOT_INUMBER].i_mtime, now);
 	
-	//Reset memory to have empty inodes
-	memset(inode_tab, 0, SECTOR_SIZE);
+	//Create the new file
+	FILE* file = fopen(filename, "wb");
+	if(file == NULL){
+		free(head);
+		return ERR_IO;
+	}
 	
-	for(int i = s.s_inode_start + 1; i < s.s_block_start; ++i){
-		err = sector_write(file, i, inode_tab);
-		if(err < 0){
-			fclose(file);
-			return err;
-		}
-	}	
+	//the image has its full size at once, without writing the data sectors: they stay sparse
+	int err = 0;
+	size_t len = (size_t)nsectors * SECTOR_SIZE;
+	if(ftruncate(fileno(file), (off_t)s.s_fsize * SECTOR_SIZE) != 0
+	   || pwrite(fileno(file), head, len, 0) != (ssize_t)len) err = ERR_IO;
+	free(head);
 	
-	if(fclose(file) != 0) return ERR_IO;
+	//an empty journal is all zeros as well
+	if(err == 0 && !(flags & MKFS_LAZY_ITABLE)) err = journal_format(file, &s);
 	
-	return 0;
+	if(fclose(file) != 0 && err == 0) err = ERR_IO;
+	return err;
 }
@@ -11,6 +11,9 @@
 #include <stdio.h>
 #include "unixv6fs.h"
 #include "bmblock.h"
+#include "dcache.h"
+#include "dirindex.h"
+#include "fslock.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -21,6 +24,12 @@ struct unix_filesystem {
     struct superblock s;           /* copy of the superblock */
     struct bmblock_array *fbm;     /* block bitmmap -- ignore before WEEK 10 */
     struct bmblock_array *ibm;     /* inode bitmap  -- ignore before WEEK 10 */
+    struct dcache *dcache;         /* cache of directory entries */
+    struct dirindex_table *dindex; /* hashed indexes of large directories */
+    struct fslock *locks;          /* locks for concurrent users, see fslock.h */
+    struct reclaim *reclaim;       /* release of freed sectors, see reclaim.h */
+    struct writeback *writeback;   /* delayed writes of the metadata, see writeback.h */
+    struct journal *journal;       /* write-ahead journal of the metadata (NULL: none), see journal.h */
 };
 
 /**
@@ -54,6 +63,19 @@ int umountv6(struct unix_filesystem *u);
  */
 int mountv6_mkfs(const char *filename, uint16_t num_blocks, uint16_t num_inodes);
 
+/* Options of mountv6_mkfs_opts */
+#define MKFS_LAZY_ITABLE 0x1 /* the inode table is not written: the new image is sparse, and reads as zeros */
+
+/**
+ * @brief create a new filesystem, with options
+ * @param filename the image file, created or overwritten
+ * @param num_blocks the total number of blocks (= max size of disk), in sectors
+ * @param num_inodes the total number of inodes
+ * @param flags 0 or MKFS_LAZY_ITABLE
+ * @return 0 on success; <0 on error
+ */
+int mountv6_mkfs_opts(const char *filename, uint16_t num_blocks, uint16_t num_inodes, int flags);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,150 @@
+#include <stdlib.h>
+#include <pthread.h>
+#include "reclaim.h"
+#include "mount.h"
+#include "bmblock.h"
+#include "fslock.h"
+#include "error.h"
+
+struct reclaim_list {
+	uint16_t *sectors;           // the sectors to release
+	size_t n;                    // number of sectors
+	struct reclaim_list *next;   // next list in the queue
+};
+
+struct reclaim {
+	pthread_mutex_t lock;        // protects all the fields below
+	pthread_cond_t work;         // signaled when a list is queued or the thread must stop
+	pthread_cond_t idle;         // signaled when the queue becomes empty
+	struct reclaim_list *head;   // first list to release
+	struct reclaim_list *tail;   // last list to release
+	int busy;                    // 1 while the thread releases a list out of the queue
+	int started;                 // 1 once the thread runs
+	int stop;                    // 1 when the thread must stop
+	pthread_t thread;            // the thread
+	struct unix_filesystem *u;   // the filesystem, known from the first list
+};
+
+/**
+ * @brief release a list of sectors in the block bitmap
+ * @param u the filesystem
+ * @param sectors the sectors (freed)
+ * @param n the number of sectors
+ */
+static void reclaim_release(struct unix_filesystem *u, uint16_t *sectors, size_t n){
+	fslock_bitmaps(u);
+	bm_clear_many(u->fbm, sectors, n);
+	fslock_bitmaps_unlock(u);
+	free(sectors);
+}
+
+/**
+ * @brief body of the thread: release the queued lists in order
+ * @param arg the reclaimer
+ * @return NULL
+ */
+static void *reclaim_run(void *arg){
+	struct reclaim *r = arg;
+	pthread_mutex_lock(&r->lock);
+	for(;;){
+		while(r->head == NULL && !r->stop) pthread_cond_wait(&r->work, &r->lock);
+		if(r->head == NULL) break;
+		
+		struct reclaim_list *l = r->head;
+		r->head = l->next;
+		if(r->head == NULL) r->tail = NULL;
+		r->busy = 1;
+		pthread_mutex_unlock(&r->lock);
+		
+		reclaim_release(r->u, l->sectors, l->n);
+		free(l);
+		
+		pthread_mutex_lock(&r->lock);
+		r->busy = 0;
+		if(r->head == NULL) pthread_cond_broadcast(&r->idle);
+	}
+	pthread_mutex_unlock(&r->lock);
+	return NULL;
+}
+
+/**
+ * @brief allocate the reclaimer of a filesystem (its thread starts on first use)
+ * @return the reclaimer or NULL on failure
+ */
+struct reclaim *reclaim_alloc(void){
+	struct reclaim *r = calloc(1, sizeof(struct reclaim));
+	if(r == NULL) return NULL;
+	pthread_mutex_init(&r->lock, NULL);
+	pthread_cond_init(&r->work, NULL);
+	pthread_cond_init(&r->idle, NULL);
+	return r;
+}
+
+/**
+ * @brief release the pending lists, stop the thread and free the reclaimer
+ * @param r the reclaimer (may be NULL)
+ */
+void reclaim_free(struct reclaim *r){
+	if(r == NULL) return;
+	pthread_mutex_lock(&r->lock);
+	r->stop = 1;
+	pthread_cond_signal(&r->work);
+	pthread_mutex_unlock(&r->lock);
+	//the thread empties the queue before it stops
+	if(r->started) pthread_join(r->thread, NULL);
+	
+	pthread_mutex_destroy(&r->lock);
+	pthread_cond_destroy(&r->work);
+	pthread_cond_destroy(&r->idle);
+	free(r);
+}
+
+/**
+ * @brief release a list of sectors, now or in the background
+ * @param u the filesystem
+ * @param sectors the sectors, allocated with malloc; freed by the reclaimer
+ * @param n the number of sectors (0 are ignored)
+ * @return 0 on success; <0 on error
+ */
+int reclaim_sectors(struct unix_filesystem *u, uint16_t *sectors, size_t n){
+	M_REQUIRE_NON_NULL(u);
+	struct reclaim *r = u->reclaim;
+	struct reclaim_list *l = NULL;
+	if(r != NULL && n > RECLAIM_THRESHOLD) l = malloc(sizeof(struct reclaim_list));
+	
+	//short lists (and any list if the thread cannot be used) are released at once
+	if(l != NULL){
+		pthread_mutex_lock(&r->lock);
+		if(!r->started && !r->stop){
+			r->u = u;
+			r->started = pthread_create(&r->thread, NULL, reclaim_run, r) == 0;
+		}
+		if(r->started && !r->stop){
+			l->sectors = sectors;
+			l->n = n;
+			l->next = NULL;
+			if(r->tail != NULL) r->tail->next = l;
+			else r->head = l;
+			r->tail = l;
+			pthread_cond_signal(&r->work);
+			sectors = NULL;
+		}
+		pthread_mutex_unlock(&r->lock);
+		if(sectors == NULL) return 0;
+		free(l);
+	}
+	reclaim_release(u, sectors, n);
+	return 0;
+}
+
+/**
+ * @brief wait until all the lists given so far are released
+ * @param u the filesystem
+ */
+void reclaim_wait(struct unix_filesystem *u){
+	if(u == NULL || u->reclaim == NULL) return;
+	struct reclaim *r = u->reclaim;
+	pthread_mutex_lock(&r->lock);
+	while(r->head != NULL || r->busy) pthread_cond_wait(&r->idle, &r->lock);
+	pthread_mutex_unlock(&r->lock);
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+/**
+ * @file reclaim.h
+ * @brief release of the sectors of deleted (or shrunk) files to the block bitmap
+ *
+ * The sectors freed by one operation are gathered in a list and cleared in
+ * the bitmap a vector at a time (see bm_clear_many). Short lists are released
+ * at once; longer ones are handed to a background thread, started on first
+ * use, so that deleting a large file returns immediately. Until its list is
+ * released, a sector stays marked as used and cannot be reused too early.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "unixv6fs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RECLAIM_THRESHOLD ADDRESSES_PER_SECTOR /* longer lists are released in the background */
+
+struct unix_filesystem;
+struct reclaim;
+
+/**
+ * @brief allocate the reclaimer of a filesystem (its thread starts on first use)
+ * @return the reclaimer or NULL on failure
+ */
+struct reclaim *reclaim_alloc(void);
+
+/**
+ * @brief release the pending lists, stop the thread and free the reclaimer
+ * @param r the reclaimer (may be NULL)
+ */
+void reclaim_free(struct reclaim *r);
+
+/**
+ * @brief release a list of sectors, now or in the background
+ * @param u the filesystem
+ * @param sectors the sectors, allocated with malloc; freed by the reclaimer
+ * @param n the number of sectors (0 are ignored)
+ * @return 0 on success; <0 on error
+ */
+int reclaim_sectors(struct unix_filesystem *u, uint16_t *sectors, size_t n);
+
+/**
+ * @brief wait until all the lists given so far are released
+ * @param u the filesystem
+ */
+void reclaim_wait(struct unix_filesystem *u);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <unistd.h>
 #include "error.h"
 #include "unixv6fs.h"
 
@@ -14,16 +15,10 @@ int sector_read(FILE *f, uint32_t sector, void *data){
 	M_REQUIRE_NON_NULL(f);
 	M_REQUIRE_NON_NULL(data);
 	
-	//Place the cursor on the right position in the sector
-	int err = fseek(f, SECTOR_SIZE*sector, SEEK_SET);
-	if(err != 0){
-		debug_print("Erreur: impossible de se mettre au bon endroit\n");
-		return ERR_IO;
-	}
-	
-	//If no error, read the 512 bytes of the sector
-	int read_bytes = fread(data, SECTOR_SIZE, 1, f);
-	if(read_bytes == 1){
+	//Read at the position of the sector, without moving the cursor of the file:
+	//several threads can read concurrently
+	ssize_t read_bytes = pread(fileno(f), data, SECTOR_SIZE, (off_t)SECTOR_SIZE * sector);
+	if(read_bytes == SECTOR_SIZE){
 		return 0;
 	}else{
 		debug_print("Erreur: impossible de lire le secteur\n");
@@ -43,15 +38,9 @@ int sector_write(FILE *f, uint32_t sector, void  *data){
 	M_REQUIRE_NON_NULL(f);
 	M_REQUIRE_NON_NULL(data);
 
-	//Place the cursor on the right position in the sector	
-	int err = fseek(f, SECTOR_SIZE * sector, SEEK_SET);
-	if(err != 0){
-		debug_print("Erreur: impossible de se mettre au bon endroit\n");
-		return ERR_IO;
-	}
-	
-	int written_bytes = fwrite(data, SECTOR_SIZE, 1, f);
-	if(written_bytes == 1){
+	//Write at the position of the sector, without moving the cursor of the file
+	ssize_t written_bytes = pwrite(fileno(f), data, SECTOR_SIZE, (off_t)SECTOR_SIZE * sector);
+	if(written_bytes == SECTOR_SIZE){
 		return 0;
 	}else{
 		debug_print("Erreur: impossible d'écrire dans le secteur\n");
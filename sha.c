@@ -58,7 +58,7 @@ void print_sha_inode(struct unix_filesystem *u, struct inode inode, int inr){
 		if(inode.i_mode & IFDIR){
 			printf("no SHA for directories\n");
 		}else{
-			struct filev6 fv6 = {u, (uint16_t)inr, inode, 0};//since inode already here, no need to filev6_open
+			struct filev6 fv6 = {u, (uint16_t)inr, inode, 0, NULL, NULL, 0};//since inode already here, no need to filev6_open
 			int size = inode_getsize(&inode);
 			
 			char p[size+1];//char tab to be filled with inode's data 
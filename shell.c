@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <inttypes.h>
 #include "unixv6fs.h"
 #include "direntv6.h"
 #include "filev6.h"
@@ -6,8 +7,12 @@
 #include "error.h"
 #include "inode.h"
 #include "sha.h"
+#include "treewalk.h"
+#include "bmblock.h"
+#include "reclaim.h"
+#include "writeback.h"
 
-#define CMD_NUMBER 13
+#define CMD_NUMBER 19
 #define CMD_MAX_CHARS 255
 
 typedef int (*shell_fct)(const char** args);
@@ -32,6 +37,13 @@ int do_istat(const char** args);
 int do_mkfs(const char** args);
 int do_mkdir(const char** args);
 int do_add(const char** args);
+int do_rm(const char** args);
+int do_rmdir(const char** args);
+int do_truncate(const char** args);
+int do_add_reserved(const char** args);
+int do_sync(const char** args);
+int do_mkfs_lazy(const char** args);
+static int shell_add(const char* src, const char* dst, int reserve);
 
 //the array with all commands
 struct shell_map shell_cmds[CMD_NUMBER] = {
@@ -39,6 +51,7 @@ struct shell_map shell_cmds[CMD_NUMBER] = {
 	{"exit", do_exit, "exit shell", 0, ""},
 	{"quit", do_exit, "exit shell", 0,  ""},
 	{"mkfs", do_mkfs, "create a new filesystem", 3, "<diskname> <#inodes> <blocks>"},
+	{"mkfs", do_mkfs_lazy, "create a new filesystem, without writing its empty inode table", 4, "--lazy-itable <diskname> <#inodes> <blocks>"},
 	{"mount", do_mount, "mount the provided filesystem", 1, "<diskname>"},
 	{"mkdir", do_mkdir, "create a new directory", 1, "<dirname>"},
 	{"lsall", do_lsall, "list all directories and files contained in the currently mounted filesystem", 0, ""},
@@ -47,7 +60,12 @@ struct shell_map shell_cmds[CMD_NUMBER] = {
 	{"istat", do_istat, "display information about the provided inode", 1, "<inode_nr>"},
 	{"inode", do_inode, "display the inode number of a file", 1, "<pathname>"},
 	{"sha", do_sha, "display the SHA of a file", 1, "<pathname>"},
-	{"psb", do_psb, "Print SuperBlock of the currently mounted filesystem", 0, ""}
+	{"psb", do_psb, "Print SuperBlock of the currently mounted filesystem", 0, ""},
+	{"rm", do_rm, "remove a file", 1, "<pathname>"},
+	{"rmdir", do_rmdir, "remove an empty directory", 1, "<dirname>"},
+	{"truncate", do_truncate, "change the size of a file", 2, "<pathname> <size>"},
+	{"add", do_add_reserved, "add a new file, on sectors reserved beforehand", 3, "-p <src-fullpath> <dst>"},
+	{"sync", do_sync, "write the metadata changed in memory to the disk", 0, ""}
 };
 
 //Global variable, to hold the current unix filesystem
@@ -90,11 +108,12 @@ int do_mount(const char** args){
 
 /**
  * @brief execute the "lsall" function of the shell, basically print the content of a unix filesystem
+ *        (the tree is read by several threads, then printed in the order of direntv6_print_tree)
  * @param args not needed for this function
  * @return 0 on success; < 0 otherwise
  */
 int do_lsall(const char** args){
-	return direntv6_print_tree(&u, ROOT_INUMBER, "");
+	return treewalk_print_tree(&u, ROOT_INUMBER, "");
 }
 
 /**
@@ -104,6 +123,13 @@ int do_lsall(const char** args){
  */
 int do_psb(const char** args){
 	mountv6_print_superblock(&u);
+	//the free counts are kept by the bitmaps: no need to scan them, only to
+	//wait for the sectors of deleted files still being released
+	if(u.fbm != NULL && u.ibm != NULL){
+		reclaim_wait(&u);
+		printf("%-19s : %" PRIu64 " / %" PRIu64 "\n", "free blocks", u.fbm->nfree, u.fbm->max - u.fbm->min + 1);
+		printf("%-19s : %" PRIu64 " / %" PRIu64 "\n", "free inodes", u.ibm->nfree, u.ibm->max - u.ibm->min + 1);
+	}
 	return 0;
 }
 
@@ -123,6 +149,9 @@ int do_istat(const char** args){
 	if(err != 0) return err;
 	
 	inode_print(i);
+	//inode_print keeps the output the tests expect: the dates are shown here
+	printf("i_atime: %" PRIu32 "\n", inode_gettime(i->i_atime));
+	printf("i_mtime: %" PRIu32 "\n", inode_gettime(i->i_mtime));
 	return 0;
 }
 
@@ -168,6 +197,8 @@ int do_cat(const char** args){
 		}
 		if (readBytes<0) return readBytes;
 		printf("%s\n", p);
+		err = inode_touch(&u, (uint16_t)inr, &fv6.i_node, INODE_ATIME);
+		if (err < 0) return err;
 	}
 	return 0;
 }
@@ -202,6 +233,19 @@ int do_mkfs(const char** args){
 	return mountv6_mkfs(filename, num_blocks, num_inodes);
 }
 
+/**
+ * @brief execute the "mkfs --lazy-itable" function of the shell: the inode table of the new
+ *        filesystem is left sparse (see MKFS_LAZY_ITABLE)
+ * @param args an array containing "--lazy-itable", the name of the disk, its number of inodes and of blocks
+ * @return 0 on success; <0 on error
+ */
+int do_mkfs_lazy(const char** args){
+	if(strcmp(args[0], "--lazy-itable") != 0) return ERR_BAD_PARAMETER;
+	const uint16_t num_inodes = atoi(args[2]);
+	const uint16_t num_blocks = atoi(args[3]);
+	return mountv6_mkfs_opts(args[1], num_blocks, num_inodes, MKFS_LAZY_ITABLE);
+}
+
 /**
  * @brief create a new directory
  * @param args an array containing the name this new directory with the path to it
@@ -218,9 +262,28 @@ int do_mkdir(const char** args){
  * @return 0 on success; <0 on error
  */
 int do_add(const char** args){
-	const char* src = args[0];
-	const char* dst = args[1];
-	
+	return shell_add(args[0], args[1], 0);
+}
+
+/**
+ * @brief add a new file to the filesystem, reserving all its sectors before writing it
+ *        (so that it lies on consecutive sectors whenever the disk allows it)
+ * @param args an array containing "-p", the path to the source file and the path to the dest file on the filesystem
+ * @return 0 on success; <0 on error
+ */
+int do_add_reserved(const char** args){
+	if(strcmp(args[0], "-p") != 0) return ERR_BAD_PARAMETER;
+	return shell_add(args[1], args[2], 1);
+}
+
+/**
+ * @brief add a new file to the filesystem
+ * @param src the path to the source file
+ * @param dst the path to the dest file on the filesystem
+ * @param reserve 1 to reserve the sectors of the file first (see filev6_fallocate)
+ * @return 0 on success; <0 on error
+ */
+static int shell_add(const char* src, const char* dst, int reserve){
 	int inr = direntv6_create(&u, dst, 0);
 	if (inr < 0) return inr;
 	
@@ -236,7 +299,9 @@ int do_add(const char** args){
 	struct filev6 fv6;
 	int err = filev6_open(&u, (uint16_t)inr, &fv6);
 	if(err < 0) return err;
-	err = filev6_writebytes(&u, &fv6, buffer, sz);
+	if(reserve) err = filev6_fallocate(&u, &fv6, 0, sz);
+	if(err == 0) err = filev6_writebytes(&u, &fv6, buffer, sz);
+	filev6_unreserve(&u, &fv6);
 	if(err < 0) return err;
 	
 	if(fclose(f) != 0) return ERR_IO;
@@ -244,6 +309,52 @@ int do_add(const char** args){
 	return 0;
 }
 
+/**
+ * @brief remove a file from the filesystem
+ * @param args an array containing the path to the file
+ * @return 0 on success; <0 on error
+ */
+int do_rm(const char** args){
+	return direntv6_unlink(&u, args[0], 0);
+}
+
+/**
+ * @brief remove an empty directory from the filesystem
+ * @param args an array containing the path to the directory
+ * @return 0 on success; <0 on error
+ */
+int do_rmdir(const char** args){
+	return direntv6_unlink(&u, args[0], 1);
+}
+
+/**
+ * @brief change the size of a file: it is cut or extended with zeros
+ * @param args an array containing the path to the file and its new size
+ * @return 0 on success; <0 on error
+ */
+int do_truncate(const char** args){
+	int size = atoi(args[1]);
+	if(size < 0) return ERR_BAD_PARAMETER;
+	
+	int inr = direntv6_dirlookup(&u, ROOT_INUMBER, args[0]);
+	if(inr < 0) return inr;
+	
+	struct filev6 fv6;
+	int err = filev6_open(&u, (uint16_t)inr, &fv6);
+	if(err < 0) return err;
+	if((fv6.i_node.i_mode & IFMT) == IFDIR) return ERR_BAD_PARAMETER;
+	return filev6_truncate(&u, &fv6, size);
+}
+
+/**
+ * @brief execute the "sync" function of the shell, basically write the changed metadata to the disk
+ * @param args not needed for this function
+ * @return 0 on success; <0 on error
+ */
+int do_sync(const char** args){
+	return writeback_sync(&u);
+}
+
 /**
  * @brief given a command name, and an array consisting of a command name and arguments, return the corresponding function
  * @param cmd the name of the command to execute
@@ -257,16 +368,19 @@ shell_fct get_func(const char* cmd, const char** args){
 	}
 	--size;//Value of size corresponds to the number of arguments
 	
+	//a command may have several entries, one for each number of arguments it takes
 	int i = 0;
-	while(i < CMD_NUMBER && strcmp(cmd, shell_cmds[i].name) != 0){
+	int known = 0;
+	while(i < CMD_NUMBER && (strcmp(cmd, shell_cmds[i].name) != 0 || shell_cmds[i].argc != size)){
+		if(strcmp(cmd, shell_cmds[i].name) == 0) known = 1;
 		++i;
 	}
 	
-	if(i == CMD_NUMBER){
+	if(i == CMD_NUMBER && !known){
 		printf("ERROR SHELL: invalid command\n");
-	}else if(shell_cmds[i].argc != size){
+	}else if(i == CMD_NUMBER){
 		printf("ERROR SHELL: wrong number of arguments\n");
-	}else if((i > 5 && i < 13) && u.f == NULL){
+	}else if(i > 6 && u.f == NULL){
 		printf("ERROR SHELL: mount the FS before the operation\n");
 	}else{
 		return shell_cmds[i].fct;
@@ -300,7 +414,7 @@ void tokenize_input(char* c, char** args){
 int main(void){
 	char input[CMD_MAX_CHARS];
 	char* cmd_args[CMD_MAX_CHARS*sizeof(char*)];
-	shell_fct fct;
+	shell_fct fct = NULL;
 	int err;
 	
 	while(!feof(stdin) && !ferror(stdin) && fct != do_exit){
@@ -328,5 +442,7 @@ int main(void){
 		//Clean the args array between two commands
 		memset(cmd_args, 0, CMD_MAX_CHARS);
 	}
+	//at the end of the input, the metadata still in memory is written as by "exit"
+	if(fct != do_exit && u.f != NULL) umountv6(&u);
 	return 0;
 }
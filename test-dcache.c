@@ -0,0 +1,23 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include "direntv6.h"
+#include "dcache.h"
+#include "error.h"
+
+#define NB_PATHS 6
+
+int test(struct unix_filesystem *u){
+	const char *paths[NB_PATHS] = {"/", "/src", "/src/mount.c", "/README.md", "/src/Makefile", "/src/missing.c"};
+
+	//Each path is looked up twice: the second pass must be answered by the cache
+	for(int pass = 0; pass < 2; ++pass){
+		printf("pass %d:\n", pass);
+		for(int i = 0; i < NB_PATHS; ++i){
+			int inr = direntv6_dirlookup(u, ROOT_INUMBER, paths[i]);
+			printf("%-15s -> %d\n", paths[i], inr);
+		}
+		printf("dcache hits: %" PRIu64 " (%" PRIu64 " negative), misses: %" PRIu64 "\n",
+		       u->dcache->hits, u->dcache->negative_hits, u->dcache->misses);
+	}
+	return 0;
+}
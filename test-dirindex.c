@@ -0,0 +1,163 @@
+/**
+ * @file test-dirindex.c
+ * @brief main program to test the directory indexes on their own, without a disk
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "dirindex.h"
+#include "error.h"
+
+#define NB_NAMES 1000   /* enough to grow an index from 256 to 2048 buckets */
+
+/**
+ * @brief print a check and its result; count it in the variable failed if it does not hold
+ */
+#define CHECK(cond) \
+    do { \
+        int ok_ = (cond); \
+        printf("%-60s %s\n", #cond, ok_ ? "ok" : "FAILED"); \
+        failed += !ok_; \
+    } while(0)
+
+/**
+ * @brief write the name of entry i
+ */
+static size_t make_name(char *name, int i){
+	return (size_t)sprintf(name, "entry%d", i);
+}
+
+/**
+ * @brief compute the bucket where the search of a name starts, as dirindex.c does (FNV-1a)
+ */
+static uint32_t home_bucket(const struct dirindex *idx, const char *name){
+	uint32_t h = UINT32_C(2166136261);
+	for(int i = 0; i < DIRENT_MAXLEN && name[i] != '\0'; ++i){
+		h = (h ^ (uint8_t)name[i]) * UINT32_C(16777619);
+	}
+	return h & (idx->capacity - 1);
+}
+
+/**
+ * @brief find a name "run<n>" whose search starts at a given bucket, other than the ones already taken
+ */
+static void name_in_bucket(const struct dirindex *idx, uint32_t bucket, int *next, char *name){
+	do{
+		sprintf(name, "run%d", (*next)++);
+	}while(home_bucket(idx, name) != bucket);
+}
+
+/**
+ * @brief check that entries from..to-1 are in an index with their inode number and slot
+ */
+static int all_found(const struct dirindex *idx, int from, int to){
+	char name[DIRENT_MAXLEN+1];
+	for(int i = from; i < to; ++i){
+		uint16_t slot = 0;
+		size_t len = make_name(name, i);
+		if(dirindex_find(idx, name, len, &slot) != i + 1 || slot != i) return 0;
+	}
+	return 1;
+}
+
+int main(void){
+	int failed = 0;
+	char name[DIRENT_MAXLEN+1];
+
+	//growth: every entry must still be found after each rehash
+	struct dirindex *idx = dirindex_create(1);
+	CHECK(idx != NULL && idx->capacity == 256);
+	if(idx == NULL) return 1;
+	int err = 0;
+	for(int i = 0; i < NB_NAMES && err == 0; ++i){
+		err = dirindex_add(idx, name, make_name(name, i), (uint16_t)(i + 1), (uint16_t)i);
+	}
+	CHECK(err == 0);
+	CHECK(idx->count == NB_NAMES && idx->capacity == 2048);
+	CHECK(all_found(idx, 0, NB_NAMES));
+	CHECK(dirindex_find(idx, "missing", 7, NULL) == ERR_INODE_OUTOF_RANGE);
+
+	//names are compared on DIRENT_MAXLEN chars only
+	CHECK(dirindex_add(idx, "fourteen_chars", 14, 5000, 0) == 0);
+	CHECK(dirindex_find(idx, "fourteen_chars", 14, NULL) == 5000);
+	CHECK(dirindex_find(idx, "fourteen_char", 13, NULL) == ERR_INODE_OUTOF_RANGE);
+	CHECK(dirindex_add(idx, "fifteen_chars__", 15, 5001, 0) == ERR_FILENAME_TOO_LONG);
+
+	//removal: the rest of the table is still found, the removed entries are not
+	for(int i = 0; i < NB_NAMES; i += 3){
+		err = dirindex_remove(idx, name, make_name(name, i));
+		if(err < 0) break;
+	}
+	CHECK(err == 0);
+	int found = 1;
+	for(int i = 0; i < NB_NAMES; ++i){
+		int expected = i % 3 == 0 ? ERR_INODE_OUTOF_RANGE : i + 1;
+		if(dirindex_find(idx, name, make_name(name, i), NULL) != expected) found = 0;
+	}
+	CHECK(found);
+	CHECK(idx->count == NB_NAMES + 1 - (NB_NAMES + 2) / 3);
+	CHECK(dirindex_remove(idx, "entry0", 6) == ERR_INODE_OUTOF_RANGE);
+
+	//removal inside a probe run, which wraps around the end of the table:
+	//a, b, c start at the last bucket, d and e at the first two
+	struct dirindex *run = dirindex_create(2);
+	CHECK(run != NULL);
+	if(run == NULL) return 1;
+	uint32_t last = run->capacity - 1;
+	char a[DIRENT_MAXLEN+1], b[DIRENT_MAXLEN+1], c[DIRENT_MAXLEN+1], d[DIRENT_MAXLEN+1], e[DIRENT_MAXLEN+1];
+	int next = 0;
+	name_in_bucket(run, last, &next, a);
+	name_in_bucket(run, last, &next, b);
+	name_in_bucket(run, last, &next, c);
+	name_in_bucket(run, 0, &next, d);
+	name_in_bucket(run, 1, &next, e);
+	dirindex_add(run, a, strlen(a), 1, 1);
+	dirindex_add(run, b, strlen(b), 2, 2);
+	dirindex_add(run, c, strlen(c), 3, 3);
+	dirindex_add(run, d, strlen(d), 4, 4);
+	dirindex_add(run, e, strlen(e), 5, 5);
+	CHECK(run->entries[last].inr == 1 && run->entries[3].inr == 5);
+
+	CHECK(dirindex_remove(run, a, strlen(a)) == 0);
+	CHECK(dirindex_find(run, a, strlen(a), NULL) == ERR_INODE_OUTOF_RANGE);
+	CHECK(dirindex_find(run, b, strlen(b), NULL) == 2 && dirindex_find(run, c, strlen(c), NULL) == 3);
+	CHECK(dirindex_find(run, d, strlen(d), NULL) == 4 && dirindex_find(run, e, strlen(e), NULL) == 5);
+	CHECK(run->entries[last].inr == 2 && run->entries[0].inr == 3);
+	CHECK(run->entries[1].inr == 4 && run->entries[2].inr == 5 && run->entries[3].inr == 0);
+
+	//d and e move back to their own buckets, not before them
+	CHECK(dirindex_remove(run, c, strlen(c)) == 0);
+	CHECK(run->entries[0].inr == 4 && run->entries[1].inr == 5 && run->entries[2].inr == 0);
+	CHECK(dirindex_find(run, b, strlen(b), NULL) == 2 && dirindex_find(run, d, strlen(d), NULL) == 4);
+	CHECK(dirindex_find(run, e, strlen(e), NULL) == 5 && run->count == 3);
+	CHECK(dirindex_remove(run, e, strlen(e)) == 0 && dirindex_remove(run, b, strlen(b)) == 0);
+	CHECK(dirindex_find(run, d, strlen(d), NULL) == 4 && run->count == 1);
+
+	//installing: an index already in the table is kept
+	struct dirindex_table *t = dirindex_alloc();
+	CHECK(t != NULL);
+	if(t == NULL) return 1;
+	CHECK(dirindex_install(t, idx) == idx);
+	struct dirindex *other = dirindex_create(1);
+	CHECK(other != NULL && dirindex_install(t, other) == idx);
+	CHECK(dirindex_get(t, 1) == idx);
+
+	//eviction: a full table drops its indexes in round-robin order
+	for(uint16_t dir = 2; dir <= DIRINDEX_MAX_DIRS; ++dir){
+		dirindex_install(t, dirindex_create(dir));
+	}
+	CHECK(dirindex_get(t, 1) == idx && dirindex_get(t, DIRINDEX_MAX_DIRS) != NULL);
+	dirindex_install(t, dirindex_create(DIRINDEX_MAX_DIRS + 1));
+	CHECK(dirindex_get(t, 1) == NULL);
+	CHECK(dirindex_get(t, 2) != NULL && dirindex_get(t, DIRINDEX_MAX_DIRS + 1) != NULL);
+	dirindex_install(t, dirindex_create(DIRINDEX_MAX_DIRS + 2));
+	CHECK(dirindex_get(t, 2) == NULL && dirindex_get(t, 3) != NULL);
+
+	dirindex_drop(t, 3);
+	CHECK(dirindex_get(t, 3) == NULL);
+	dirindex_free(t);
+	dirindex_destroy(run);
+
+	if(failed > 0) printf("%d check(s) failed\n", failed);
+	return failed != 0;
+}
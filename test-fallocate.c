@@ -0,0 +1,53 @@
+#include <string.h>
+#include "direntv6.h"
+#include "filev6.h"
+#include "inode.h"
+#include "bmblock.h"
+#include "error.h"
+#include "test-scratch.h"
+
+#define NSECTORS 12       /* sectors of the file, past ADDR_SMALL_LENGTH */
+
+int test(struct unix_filesystem *u, const char *diskname){
+	(void)diskname;
+	int failed = 0;
+	uint8_t buf[SECTOR_SIZE];
+	struct filev6 f;
+
+	int inr = direntv6_create(u, "/falloc", 0);
+	if(inr < 0) return inr;
+	memset(buf, 'y', sizeof(buf));
+
+	//a file with a hole: its first and last sectors are written
+	int err = filev6_open(u, (uint16_t)inr, &f);
+	if(err == 0) err = filev6_writeat(u, &f, buf, SECTOR_SIZE, 0);
+	if(err == 0) err = filev6_writeat(u, &f, buf, SECTOR_SIZE, (NSECTORS - 1) * SECTOR_SIZE);
+	if(err < 0) return err;
+
+	//the hole and the sectors past the end are reserved at once...
+	uint64_t nfree = u->fbm->nfree;
+	err = filev6_fallocate(u, &f, SECTOR_SIZE, (NSECTORS + 3) * SECTOR_SIZE);
+	if(err < 0) return err;
+	CHECK(nfree - u->fbm->nfree == (uint64_t)NSECTORS + 2);
+	CHECK(f.nreserved == NSECTORS + 2);
+	CHECK(inode_getsize(&f.i_node) == NSECTORS * SECTOR_SIZE);
+
+	//...so that the writes which fill them take no other sector
+	nfree = u->fbm->nfree;
+	for(int i = 1; i < NSECTORS + 4 && err == 0; ++i){
+		err = filev6_writeat(u, &f, buf, SECTOR_SIZE, i * SECTOR_SIZE);
+	}
+	if(err < 0) return err;
+	CHECK(u->fbm->nfree == nfree);
+	CHECK(f.nreserved == 0);
+	CHECK(inode_getsize(&f.i_node) == (NSECTORS + 4) * SECTOR_SIZE);
+
+	//the sectors the writes did not use are released
+	err = filev6_fallocate(u, &f, 0, (NSECTORS + 8) * SECTOR_SIZE);
+	if(err < 0) return err;
+	CHECK(nfree - u->fbm->nfree == 4);
+	filev6_unreserve(u, &f);
+	CHECK(u->fbm->nfree == nfree);
+	CHECK(f.nreserved == 0);
+	return failed;
+}
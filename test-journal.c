@@ -0,0 +1,157 @@
+#include <stdlib.h>
+#include <string.h>
+#include "journal.h"
+#include "writeback.h"
+#include "direntv6.h"
+#include "filev6.h"
+#include "inode.h"
+#include "sector.h"
+#include "error.h"
+#include "test-scratch.h"
+
+#define FILE_SIZE 5000     /* past ADDR_SMALL_LENGTH sectors: the file has an indirection sector */
+#define SMALL_BLOCKS 200   /* too small a disk for mountv6_mkfs to set up a journal */
+#define SMALL_INODES 32
+
+/**
+ * @brief stop as a crash would: the dirty metadata is lost, and the transactions in the journal
+ *        are neither written in place nor dropped; then mount again
+ */
+static int crash(struct unix_filesystem *u, const char *diskname){
+	writeback_free(u->writeback);
+	u->writeback = NULL;
+	journal_free(u->journal);
+	u->journal = NULL;
+	int err = umountv6(u);
+	if(err == 0) err = mountv6(diskname, u);
+	return err;
+}
+
+/**
+ * @brief read the whole disk file
+ * @param nsectors its size in sectors (OUT)
+ * @return the content, or NULL on error
+ */
+static uint8_t *snapshot(struct unix_filesystem *u, uint32_t *nsectors){
+	if(fseek(u->f, 0, SEEK_END) != 0) return NULL;
+	long size = ftell(u->f);
+	uint8_t *image = size > 0 ? malloc((size_t)size) : NULL;
+	if(image == NULL) return NULL;
+	*nsectors = (uint32_t)(size / SECTOR_SIZE);
+	for(uint32_t s = 0; s < *nsectors; ++s){
+		if(sector_read(u->f, s, image + (size_t)s * SECTOR_SIZE) < 0){
+			free(image);
+			return NULL;
+		}
+	}
+	return image;
+}
+
+int test(struct unix_filesystem *u, const char *diskname){
+	int failed = 0;
+	uint8_t data[SECTOR_SIZE];
+	uint8_t out[SECTOR_SIZE];
+	uint16_t first = u->s.s_block_start + 10;
+	uint16_t second = first + 1;
+
+	CHECK(u->journal != NULL);
+	if(u->journal == NULL) return failed;
+
+	//the sectors start empty (the disk file may not reach them yet)
+	memset(data, 0, sizeof(data));
+	int err = sector_write(u->f, first, data);
+	if(err == 0) err = sector_write(u->f, second, data);
+	if(err < 0) return err;
+
+	//a complete transaction is written in place at mount
+	memset(data, 'A', sizeof(data));
+	err = journal_commit(u->journal, 1, &first, data);
+	if(err == 0) err = crash(u, diskname);
+	if(err == 0) err = sector_read(u->f, first, out);
+	if(err < 0) return err;
+	CHECK(memcmp(out, data, SECTOR_SIZE) == 0);
+
+	//a torn one is not: the one before it is still the last complete one
+	memset(data, 'B', sizeof(data));
+	err = journal_commit(u->journal, 1, &second, data);
+	if(err < 0) return err;
+	for(uint32_t s = u->s.s_journal_start; s < (uint32_t)u->s.s_journal_start + u->s.s_journal_size && err == 0; ++s){
+		//the content of the sector in the journal is cut short
+		err = sector_read(u->f, s, out);
+		if(err == 0 && memcmp(out, data, SECTOR_SIZE) == 0){
+			memset(out + SECTOR_SIZE / 2, 0, SECTOR_SIZE / 2);
+			err = sector_write(u->f, s, out);
+		}
+	}
+	if(err == 0) err = crash(u, diskname);
+	if(err < 0) return err;
+	memset(data, 0, sizeof(data));
+	err = sector_read(u->f, second, out);
+	if(err < 0) return err;
+	CHECK(memcmp(out, data, SECTOR_SIZE) == 0);
+	memset(data, 'A', sizeof(data));
+	err = sector_read(u->f, first, out);
+	if(err < 0) return err;
+	CHECK(memcmp(out, data, SECTOR_SIZE) == 0);
+
+	//a crash between the journal and the writes in place: the file created and written by the
+	//batch is back after the replay, with its directory entry, inode and indirection sector
+	uint8_t buf[FILE_SIZE];
+	for(int i = 0; i < FILE_SIZE; ++i) buf[i] = (uint8_t)(i % 251);
+	struct filev6 f;
+	int inr = direntv6_create(u, "/j", 0);
+	if(inr < 0) return inr;
+	err = filev6_open(u, (uint16_t)inr, &f);
+	if(err == 0) err = filev6_writeat(u, &f, buf, FILE_SIZE, 0);
+	if(err < 0) return err;
+
+	uint32_t nsectors = 0;
+	uint8_t *before = snapshot(u, &nsectors);
+	if(before == NULL) return ERR_IO;
+	err = writeback_sync(u);
+	uint32_t isector = u->s.s_inode_start + (uint32_t)inr / INODES_PER_SECTOR;
+	if(err == 0) err = sector_read(u->f, isector, out);
+	CHECK(err == 0 && memcmp(out, before + (size_t)isector * SECTOR_SIZE, SECTOR_SIZE) != 0);
+
+	//everything but the journal goes back to what it was before the batch
+	for(uint32_t s = 0; s < nsectors && err == 0; ++s){
+		if(s >= u->s.s_journal_start && s < (uint32_t)u->s.s_journal_start + u->s.s_journal_size) continue;
+		err = sector_write(u->f, s, before + (size_t)s * SECTOR_SIZE);
+	}
+	free(before);
+	if(err == 0) err = crash(u, diskname);
+	if(err < 0) return err;
+	CHECK(direntv6_dirlookup(u, ROOT_INUMBER, "/j") == inr);
+	uint8_t back[FILE_SIZE + 1];
+	err = filev6_open(u, (uint16_t)inr, &f);
+	if(err == 0) err = filev6_readbytes(&f, back, sizeof(back));
+	CHECK(err == FILE_SIZE && memcmp(back, buf, FILE_SIZE) == 0);
+
+	//dates set on purpose are kept even when they are earlier than the ones on the disk
+	err = inode_settimes(u, (uint16_t)inr, &f.i_node, INODE_ATIME | INODE_MTIME, 1000, 2000);
+	if(err == 0) err = writeback_sync(u);
+	if(err == 0) err = crash(u, diskname);
+	if(err == 0) err = inode_read(u, (uint16_t)inr, &f.i_node);
+	if(err < 0) return err;
+	CHECK(inode_gettime(f.i_node.i_atime) == 1000 && inode_gettime(f.i_node.i_mtime) == 2000);
+
+	//an oversized batch is refused rather than split in two transactions
+	CHECK(journal_commit(u->journal, journal_capacity(u->journal) + 1, &first, data) == ERR_BAD_PARAMETER);
+
+	//without a journal, the inode of a new entry is on the disk as soon as the entry is
+	char small[FILENAME_MAX];
+	snprintf(small, sizeof(small), "%s.small", diskname);
+	struct unix_filesystem v = {0};
+	err = mountv6_mkfs(small, SMALL_BLOCKS, SMALL_INODES);
+	if(err == 0) err = mountv6(small, &v);
+	if(err < 0) return err;
+	CHECK(v.journal == NULL);
+	inr = direntv6_create(&v, "/k", 0);
+	struct inode inodes[INODES_PER_SECTOR];
+	err = inr < 0 ? inr : sector_read(v.f, v.s.s_inode_start + (uint32_t)inr / INODES_PER_SECTOR, inodes);
+	CHECK(err == 0 && (inodes[inr % INODES_PER_SECTOR].i_mode & IALLOC));
+	umountv6(&v);
+	remove(small);
+
+	return failed;
+}
@@ -0,0 +1,102 @@
+/**
+ * @file test-match.c
+ * @brief main program to check that direntv6_match finds the same entries as
+ *        direntv6_match_scalar, on sectors built to trip up the SIMD compares
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "direntv6.h"
+
+#define NB_SECTORS 2000
+
+/**
+ * @brief print a check and its result; count it in the variable failed if it does not hold
+ */
+#define CHECK(cond) \
+    do { \
+        int ok_ = (cond); \
+        printf("%-60s %s\n", #cond, ok_ ? "ok" : "FAILED"); \
+        failed += !ok_; \
+    } while(0)
+
+/**
+ * @brief compare both matchers for every prefix of a sector and every name of a list
+ * @return the number of disagreements
+ */
+static int compare(const struct direntv6 *dirs, char names[][DIRENT_MAXLEN+1], int nnames){
+	int diff = 0;
+	for(int count = 0; count <= DIRENTRIES_PER_SECTOR; ++count){
+		for(int n = 0; n < nnames; ++n){
+			size_t len = strlen(names[n]);
+			diff += direntv6_match(dirs, count, names[n], len) != direntv6_match_scalar(dirs, count, names[n], len);
+		}
+	}
+	return diff;
+}
+
+/**
+ * @brief fill an entry with a name of a few letters out of two, so that names collide,
+ *        followed by garbage after its '\0' (as direntv6_create used to leave)
+ */
+static void random_entry(struct direntv6 *d, char *name){
+	size_t len = 1 + (size_t)rand() % DIRENT_MAXLEN;
+	for(size_t i = 0; i < DIRENT_MAXLEN; ++i) d->d_name[i] = (char)(rand() % 256);
+	for(size_t i = 0; i < len; ++i) d->d_name[i] = rand() % 2 ? 'a' : 'b';
+	if(len < DIRENT_MAXLEN) d->d_name[len] = '\0';
+	d->d_inumber = rand() % 4 ? (uint16_t)(1 + rand() % 1000) : 0;
+	memcpy(name, d->d_name, len);
+	name[len] = '\0';
+}
+
+int main(void){
+	int failed = 0;
+	struct direntv6 dirs[DIRENTRIES_PER_SECTOR];
+	char names[2 * DIRENTRIES_PER_SECTOR][DIRENT_MAXLEN+1];
+
+	//hand-made cases
+	memset(dirs, 0, sizeof(dirs));
+	memcpy(dirs[0].d_name, "fourteen_chars", DIRENT_MAXLEN);   //no '\0' at all
+	dirs[0].d_inumber = 2;
+	memcpy(dirs[1].d_name, "short\0garbage!", DIRENT_MAXLEN);  //garbage after the '\0'
+	dirs[1].d_inumber = 3;
+	memcpy(dirs[2].d_name, "free", 5);                         //a free slot with a name
+	memcpy(dirs[3].d_name, "free", 5);
+	dirs[3].d_inumber = 4;
+	memcpy(dirs[4].d_name, "shorter", 8);
+	dirs[4].d_inumber = 5;
+	CHECK(direntv6_match(dirs, 5, "fourteen_chars", 14) == 0);
+	CHECK(direntv6_match(dirs, 5, "fourteen_char", 13) == -1);
+	CHECK(direntv6_match(dirs, 5, "short", 5) == 1);
+	CHECK(direntv6_match(dirs, 5, "free", 4) == 3);
+	CHECK(direntv6_match(dirs, 3, "free", 4) == -1);
+	CHECK(direntv6_match(dirs, 5, "shorte", 6) == -1);
+	CHECK(direntv6_match(dirs, 5, "fifteen_chars__", 15) == -1);
+	CHECK(direntv6_match(dirs, 5, "", 0) == -1);
+	char hand[][DIRENT_MAXLEN+1] = {"fourteen_chars", "fourteen_char", "short", "free", "shorter", "shorte", "s"};
+	CHECK(compare(dirs, hand, sizeof(hand) / sizeof(hand[0])) == 0);
+
+	//the inode number bytes look like part of a name
+	memset(dirs, 0, sizeof(dirs));
+	dirs[7].d_inumber = 'x' | 'y' << 8;
+	memcpy(dirs[7].d_name, "z", 2);
+	CHECK(direntv6_match(dirs, 8, "z", 1) == 7 && direntv6_match(dirs, 8, "xyz", 3) == -1);
+
+	//random sectors; the names searched are those of the sector and their prefixes
+	srand(1);
+	int diff = 0;
+	for(int s = 0; s < NB_SECTORS; ++s){
+		for(int i = 0; i < DIRENTRIES_PER_SECTOR; ++i){
+			random_entry(&dirs[i], names[2 * i]);
+			strcpy(names[2 * i + 1], names[2 * i]);
+			size_t len = strlen(names[2 * i + 1]);
+			if(len > 1) names[2 * i + 1][len - 1] = '\0';
+		}
+		diff += compare(dirs, names, 2 * DIRENTRIES_PER_SECTOR);
+	}
+	CHECK(diff == 0);
+
+	if(failed > 0) printf("%d check(s) failed\n", failed);
+	return failed != 0;
+}
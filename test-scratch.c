@@ -0,0 +1,65 @@
+/**
+ * @file test-scratch.c
+ * @brief main program to perform tests which change a disk: a new one is created first
+ *
+ * The test gets the mounted disk and its name (to mount it again). It returns
+ * the number of checks which failed, or <0 on error.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include "mount.h"
+#include "error.h"
+#include "test-scratch.h"
+
+#define MIN_ARGS 1
+#define MAX_ARGS 1
+#define USAGE    "test <new diskname>"
+
+#define SCRATCH_BLOCKS 4000   /* large enough for mountv6_mkfs to set up a journal */
+#define SCRATCH_INODES 64
+
+void error(const char* message)
+{
+    fputs(message, stderr);
+    putc('\n', stderr);
+    fputs("Usage: " USAGE, stderr);
+    putc('\n', stderr);
+    exit(1);
+}
+
+void check_args(int argc)
+{
+    if (argc < MIN_ARGS) {
+        error("too few arguments:");
+    }
+    if (argc > MAX_ARGS) {
+        error("too many arguments:");
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    // Check the number of args but remove program's name
+    check_args(argc - 1);
+
+    int error = mountv6_mkfs(argv[1], SCRATCH_BLOCKS, SCRATCH_INODES);
+    if (error) {
+        puts(ERR_MESSAGES[error - ERR_FIRST]);
+        return 1;
+    }
+
+    struct unix_filesystem u = {0};
+    error = mountv6(argv[1], &u);
+    if (error == 0) {
+        error = test(&u, argv[1]);
+    }
+    if (error < 0) {
+        puts(ERR_MESSAGES[error - ERR_FIRST]);
+    } else if (error > 0) {
+        printf("%d check(s) failed\n", error);
+    }
+    umountv6(&u);
+
+    return error != 0;
+}
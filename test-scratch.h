@@ -0,0 +1,27 @@
+#pragma once
+
+/**
+ * @file test-scratch.h
+ * @brief tests which change a disk, run on a new one by test-scratch.c
+ */
+
+#include <stdio.h>
+#include "mount.h"
+
+/**
+ * @brief print a check and its result; count it in the variable failed if it does not hold
+ */
+#define CHECK(cond) \
+    do { \
+        int ok_ = (cond); \
+        printf("%-60s %s\n", #cond, ok_ ? "ok" : "FAILED"); \
+        failed += !ok_; \
+    } while(0)
+
+/**
+ * @brief the test
+ * @param u the new disk, mounted
+ * @param diskname its name, to mount it again
+ * @return the number of checks which failed; <0 on error
+ */
+int test(struct unix_filesystem *u, const char *diskname);
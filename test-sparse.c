@@ -0,0 +1,50 @@
+#include <string.h>
+#include "direntv6.h"
+#include "filev6.h"
+#include "inode.h"
+#include "bmblock.h"
+#include "error.h"
+#include "test-scratch.h"
+
+#define HOLE_END 20       /* the second sector written, past ADDR_SMALL_LENGTH: it needs an indirection sector */
+
+int test(struct unix_filesystem *u, const char *diskname){
+	int failed = 0;
+	uint8_t buf[(HOLE_END + 1) * SECTOR_SIZE];
+	struct filev6 f;
+
+	//counted once the root directory has its sector
+	int inr = direntv6_create(u, "/sparse", 0);
+	if(inr < 0) return inr;
+	uint64_t nfree = u->fbm->nfree;
+
+	//only the first and the last sectors are written: the ones between are holes, without a sector
+	memset(buf, 'x', SECTOR_SIZE);
+	int err = filev6_open(u, (uint16_t)inr, &f);
+	if(err == 0) err = filev6_writeat(u, &f, buf, SECTOR_SIZE, 0);
+	if(err == 0) err = filev6_writeat(u, &f, buf, SECTOR_SIZE, HOLE_END * SECTOR_SIZE);
+	if(err < 0) return err;
+	CHECK(inode_getsize(&f.i_node) == (HOLE_END + 1) * SECTOR_SIZE);
+	CHECK(inode_findsector(u, &f.i_node, 1) == 0);
+	CHECK(inode_findsector(u, &f.i_node, HOLE_END - 1) == 0);
+	CHECK(inode_findsector(u, &f.i_node, HOLE_END) > 0);
+	CHECK(u->fbm->nfree == nfree - 3);
+
+	memset(buf, 0xff, sizeof(buf));
+	err = filev6_open(u, (uint16_t)inr, &f);
+	if(err < 0) return err;
+	CHECK(filev6_readbytes(&f, buf, sizeof(buf)) == (int)sizeof(buf));
+	int zeros = 1;
+	for(int i = SECTOR_SIZE; i < HOLE_END * SECTOR_SIZE; ++i){
+		if(buf[i] != 0) zeros = 0;
+	}
+	CHECK(zeros);
+	CHECK(buf[0] == 'x' && buf[sizeof(buf) - 1] == 'x');
+
+	//the bitmap rebuilt at mount skips the holes but not the sectors after them
+	err = umountv6(u);
+	if(err == 0) err = mountv6(diskname, u);
+	if(err < 0) return err;
+	CHECK(u->fbm->nfree == nfree - 3);
+	return failed;
+}
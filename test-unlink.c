@@ -0,0 +1,114 @@
+#include <string.h>
+#include "direntv6.h"
+#include "filev6.h"
+#include "inode.h"
+#include "bmblock.h"
+#include "reclaim.h"
+#include "writeback.h"
+#include "error.h"
+#include "test-scratch.h"
+
+#define BIG_SIZE 5000     /* past ADDR_SMALL_LENGTH sectors: the file has an indirection sector */
+#define SMALL_SIZE 1000
+
+/**
+ * @brief write the batch in progress and wait until the sectors it frees are released
+ */
+static int settle(struct unix_filesystem *u){
+	int err = writeback_sync(u);
+	reclaim_wait(u);
+	return err;
+}
+
+/**
+ * @brief read a whole file
+ * @return the number of bytes read (its size); <0 on error
+ */
+static int read_file(struct unix_filesystem *u, uint16_t inr, uint8_t *buf, int len){
+	struct filev6 f;
+	int err = filev6_open(u, inr, &f);
+	if(err < 0) return err;
+	return filev6_readbytes(&f, buf, len);
+}
+
+/**
+ * @brief check that bytes are all equal to a value
+ */
+static int all(const uint8_t *buf, int from, int to, uint8_t value){
+	for(int i = from; i < to; ++i){
+		if(buf[i] != value) return 0;
+	}
+	return 1;
+}
+
+int test(struct unix_filesystem *u, const char *diskname){
+	(void)diskname;
+	int failed = 0;
+	uint8_t buf[2 * BIG_SIZE];
+	struct filev6 f;
+
+	//the root directory keeps the sector its first entry takes: it is counted in the baseline
+	int err = direntv6_create(u, "/first", 0);
+	if(err >= 0) err = direntv6_unlink(u, "/first", 0);
+	if(err == 0) err = settle(u);
+	if(err < 0) return err;
+	uint64_t nfree = u->fbm->nfree;
+	uint64_t ifree = u->ibm->nfree;
+
+	//unlink and rmdir give back the inodes and all the sectors, indirection sector included
+	int dir = direntv6_create(u, "/d", IFDIR);
+	if(dir < 0) return dir;
+	int inr = direntv6_create(u, "/d/f", 0);
+	if(inr < 0) return inr;
+	memset(buf, 'a', BIG_SIZE);
+	err = filev6_open(u, (uint16_t)inr, &f);
+	if(err == 0) err = filev6_writeat(u, &f, buf, BIG_SIZE, 0);
+	if(err < 0) return err;
+
+	CHECK(direntv6_unlink(u, "/d", 1) == ERR_DIRECTORY_NOT_EMPTY);
+	CHECK(direntv6_unlink(u, "/d/f", 1) < 0);
+	CHECK(direntv6_unlink(u, "/d/f", 0) == 0);
+	CHECK(direntv6_dirlookup(u, ROOT_INUMBER, "/d/f") < 0);
+	CHECK(direntv6_unlink(u, "/d", 1) == 0);
+	CHECK(direntv6_dirlookup(u, ROOT_INUMBER, "/d") < 0);
+	err = settle(u);
+	if(err < 0) return err;
+	CHECK(bm_get(u->ibm, (uint64_t)inr) == 0);
+	CHECK(bm_get(u->ibm, (uint64_t)dir) == 0);
+	CHECK(u->ibm->nfree == ifree);
+	CHECK(u->fbm->nfree == nfree);
+
+	//truncate up, across the indirection, then down below it: new bytes read as zeros
+	inr = direntv6_create(u, "/t", 0);
+	if(inr < 0) return inr;
+	err = filev6_open(u, (uint16_t)inr, &f);
+	if(err == 0) err = filev6_writeat(u, &f, buf, SMALL_SIZE, 0);
+	if(err == 0) err = filev6_truncate(u, &f, BIG_SIZE);
+	if(err < 0) return err;
+	memset(buf, 0xff, sizeof(buf));
+	CHECK(read_file(u, (uint16_t)inr, buf, sizeof(buf)) == BIG_SIZE);
+	CHECK(all(buf, 0, SMALL_SIZE, 'a') && all(buf, SMALL_SIZE, BIG_SIZE, 0));
+
+	memset(buf, 'b', BIG_SIZE);
+	err = filev6_writeat(u, &f, buf, BIG_SIZE, 0);
+	if(err == 0) err = filev6_truncate(u, &f, SMALL_SIZE);
+	if(err == 0) err = settle(u);
+	if(err < 0) return err;
+	CHECK(inode_getsize(&f.i_node) == SMALL_SIZE);
+	CHECK(u->fbm->nfree == nfree - (SMALL_SIZE + SECTOR_SIZE - 1) / SECTOR_SIZE);
+
+	//the bytes cut off do not come back when the file grows again
+	err = filev6_truncate(u, &f, 2 * SMALL_SIZE);
+	if(err < 0) return err;
+	memset(buf, 0xff, sizeof(buf));
+	CHECK(read_file(u, (uint16_t)inr, buf, sizeof(buf)) == 2 * SMALL_SIZE);
+	CHECK(all(buf, 0, SMALL_SIZE, 'b') && all(buf, SMALL_SIZE, 2 * SMALL_SIZE, 0));
+
+	err = filev6_truncate(u, &f, 0);
+	if(err == 0) err = direntv6_unlink(u, "/t", 0);
+	if(err == 0) err = settle(u);
+	if(err < 0) return err;
+	CHECK(u->fbm->nfree == nfree);
+	CHECK(u->ibm->nfree == ifree);
+	return failed;
+}
@@ -0,0 +1,363 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "treewalk.h"
+#include "direntv6.h"
+#include "inode.h"
+#include "error.h"
+
+#define TREEWALK_DEQUE_INIT 64
+
+//Double-ended queue of nodes to expand: the owner pushes and pops at the bottom,
+//the other workers steal from the top
+struct treewalk_deque {
+	pthread_mutex_t lock;
+	struct treewalk_node **nodes;
+	size_t top;
+	size_t bottom;
+	size_t capacity;
+};
+
+struct treewalk_pool {
+	const struct unix_filesystem *u;
+	treewalk_visit_fct visit;
+	void *arg;
+	int nthreads;
+	struct treewalk_deque *deques;
+	pthread_mutex_t lock;        // protects the fields below
+	pthread_cond_t work;         // signaled when nodes are pushed or when the walk is over
+	size_t pending;              // number of nodes pushed but not yet expanded
+	unsigned long generation;    // incremented each time nodes are pushed
+	int idle;                    // number of workers waiting for work
+};
+
+struct treewalk_worker {
+	struct treewalk_pool *pool;
+	int id;
+};
+
+/**
+ * @brief allocate a node
+ * @param inr the inode number of the node
+ * @param prefix the path of the parent
+ * @param name the name of the node in its parent (NULL for the root of the subtree)
+ * @return the new node or NULL on failure
+ */
+static struct treewalk_node *treewalk_node_new(uint16_t inr, const char *prefix, const char *name){
+	struct treewalk_node *node = calloc(1, sizeof(struct treewalk_node));
+	if(node == NULL) return NULL;
+
+	size_t len = strlen(prefix) + (name != NULL ? strlen(name) + 1 : 0);
+	node->path = malloc(len + 1);
+	if(node->path == NULL){
+		free(node);
+		return NULL;
+	}
+	if(name != NULL){
+		snprintf(node->path, len + 1, "%s%c%s", prefix, PATH_TOKEN, name);
+	}else{
+		strcpy(node->path, prefix);
+	}
+	node->inr = inr;
+	return node;
+}
+
+/**
+ * @brief free a node and all its descendants
+ * @param node the node (may be NULL)
+ */
+static void treewalk_node_free(struct treewalk_node *node){
+	if(node == NULL) return;
+	for(size_t i = 0; i < node->nchildren; ++i){
+		treewalk_node_free(node->children[i]);
+	}
+	free(node->children);
+	free(node->path);
+	free(node);
+}
+
+/**
+ * @brief push a node at the bottom of a deque
+ * @param q the deque
+ * @param node the node
+ * @return 0 on success; <0 on error
+ */
+static int treewalk_push(struct treewalk_deque *q, struct treewalk_node *node){
+	int err = 0;
+	pthread_mutex_lock(&q->lock);
+	if(q->bottom == q->capacity){
+		if(q->top > 0){
+			//slide the nodes back to the beginning of the array
+			memmove(q->nodes, q->nodes + q->top, (q->bottom - q->top) * sizeof(*q->nodes));
+			q->bottom -= q->top;
+			q->top = 0;
+		}else{
+			size_t capacity = q->capacity ? 2 * q->capacity : TREEWALK_DEQUE_INIT;
+			struct treewalk_node **nodes = realloc(q->nodes, capacity * sizeof(*nodes));
+			if(nodes == NULL){
+				err = ERR_NOMEM;
+			}else{
+				q->nodes = nodes;
+				q->capacity = capacity;
+			}
+		}
+	}
+	if(err == 0) q->nodes[q->bottom++] = node;
+	pthread_mutex_unlock(&q->lock);
+	return err;
+}
+
+/**
+ * @brief take a node from a deque
+ * @param q the deque
+ * @param steal 0 to take the most recent node (owner), 1 to take the oldest one (thief)
+ * @return the node or NULL if the deque is empty
+ */
+static struct treewalk_node *treewalk_take(struct treewalk_deque *q, int steal){
+	struct treewalk_node *node = NULL;
+	pthread_mutex_lock(&q->lock);
+	if(q->top < q->bottom){
+		node = steal ? q->nodes[q->top++] : q->nodes[--q->bottom];
+		if(q->top == q->bottom) q->top = q->bottom = 0;
+	}
+	pthread_mutex_unlock(&q->lock);
+	return node;
+}
+
+/**
+ * @brief read the inode of a node, call the visitor and list its children
+ * @param pool the pool
+ * @param node the node
+ * @return 0 on success; <0 on error (stored in node->err)
+ */
+static int treewalk_expand(struct treewalk_pool *pool, struct treewalk_node *node){
+	int err = inode_read(pool->u, node->inr, &node->inode);
+	if(err < 0){
+		memset(&node->inode, 0, sizeof(node->inode));
+		return node->err = err;
+	}
+
+	if(pool->visit != NULL){
+		err = pool->visit(pool->u, node, pool->arg);
+		if(err < 0) return node->err = err;
+	}
+
+	struct directory_reader d;
+	err = direntv6_opendir(pool->u, node->inr, &d);
+	if(err == ERR_INVALID_DIRECTORY_INODE) return 0;
+	if(err < 0) return node->err = err;
+
+	char name[DIRENT_MAXLEN+1];
+	uint16_t child_inr;
+	size_t capacity = 0;
+	while((err = direntv6_readdir(&d, name, &child_inr)) > 0){
+		if(node->nchildren == capacity){
+			capacity = capacity ? 2 * capacity : DIRENTRIES_PER_SECTOR;
+			struct treewalk_node **children = realloc(node->children, capacity * sizeof(*children));
+			if(children == NULL) return node->err = ERR_NOMEM;
+			node->children = children;
+		}
+		struct treewalk_node *child = treewalk_node_new(child_inr, node->path, name);
+		if(child == NULL) return node->err = ERR_NOMEM;
+		node->children[node->nchildren++] = child;
+	}
+	if(err < 0) node->err = err;
+	return node->err;
+}
+
+/**
+ * @brief body of a worker: expand nodes until the whole subtree is known
+ * @param arg the worker (struct treewalk_worker *)
+ * @return NULL
+ */
+static void *treewalk_work(void *arg){
+	struct treewalk_worker *w = arg;
+	struct treewalk_pool *pool = w->pool;
+	struct treewalk_deque *own = &pool->deques[w->id];
+
+	for(;;){
+		//own nodes first (depth-first), then steal the oldest node of another worker
+		struct treewalk_node *node = treewalk_take(own, 0);
+		for(int i = 1; node == NULL && i < pool->nthreads; ++i){
+			node = treewalk_take(&pool->deques[(w->id + i) % pool->nthreads], 1);
+		}
+
+		if(node == NULL){
+			//nothing to do: wait until some nodes are pushed or the walk is over
+			pthread_mutex_lock(&pool->lock);
+			unsigned long generation = pool->generation;
+			++pool->idle;
+			while(pool->pending > 0 && pool->generation == generation){
+				pthread_cond_wait(&pool->work, &pool->lock);
+			}
+			--pool->idle;
+			int done = pool->pending == 0;
+			pthread_mutex_unlock(&pool->lock);
+			if(done) return NULL;
+			continue;
+		}
+
+		treewalk_expand(pool, node);
+
+		//the children must be counted before they can be stolen
+		size_t pushed = 0;
+		pthread_mutex_lock(&pool->lock);
+		pool->pending += node->nchildren;
+		pthread_mutex_unlock(&pool->lock);
+		//push in reverse order so that the owner expands the first child first
+		for(size_t i = node->nchildren; i > 0; --i){
+			if(treewalk_push(own, node->children[i-1]) < 0){
+				node->children[i-1]->err = ERR_NOMEM;
+			}else{
+				++pushed;
+			}
+		}
+
+		pthread_mutex_lock(&pool->lock);
+		pool->pending -= 1 + node->nchildren - pushed;
+		if(pushed > 0) ++pool->generation;
+		if(pool->idle > 0 && (pushed > 0 || pool->pending == 0)){
+			pthread_cond_broadcast(&pool->work);
+		}
+		pthread_mutex_unlock(&pool->lock);
+	}
+}
+
+/**
+ * @brief call the emitter on a subtree, in pre-order
+ * @param node the root of the subtree
+ * @param emit the emitter
+ * @param arg argument given to emit
+ * @return 0 on success; <0 if the emitter failed
+ */
+static int treewalk_emit(const struct treewalk_node *node, treewalk_emit_fct emit, void *arg){
+	int err = emit(node, arg);
+	for(size_t i = 0; err == 0 && i < node->nchildren; ++i){
+		err = treewalk_emit(node->children[i], emit, arg);
+	}
+	return err;
+}
+
+/**
+ * @brief return the number of workers to use
+ * @param nthreads the number of threads asked (0 for one per online core)
+ * @return a number between 1 and TREEWALK_MAX_THREADS
+ */
+static int treewalk_nthreads(int nthreads){
+	if(nthreads <= 0){
+		long cores = sysconf(_SC_NPROCESSORS_ONLN);
+		nthreads = cores > 0 ? (int)(cores < TREEWALK_MAX_THREADS ? cores : TREEWALK_MAX_THREADS) : 1;
+	}
+	return nthreads < TREEWALK_MAX_THREADS ? nthreads : TREEWALK_MAX_THREADS;
+}
+
+/**
+ * @brief walk a subtree in parallel, then emit its nodes in a deterministic order
+ * @param u a mounted filesystem
+ * @param inr the root of the subtree
+ * @param prefix the path of the root of the subtree
+ * @param nthreads the number of threads (0 for one per online core)
+ * @param visit the visitor (may be NULL)
+ * @param emit the emitter (may be NULL)
+ * @param arg argument given to visit and emit
+ * @return 0 on success; <0 on error
+ */
+int treewalk_run(const struct unix_filesystem *u, uint16_t inr, const char *prefix, int nthreads,
+                 treewalk_visit_fct visit, treewalk_emit_fct emit, void *arg){
+	M_REQUIRE_NON_NULL(u);
+	M_REQUIRE_NON_NULL(prefix);
+
+	//Check if file is mounted
+	if (u->f ==  NULL) {
+		debug_print("File system not mounted");
+		return ERR_IO;
+	}
+
+	struct treewalk_node *root = treewalk_node_new(inr, prefix, NULL);
+	if(root == NULL) return ERR_NOMEM;
+
+	struct treewalk_pool pool;
+	memset(&pool, 0, sizeof(pool));
+	pool.u = u;
+	pool.visit = visit;
+	pool.arg = arg;
+	pool.nthreads = treewalk_nthreads(nthreads);
+	pool.pending = 1;
+	pool.deques = calloc(pool.nthreads, sizeof(struct treewalk_deque));
+	struct treewalk_worker *workers = calloc(pool.nthreads, sizeof(struct treewalk_worker));
+	pthread_t *threads = calloc(pool.nthreads, sizeof(pthread_t));
+	if(pool.deques == NULL || workers == NULL || threads == NULL){
+		free(pool.deques);
+		free(workers);
+		free(threads);
+		treewalk_node_free(root);
+		return ERR_NOMEM;
+	}
+	pthread_mutex_init(&pool.lock, NULL);
+	pthread_cond_init(&pool.work, NULL);
+	for(int i = 0; i < pool.nthreads; ++i){
+		pthread_mutex_init(&pool.deques[i].lock, NULL);
+		workers[i].pool = &pool;
+		workers[i].id = i;
+	}
+
+	int err = treewalk_push(&pool.deques[0], root);
+	if(err == 0){
+		//the calling thread is worker 0; if a thread cannot be created, the others do its share
+		int started = 1;
+		while(started < pool.nthreads && pthread_create(&threads[started], NULL, treewalk_work, &workers[started]) == 0){
+			++started;
+		}
+		treewalk_work(&workers[0]);
+		for(int i = 1; i < started; ++i){
+			pthread_join(threads[i], NULL);
+		}
+
+		//the nodes read before an error are emitted anyway
+		if(emit != NULL) err = treewalk_emit(root, emit, arg);
+		if(root->err < 0) err = root->err;
+	}
+
+	for(int i = 0; i < pool.nthreads; ++i){
+		pthread_mutex_destroy(&pool.deques[i].lock);
+		free(pool.deques[i].nodes);
+	}
+	pthread_cond_destroy(&pool.work);
+	pthread_mutex_destroy(&pool.lock);
+	free(pool.deques);
+	free(workers);
+	free(threads);
+	treewalk_node_free(root);
+	return err;
+}
+
+/**
+ * @brief emitter of treewalk_print_tree: print a node as direntv6_print_tree does
+ * @param node the node
+ * @param arg unused
+ * @return 0
+ */
+static int treewalk_print_node(const struct treewalk_node *node, void *arg){
+	//unreadable nodes are skipped, as direntv6_print_tree does
+	if((node->inode.i_mode & IALLOC) == 0) return 0;
+
+	if((node->inode.i_mode & IFMT) == IFDIR){
+		printf("%s %s%c\n", SHORT_DIR_NAME, node->path, PATH_TOKEN);
+	}else{
+		printf("%s %s\n", SHORT_FIL_NAME, node->path);
+	}
+	return 0;
+}
+
+/**
+ * @brief print a subtree the same way as direntv6_print_tree, reading it in parallel
+ * @param u a mounted filesystem
+ * @param inr the root of the subtree
+ * @param prefix the prefix to the subtree
+ * @return 0 on success; <0 on error
+ */
+int treewalk_print_tree(const struct unix_filesystem *u, uint16_t inr, const char *prefix){
+	return treewalk_run(u, inr, prefix, 0, NULL, treewalk_print_node, NULL);
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+/**
+ * @file treewalk.h
+ * @brief parallel traversal of a subtree of the filesystem.
+ *
+ * The subtree is expanded by a pool of threads, each with its own deque of
+ * pending nodes and stealing from the others when its deque is empty.
+ * A visitor is called (concurrently) once per node; then an emitter is called
+ * (sequentially) once per node in a deterministic order: pre-order, children
+ * in the order of their directory.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "unixv6fs.h"
+#include "mount.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TREEWALK_MAX_THREADS 16
+
+struct treewalk_node {
+    uint16_t inr;                        // inode number of the node
+    struct inode inode;                  // content of the inode (zeroed if it cannot be read)
+    int err;                             // 0 if the node could be read; <0 error otherwise
+    char *path;                          // full path of the node ("" for the root of the subtree)
+    struct treewalk_node **children;     // children, in the order of the directory
+    size_t nchildren;                    // number of children
+    int64_t result;                      // value set by the visitor, if any
+};
+
+/**
+ * @brief function called on each node while the tree is walked, from any thread
+ * @param u the filesystem
+ * @param node the node (its children are not known yet)
+ * @param arg the argument given to treewalk_run
+ * @return 0 on success; <0 on error (stored in node->err)
+ */
+typedef int (*treewalk_visit_fct)(const struct unix_filesystem *u, struct treewalk_node *node, void *arg);
+
+/**
+ * @brief function called on each node once the tree is walked, in pre-order
+ * @param node the node
+ * @param arg the argument given to treewalk_run
+ * @return 0 to go on; <0 to stop the traversal with this error
+ */
+typedef int (*treewalk_emit_fct)(const struct treewalk_node *node, void *arg);
+
+/**
+ * @brief walk a subtree in parallel, then emit its nodes in a deterministic order
+ * @param u a mounted filesystem
+ * @param inr the root of the subtree
+ * @param prefix the path of the root of the subtree
+ * @param nthreads the number of threads (0 for one per online core)
+ * @param visit the visitor (may be NULL)
+ * @param emit the emitter (may be NULL)
+ * @param arg argument given to visit and emit
+ * @return 0 on success; <0 on error
+ */
+int treewalk_run(const struct unix_filesystem *u, uint16_t inr, const char *prefix, int nthreads,
+                 treewalk_visit_fct visit, treewalk_emit_fct emit, void *arg);
+
+/**
+ * @brief print a subtree the same way as direntv6_print_tree, reading it in parallel
+ * @param u a mounted filesystem
+ * @param inr the root of the subtree
+ * @param prefix the prefix to the subtree
+ * @return 0 on success; <0 on error
+ */
+int treewalk_print_tree(const struct unix_filesystem *u, uint16_t inr, const char *prefix);
+
+#ifdef __cplusplus
+}
+#endif
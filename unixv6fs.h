@@ -187,7 +187,9 @@ struct superblock {
     uint8_t	    s_fmod;		    /* super block modified flag */
     uint8_t	    s_ronly;	    /* mounted read-only flag */
     uint16_t	s_time[2];	    /* current date of last update */
-    uint16_t	pad[244];       /* unused entries:
+    uint16_t    s_journal_start; /* first sector of the metadata journal */
+    uint16_t    s_journal_size; /* size in sectors of the journal (0: none) */
+    uint16_t	pad[242];       /* unused entries:
                                  * padding to ensure sizeof(superblock) == SECTOR_SIZE */
 };
 
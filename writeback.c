@@ -0,0 +1,689 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "writeback.h"
+#include "mount.h"
+#include "sector.h"
+#include "inode.h"
+#include "journal.h"
+#include "reclaim.h"
+#include "error.h"
+
+struct writeback_sector {
+	uint8_t data[SECTOR_SIZE];   // the sector, as it must be on the disk
+	uint32_t gen;                // tells this copy from a later copy of the same sector
+	int dirty;                   // 1 if it changed since a batch last took it
+	uint32_t batch;              // the last batch which took it
+	int keep;                    // 1 to keep it once written (the sectors of the inode table are)
+	int lazy;                    // 1 if timestamps changed while it was clean (see writeback_touch)
+};
+
+struct writeback_list {
+	uint16_t *sectors;           // sectors freed by an operation
+	size_t n;                    // number of sectors
+	struct writeback_list *next; // next list
+};
+
+struct writeback {
+	pthread_mutex_t lock;        // protects all the fields below
+	pthread_cond_t work;         // signaled when sectors get dirty or the thread must stop
+	pthread_cond_t idle;         // signaled when an operation ends while a batch waits for it
+	pthread_cond_t turn;         // signaled when a batch is taken or written
+	pthread_key_t depth;         // nesting of writeback_begin in the calling thread
+	struct writeback_sector **sectors; // copy of each sector kept in memory, or NULL
+	uint32_t nsectors;           // number of sectors of the disk
+	uint16_t *dirty;             // the dirty sectors, each once
+	uint32_t ndirty;             // number of dirty sectors
+	struct writeback_list *freed; // sectors freed by the operations of the next batch
+	size_t nfreed;               // number of sectors in freed
+	uint32_t gen;                // generation of the last copy made
+	uint32_t nops;               // number of operations in progress
+	uint32_t pending;            // number of batches waiting for the operations in progress
+	uint32_t inside;             // number of them waiting in an operation of their own thread
+	uint32_t blocked;            // number of operations waiting for a batch before they begin
+	uint32_t taken;              // number of batches taken
+	uint32_t written;            // number of batches written, in the order they were taken
+	time_t since;                // when the oldest dirty sector got dirty
+	uint32_t nlazy;              // number of sectors with lazy changes
+	time_t lazy_since;           // when the oldest of them changed
+	int started;                 // 1 once the thread runs
+	int stop;                    // 1 when the thread must stop
+	pthread_t thread;            // the thread
+	struct unix_filesystem *u;   // the filesystem
+};
+
+static void *writeback_run(void *arg);
+
+/**
+ * @brief compare two sector numbers, for qsort
+ * @param a the first sector
+ * @param b the second sector
+ * @return <0, 0 or >0 as a is before, at or after b
+ */
+static int writeback_cmp(const void *a, const void *b){
+	return (int)*(const uint16_t *)a - (int)*(const uint16_t *)b;
+}
+
+/**
+ * @brief tell whether an operation must wait for a batch before it begins (the caller holds the lock)
+ * @param w the write-back
+ * @return 1 if it must wait; 0 otherwise
+ */
+static int writeback_full(const struct writeback *w){
+	if(w->ndirty >= WRITEBACK_MAX_DIRTY) return 1;
+	//the operations in progress and the new one must all fit in the transaction of the batch
+	const struct journal *j = w->u->journal;
+	return j != NULL && w->ndirty + (w->nops + 1) * WRITEBACK_OP_SECTORS > journal_capacity(j);
+}
+
+/**
+ * @brief get the copy of a sector, made if there is none (the caller holds the lock)
+ * @param w the write-back
+ * @param sector the sector (in range)
+ * @param load 1 to read the sector in a new copy; 0 if the caller overwrites it all
+ * @param s the copy (OUT)
+ * @return 0 on success; <0 on error
+ */
+static int writeback_get(struct writeback *w, uint32_t sector, int load, struct writeback_sector **s){
+	*s = w->sectors[sector];
+	if(*s != NULL) return 0;
+	struct writeback_sector *c = calloc(1, sizeof(struct writeback_sector));
+	if(c == NULL) return ERR_NOMEM;
+	int err = load ? sector_read(w->u->f, sector, c->data) : 0;
+	if(err < 0){
+		free(c);
+		return err;
+	}
+	c->gen = ++w->gen;
+	w->sectors[sector] = *s = c;
+	return 0;
+}
+
+/**
+ * @brief mark a copy dirty, and wake the thread up if it has to (the caller holds the lock)
+ * @param w the write-back
+ * @param s the copy
+ * @param sector its sector
+ */
+static void writeback_mark(struct writeback *w, struct writeback_sector *s, uint32_t sector){
+	if(s->dirty) return;
+	s->dirty = 1;
+	//the batch which writes the sector writes its timestamps as well
+	if(s->lazy){
+		s->lazy = 0;
+		--w->nlazy;
+	}
+	w->dirty[w->ndirty++] = (uint16_t)sector;
+	if(w->ndirty == 1) w->since = time(NULL);
+
+	//without a thread, the changes wait for writeback_sync
+	if(!w->started && !w->stop) w->started = pthread_create(&w->thread, NULL, writeback_run, w) == 0;
+	//the thread waits for a first dirty sector, then for the oldest to be old enough
+	if(w->ndirty == 1 || w->ndirty * SECTOR_SIZE == WRITEBACK_DIRTY_BYTES) pthread_cond_signal(&w->work);
+}
+
+/**
+ * @brief drop the copy of a sector which is no longer metadata (the caller holds the lock)
+ * @param w the write-back
+ * @param sector the sector
+ */
+static void writeback_drop(struct writeback *w, uint32_t sector){
+	if(sector >= w->nsectors || w->sectors[sector] == NULL) return;
+	if(w->sectors[sector]->lazy) --w->nlazy;
+	if(w->sectors[sector]->dirty){
+		for(uint32_t i = 0; i < w->ndirty; ++i){
+			if(w->dirty[i] == sector) w->dirty[i] = w->dirty[--w->ndirty];
+		}
+	}
+	free(w->sectors[sector]);
+	w->sectors[sector] = NULL;
+}
+
+/**
+ * @brief make dirty the sectors with lazy changes, so that the next batch writes them
+ *        (the caller holds the lock)
+ * @param w the write-back
+ */
+static void writeback_expire(struct writeback *w){
+	//only the sectors of the inode table hold timestamps
+	uint32_t first = w->u->s.s_inode_start;
+	uint32_t end = first + w->u->s.s_isize;
+	for(uint32_t i = first; i < end && i < w->nsectors && w->nlazy > 0; ++i){
+		if(w->sectors[i] != NULL && w->sectors[i]->lazy) writeback_mark(w, w->sectors[i], i);
+	}
+}
+
+/**
+ * @brief keep the later dates of an inode: a stale copy of it (of another handle of
+ *        the file, say) never puts older ones back
+ * @param inode the inode, whose dates may change (IN/OUT)
+ * @param current the inode in the copy of its sector
+ */
+static void writeback_later(struct inode *inode, const struct inode *current){
+	//a new or freed inode takes its dates as they are
+	if(!(inode->i_mode & IALLOC) || !(current->i_mode & IALLOC)) return;
+	if(inode_gettime(current->i_atime) > inode_gettime(inode->i_atime)){
+		memcpy(inode->i_atime, current->i_atime, sizeof(inode->i_atime));
+	}
+	if(inode_gettime(current->i_mtime) > inode_gettime(inode->i_mtime)){
+		memcpy(inode->i_mtime, current->i_mtime, sizeof(inode->i_mtime));
+	}
+}
+
+/**
+ * @brief take the dirty sectors as a batch, between two operations, then write it:
+ *        in the journal if there is one, then in place; the sectors freed by the
+ *        operations of the batch are released last
+ * @param w the write-back
+ * @return 0 on success; 1 if sectors were left for another batch, the transaction being full;
+ *         <0 on error (the sectors which could not be written stay dirty)
+ */
+static int writeback_flush(struct writeback *w){
+	struct unix_filesystem *u = w->u;
+	pthread_mutex_lock(&w->lock);
+	//an operation in progress in the calling thread (if any) is part of the batch, and so are
+	//those of the threads which wait here as well: two of them must not wait for each other
+	uint32_t own = pthread_getspecific(w->depth) != NULL;
+	++w->pending;
+	w->inside += own;
+	while(w->nops > w->inside) pthread_cond_wait(&w->idle, &w->lock);
+	w->inside -= own;
+
+	//an operation which went past WRITEBACK_OP_SECTORS, or the timestamps, may leave more than a
+	//transaction holds: the others wait for the next batch, after this one is written in place
+	uint32_t n = w->ndirty;
+	size_t capacity = u->journal != NULL ? journal_capacity(u->journal) : n;
+	int left = n > capacity;
+	if(left) n = (uint32_t)capacity;
+	uint16_t *sectors = malloc((n + 1) * sizeof(uint16_t));
+	uint32_t *gens = malloc((n + 1) * sizeof(uint32_t));
+	uint8_t *data = malloc(((size_t)n + 1) * SECTOR_SIZE);
+	int *errs = malloc((n + 1) * sizeof(int));
+	if(sectors == NULL || gens == NULL || data == NULL || errs == NULL){
+		--w->pending;
+		pthread_cond_broadcast(&w->turn);
+		pthread_mutex_unlock(&w->lock);
+		free(sectors);
+		free(gens);
+		free(data);
+		free(errs);
+		return ERR_NOMEM;
+	}
+
+	//the copies are taken in the order of the disk, and can change meanwhile
+	uint32_t ticket = w->taken + 1;
+	qsort(w->dirty, w->ndirty, sizeof(uint16_t), writeback_cmp);
+	for(uint32_t i = 0; i < n; ++i){
+		struct writeback_sector *s = w->sectors[w->dirty[i]];
+		sectors[i] = w->dirty[i];
+		gens[i] = s->gen;
+		memcpy(data + (size_t)i * SECTOR_SIZE, s->data, SECTOR_SIZE);
+		s->dirty = 0;
+		s->batch = ticket;
+	}
+	w->ndirty -= n;
+	memmove(w->dirty, w->dirty + n, w->ndirty * sizeof(uint16_t));
+	//the sectors freed by the operations are released once all their changes are in the journal
+	struct writeback_list *freed = left ? NULL : w->freed;
+	size_t nfreed = left ? 0 : w->nfreed;
+	if(!left){
+		w->freed = NULL;
+		w->nfreed = 0;
+	}
+	w->taken = ticket;
+	--w->pending;
+	pthread_cond_broadcast(&w->turn);
+
+	//the batches reach the disk in the order they were taken; the readers use the copies meanwhile
+	while(w->written != ticket - 1) pthread_cond_wait(&w->turn, &w->lock);
+	pthread_mutex_unlock(&w->lock);
+
+	//in place without the lock: a sector of the batch cannot be freed and reused before it is written
+	int err = u->journal != NULL ? journal_commit(u->journal, n, sectors, data) : 0;
+	for(uint32_t i = 0; i < n; ++i){
+		errs[i] = err < 0 ? err : sector_write(u->f, sectors[i], data + (size_t)i * SECTOR_SIZE);
+		if(errs[i] < 0) err = errs[i];
+	}
+
+	pthread_mutex_lock(&w->lock);
+	for(uint32_t i = 0; i < n; ++i){
+		//a sector freed meanwhile has no copy any more, or a new one
+		struct writeback_sector *s = w->sectors[sectors[i]];
+		if(s == NULL || s->gen != gens[i]) continue;
+		if(errs[i] < 0){
+			writeback_mark(w, s, sectors[i]);//in the next batch
+		}else if(!s->dirty && !s->keep && s->batch == ticket){
+			writeback_drop(w, sectors[i]);//unless a later batch took it: it is read until written
+		}
+	}
+	if(err < 0 && freed != NULL){
+		//the batch may not be in the journal: its freed sectors wait for the next one
+		struct writeback_list *last = freed;
+		while(last->next != NULL) last = last->next;
+		last->next = w->freed;
+		w->freed = freed;
+		w->nfreed += nfreed;
+		freed = NULL;
+	}
+	for(struct writeback_list *l = freed; l != NULL; l = l->next){
+		for(size_t i = 0; i < l->n; ++i) writeback_drop(w, l->sectors[i]);
+	}
+	w->written = ticket;
+	pthread_cond_broadcast(&w->turn);
+	pthread_mutex_unlock(&w->lock);
+
+	while(freed != NULL){
+		struct writeback_list *next = freed->next;
+		(void)reclaim_sectors(u, freed->sectors, freed->n);
+		free(freed);
+		freed = next;
+	}
+	free(sectors);
+	free(gens);
+	free(data);
+	free(errs);
+	return err < 0 ? err : left;
+}
+
+/**
+ * @brief body of the thread: write the dirty sectors once the oldest is old
+ *        enough, or once enough of them are dirty; and the lazy changes once
+ *        the oldest is old enough
+ * @param arg the write-back
+ * @return NULL
+ */
+static void *writeback_run(void *arg){
+	struct writeback *w = arg;
+	pthread_mutex_lock(&w->lock);
+	while(!w->stop){
+		int expired = w->nlazy > 0 && time(NULL) >= w->lazy_since + WRITEBACK_LAZY_AGE;
+		if(expired) writeback_expire(w);
+		if(w->ndirty == 0 && w->freed == NULL){
+			struct timespec lazy_due = {w->lazy_since + WRITEBACK_LAZY_AGE, 0};
+			if(w->nlazy > 0) pthread_cond_timedwait(&w->work, &w->lock, &lazy_due);
+			else pthread_cond_wait(&w->work, &w->lock);
+			continue;
+		}
+		struct timespec due = {w->since + WRITEBACK_AGE, 0};
+		if(!expired && w->blocked == 0 && (w->ndirty + w->nfreed) * SECTOR_SIZE < WRITEBACK_DIRTY_BYTES
+		   && time(NULL) < due.tv_sec){
+			pthread_cond_timedwait(&w->work, &w->lock, &due);
+			continue;
+		}
+
+		pthread_mutex_unlock(&w->lock);
+		(void)writeback_flush(w);//the sectors which could not be written are tried again later
+		pthread_mutex_lock(&w->lock);
+	}
+	pthread_mutex_unlock(&w->lock);
+	return NULL;
+}
+
+/**
+ * @brief allocate the write-back of the metadata of a filesystem (its thread starts on first use)
+ * @param u the filesystem, whose superblock is read
+ * @return the write-back or NULL on failure
+ */
+struct writeback *writeback_alloc(struct unix_filesystem *u){
+	if(u == NULL) return NULL;
+	struct writeback *w = calloc(1, sizeof(struct writeback));
+	if(w == NULL) return NULL;
+	w->nsectors = u->s.s_fsize > u->s.s_block_start ? u->s.s_fsize : u->s.s_block_start;
+	w->sectors = calloc(w->nsectors + 1, sizeof(struct writeback_sector *));
+	w->dirty = calloc(w->nsectors + 1, sizeof(uint16_t));
+	if(w->sectors == NULL || w->dirty == NULL || pthread_key_create(&w->depth, NULL) != 0){
+		free(w->sectors);
+		free(w->dirty);
+		free(w);
+		return NULL;
+	}
+	w->u = u;
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_cond_init(&w->work, NULL);
+	pthread_cond_init(&w->idle, NULL);
+	pthread_cond_init(&w->turn, NULL);
+	return w;
+}
+
+/**
+ * @brief stop the thread and free the write-back (the dirty sectors are lost: see writeback_sync)
+ * @param w the write-back (may be NULL)
+ */
+void writeback_free(struct writeback *w){
+	if(w == NULL) return;
+	pthread_mutex_lock(&w->lock);
+	w->stop = 1;
+	pthread_cond_signal(&w->work);
+	pthread_mutex_unlock(&w->lock);
+	if(w->started) pthread_join(w->thread, NULL);
+
+	//the sectors freed since the last batch stay used until the next mount
+	while(w->freed != NULL){
+		struct writeback_list *next = w->freed->next;
+		free(w->freed->sectors);
+		free(w->freed);
+		w->freed = next;
+	}
+	for(uint32_t i = 0; i < w->nsectors; ++i) free(w->sectors[i]);
+	free(w->sectors);
+	free(w->dirty);
+	pthread_key_delete(w->depth);
+	pthread_cond_destroy(&w->turn);
+	pthread_cond_destroy(&w->idle);
+	pthread_cond_destroy(&w->work);
+	pthread_mutex_destroy(&w->lock);
+	free(w);
+}
+
+/**
+ * @brief start an operation whose changes must reach the disk together; operations may nest
+ *        in a thread, and wait while a batch is being taken
+ * @param u the filesystem
+ */
+void writeback_begin(struct unix_filesystem *u){
+	if(u == NULL || u->writeback == NULL) return;
+	struct writeback *w = u->writeback;
+	uintptr_t depth = (uintptr_t)pthread_getspecific(w->depth);
+	if(depth == 0){
+		pthread_mutex_lock(&w->lock);
+		//past WRITEBACK_MAX_DIRTY, or if the batch could outgrow its transaction, the thread takes it first
+		int full = w->started && writeback_full(w);
+		if(full){
+			++w->blocked;
+			pthread_cond_signal(&w->work);
+		}
+		while(w->pending > 0 || (full && writeback_full(w) && !w->stop)){
+			pthread_cond_wait(&w->turn, &w->lock);
+		}
+		if(full) --w->blocked;
+		++w->nops;
+		pthread_mutex_unlock(&w->lock);
+	}
+	pthread_setspecific(w->depth, (void *)(depth + 1));
+}
+
+/**
+ * @brief end the operation started by the matching writeback_begin
+ * @param u the filesystem
+ */
+void writeback_end(struct unix_filesystem *u){
+	if(u == NULL || u->writeback == NULL) return;
+	struct writeback *w = u->writeback;
+	uintptr_t depth = (uintptr_t)pthread_getspecific(w->depth);
+	if(depth == 0) return;
+	pthread_setspecific(w->depth, (void *)(depth - 1));
+	if(depth == 1){
+		pthread_mutex_lock(&w->lock);
+		--w->nops;
+		if(w->pending > 0) pthread_cond_broadcast(&w->idle);
+		if(w->blocked > 0) pthread_cond_broadcast(&w->turn);
+		pthread_mutex_unlock(&w->lock);
+	}
+}
+
+/**
+ * @brief write a copy in place at once, once any batch which took an older content of it
+ *        is written (the caller holds the lock)
+ * @param w the write-back
+ * @param s the copy
+ * @param sector its sector
+ * @return 0 on success; <0 on error (the copy is then dirty, for the next batch)
+ */
+static int writeback_write_now(struct writeback *w, struct writeback_sector *s, uint32_t sector){
+	while(s->batch > w->written) pthread_cond_wait(&w->turn, &w->lock);
+	int err = sector_write(w->u->f, sector, s->data);
+	if(err < 0){
+		writeback_mark(w, s, sector);
+	}else if(s->lazy){
+		//its timestamps are on the disk as well
+		s->lazy = 0;
+		--w->nlazy;
+	}
+	return err;
+}
+
+/**
+ * @brief change an inode in the copy of its sector, which becomes dirty if the filesystem
+ *        has a journal, and is written at once otherwise
+ * @param u the filesystem
+ * @param inr the inode number (in range)
+ * @param inode the new content of the inode
+ * @param later 1 to only change its dates for later ones; 0 to take them as they are
+ * @return 0 on success; <0 on error
+ */
+static int writeback_change(struct unix_filesystem *u, uint16_t inr, const struct inode *inode, int later){
+	M_REQUIRE_NON_NULL(u);
+	M_REQUIRE_NON_NULL(u->writeback);
+	M_REQUIRE_NON_NULL(inode);
+	struct writeback *w = u->writeback;
+	uint32_t sector = u->s.s_inode_start + inr / INODES_PER_SECTOR;
+	if(sector >= w->nsectors) return ERR_INODE_OUTOF_RANGE;
+
+	pthread_mutex_lock(&w->lock);
+	//the first change of a sector reads it: its other inodes are written back unchanged
+	struct writeback_sector *s;
+	int err = writeback_get(w, sector, 1, &s);
+	if(err == 0){
+		s->keep = 1;
+		struct inode *current = (struct inode *)s->data + inr % INODES_PER_SECTOR;
+		struct inode changed = *inode;
+		if(later) writeback_later(&changed, current);
+		*current = changed;
+		//without a journal, directory sectors are written at once (see writeback_write):
+		//the inodes their entries name must be on the disk before them
+		if(u->journal != NULL) writeback_mark(w, s, sector);
+		else err = writeback_write_now(w, s, sector);
+	}
+	pthread_mutex_unlock(&w->lock);
+	return err;
+}
+
+/**
+ * @brief change an inode in the copy of its sector, which becomes dirty if the filesystem
+ *        has a journal, and is written at once otherwise; its dates are only changed for
+ *        later ones
+ * @param u the filesystem
+ * @param inr the inode number (in range)
+ * @param inode the new content of the inode
+ * @return 0 on success; <0 on error
+ */
+int writeback_inode(struct unix_filesystem *u, uint16_t inr, const struct inode *inode){
+	return writeback_change(u, inr, inode, 1);
+}
+
+/**
+ * @brief change an inode as writeback_inode does, with its dates as given, earlier ones
+ *        included (they were set on purpose)
+ * @param u the filesystem
+ * @param inr the inode number (in range)
+ * @param inode the new content of the inode
+ * @return 0 on success; <0 on error
+ */
+int writeback_settimes(struct unix_filesystem *u, uint16_t inr, const struct inode *inode){
+	return writeback_change(u, inr, inode, 0);
+}
+
+/**
+ * @brief change the timestamps of an inode in the copy of its sector, which is written
+ *        later (lazily) if nothing else makes it dirty
+ * @param u the filesystem
+ * @param inr the inode number (in range)
+ * @param inode the new content of the inode, which differs by its timestamps only
+ *        (later ones only are kept, as with writeback_inode)
+ * @return 0 on success; <0 on error
+ */
+int writeback_touch(struct unix_filesystem *u, uint16_t inr, const struct inode *inode){
+	M_REQUIRE_NON_NULL(u);
+	M_REQUIRE_NON_NULL(u->writeback);
+	M_REQUIRE_NON_NULL(inode);
+	struct writeback *w = u->writeback;
+	uint32_t sector = u->s.s_inode_start + inr / INODES_PER_SECTOR;
+	if(sector >= w->nsectors) return ERR_INODE_OUTOF_RANGE;
+
+	pthread_mutex_lock(&w->lock);
+	struct writeback_sector *s;
+	int err = writeback_get(w, sector, 1, &s);
+	if(err == 0){
+		s->keep = 1;
+		struct inode *current = (struct inode *)s->data + inr % INODES_PER_SECTOR;
+		struct inode changed = *inode;
+		writeback_later(&changed, current);
+		*current = changed;
+		//a dirty sector goes with the next batch anyway
+		if(!s->dirty && !s->lazy){
+			s->lazy = 1;
+			if(w->nlazy++ == 0){
+				w->lazy_since = time(NULL);
+				//the thread waits for the first one to be old enough
+				if(!w->started && !w->stop) w->started = pthread_create(&w->thread, NULL, writeback_run, w) == 0;
+				pthread_cond_signal(&w->work);
+			}
+		}
+	}
+	pthread_mutex_unlock(&w->lock);
+	return err;
+}
+
+/**
+ * @brief bring the dates of an inode up to those in the copy of its sector, if they are later
+ * @param u the filesystem
+ * @param inr the inode number (in range)
+ * @param inode the inode, whose dates may change (IN/OUT)
+ * @return 0 on success; <0 on error
+ */
+int writeback_dates(const struct unix_filesystem *u, uint16_t inr, struct inode *inode){
+	M_REQUIRE_NON_NULL(u);
+	M_REQUIRE_NON_NULL(u->writeback);
+	M_REQUIRE_NON_NULL(inode);
+	struct writeback *w = u->writeback;
+	uint32_t sector = u->s.s_inode_start + inr / INODES_PER_SECTOR;
+	if(sector >= w->nsectors) return ERR_INODE_OUTOF_RANGE;
+
+	//without a copy, the sector on the disk has not changed since the inode was read
+	pthread_mutex_lock(&w->lock);
+	const struct writeback_sector *s = w->sectors[sector];
+	if(s != NULL) writeback_later(inode, (const struct inode *)s->data + inr % INODES_PER_SECTOR);
+	pthread_mutex_unlock(&w->lock);
+	return 0;
+}
+
+/**
+ * @brief write a sector of metadata (of a directory, or an indirection sector):
+ *        a copy of it becomes dirty if the filesystem has a journal, it is written at once otherwise
+ * @param u the filesystem
+ * @param sector the sector
+ * @param data SECTOR_SIZE bytes (IN)
+ * @return 0 on success; <0 on error
+ */
+int writeback_write(struct unix_filesystem *u, uint32_t sector, const void *data){
+	M_REQUIRE_NON_NULL(u);
+	M_REQUIRE_NON_NULL(data);
+	struct writeback *w = u->writeback;
+	if(w == NULL || u->journal == NULL || sector >= w->nsectors) return sector_write(u->f, sector, (void *)data);
+
+	pthread_mutex_lock(&w->lock);
+	struct writeback_sector *s;
+	int err = writeback_get(w, sector, 0, &s);
+	if(err == 0){
+		memcpy(s->data, data, SECTOR_SIZE);
+		writeback_mark(w, s, sector);
+	}
+	pthread_mutex_unlock(&w->lock);
+	return err;
+}
+
+/**
+ * @brief read a sector, from its copy in memory if there is one
+ * @param u the filesystem
+ * @param sector the sector
+ * @param data SECTOR_SIZE bytes (OUT)
+ * @return 0 on success; <0 on error
+ */
+int writeback_read(const struct unix_filesystem *u, uint32_t sector, void *data){
+	M_REQUIRE_NON_NULL(u);
+	M_REQUIRE_NON_NULL(data);
+	struct writeback *w = u->writeback;
+	if(w != NULL && sector < w->nsectors){
+		pthread_mutex_lock(&w->lock);
+		const struct writeback_sector *s = w->sectors[sector];
+		if(s != NULL) memcpy(data, s->data, SECTOR_SIZE);
+		pthread_mutex_unlock(&w->lock);
+		if(s != NULL) return 0;
+	}
+	return sector_read(u->f, sector, data);
+}
+
+/**
+ * @brief release freed sectors: once the batch of the operation which freed them
+ *        is in the journal, or at once if the filesystem has none (see reclaim_sectors)
+ * @param u the filesystem
+ * @param sectors the sectors, allocated with malloc; freed by the write-back
+ * @param n the number of sectors (0 are ignored)
+ * @return 0 on success; <0 on error (the sectors then stay used until the next mount)
+ */
+int writeback_release(struct unix_filesystem *u, uint16_t *sectors, size_t n){
+	M_REQUIRE_NON_NULL(u);
+	struct writeback *w = u->writeback;
+	if(w == NULL || u->journal == NULL) return reclaim_sectors(u, sectors, n);
+
+	//until then, the inodes on the disk may still point to them
+	struct writeback_list *l = malloc(sizeof(struct writeback_list));
+	if(l == NULL){
+		free(sectors);
+		return ERR_NOMEM;
+	}
+	l->sectors = sectors;
+	l->n = n;
+	pthread_mutex_lock(&w->lock);
+	l->next = w->freed;
+	w->freed = l;
+	size_t before = w->nfreed;
+	w->nfreed += n;
+	if((w->ndirty + before) * SECTOR_SIZE < WRITEBACK_DIRTY_BYTES && (w->ndirty + w->nfreed) * SECTOR_SIZE >= WRITEBACK_DIRTY_BYTES)
+		pthread_cond_signal(&w->work);
+	pthread_mutex_unlock(&w->lock);
+	return 0;
+}
+
+/**
+ * @brief write a batch now if sectors freed by earlier operations wait for one, and release them,
+ *        e.g. when the disk is full (the operation in progress in the calling thread joins the batch)
+ * @param u the filesystem
+ * @return 1 if sectors were released; 0 if none waited; <0 on error
+ */
+int writeback_release_now(struct unix_filesystem *u){
+	M_REQUIRE_NON_NULL(u);
+	struct writeback *w = u->writeback;
+	if(w == NULL) return 0;
+	pthread_mutex_lock(&w->lock);
+	int waiting = w->freed != NULL;
+	pthread_mutex_unlock(&w->lock);
+	if(!waiting) return 0;
+	
+	int err;
+	do err = writeback_flush(w); while(err > 0);
+	if(err < 0) return err;
+	//long lists are released by the reclaimer
+	reclaim_wait(u);
+	return 1;
+}
+
+/**
+ * @brief write all the dirty sectors now, and the timestamps waiting to be written
+ * @param u the filesystem
+ * @return 0 on success; <0 on error (the sectors which could not be written stay dirty)
+ */
+int writeback_sync(struct unix_filesystem *u){
+	M_REQUIRE_NON_NULL(u);
+	struct writeback *w = u->writeback;
+	if(w == NULL) return 0;
+	int err;
+	do{
+		pthread_mutex_lock(&w->lock);
+		writeback_expire(w);
+		pthread_mutex_unlock(&w->lock);
+		err = writeback_flush(w);
+	}while(err > 0);
+	return err;
+}
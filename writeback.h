@@ -0,0 +1,167 @@
+#pragma once
+
+/**
+ * @file writeback.h
+ * @brief delayed write-back of the metadata
+ *
+ * On a filesystem with a journal (see journal.h), inode_write no longer writes
+ * its sector: the change goes to a copy of the sector kept in memory, which
+ * becomes dirty. The sectors of the directories and the indirection sectors
+ * wait in memory the same way (writeback_write). Without a journal, all of
+ * them are written at once, the inode table included (its copy in memory is
+ * still updated): a crash must not leave a directory entry on the disk
+ * without the inode it names.
+ *
+ * The dirty sectors are written as one batch (each once, whatever the number
+ * of changes it got) by a background thread, started on first use, as soon as
+ * the oldest change is WRITEBACK_AGE seconds old or WRITEBACK_DIRTY_BYTES are
+ * dirty; or at once by writeback_sync, which umountv6 calls. Until then, the
+ * readers of the metadata see the copies (writeback_read).
+ *
+ * A batch is only taken between operations: the changes an operation makes
+ * between writeback_begin and writeback_end all go to the same batch, which
+ * the journal writes as one transaction before the sectors are written in
+ * place. A transaction has room for journal_capacity sectors: an operation
+ * also waits before it begins while the operations in progress could fill it.
+ * The sectors an operation frees (writeback_release) are released once its
+ * batch is in the journal; they count as dirty for the thresholds.
+ *
+ * Timestamps are written lazily (writeback_touch): they change the copy of
+ * the sector without making it dirty, so they reach the disk with the next
+ * batch which writes the sector for another reason, once the oldest of them
+ * is WRITEBACK_LAZY_AGE seconds old, or at writeback_sync.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "unixv6fs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define WRITEBACK_AGE 5                            /* seconds a change may wait in memory */
+#define WRITEBACK_DIRTY_BYTES (64 * SECTOR_SIZE)   /* dirty bytes written without waiting */
+#define WRITEBACK_MAX_DIRTY (2 * WRITEBACK_DIRTY_BYTES / SECTOR_SIZE) /* dirty sectors past which
+                                                                       * operations wait for a batch */
+#define WRITEBACK_OP_SECTORS 16                    /* sectors an operation may make dirty, kept free
+                                                    * for it in the batch when it begins */
+#define WRITEBACK_LAZY_AGE 60                      /* seconds a change of timestamps may wait in memory */
+
+struct unix_filesystem;
+struct writeback;
+
+/**
+ * @brief allocate the write-back of the metadata of a filesystem (its thread starts on first use)
+ * @param u the filesystem, whose superblock is read
+ * @return the write-back or NULL on failure
+ */
+struct writeback *writeback_alloc(struct unix_filesystem *u);
+
+/**
+ * @brief stop the thread and free the write-back (the dirty sectors are lost: see writeback_sync)
+ * @param w the write-back (may be NULL)
+ */
+void writeback_free(struct writeback *w);
+
+/**
+ * @brief start an operation whose changes must reach the disk together; operations may nest
+ *        in a thread, and wait while a batch is being taken
+ * @param u the filesystem
+ */
+void writeback_begin(struct unix_filesystem *u);
+
+/**
+ * @brief end the operation started by the matching writeback_begin
+ * @param u the filesystem
+ */
+void writeback_end(struct unix_filesystem *u);
+
+/**
+ * @brief change an inode in the copy of its sector, which becomes dirty if the filesystem
+ *        has a journal, and is written at once otherwise; its dates are only changed for
+ *        later ones
+ * @param u the filesystem
+ * @param inr the inode number (in range)
+ * @param inode the new content of the inode
+ * @return 0 on success; <0 on error
+ */
+int writeback_inode(struct unix_filesystem *u, uint16_t inr, const struct inode *inode);
+
+/**
+ * @brief change an inode as writeback_inode does, with its dates as given, earlier ones
+ *        included (they were set on purpose)
+ * @param u the filesystem
+ * @param inr the inode number (in range)
+ * @param inode the new content of the inode
+ * @return 0 on success; <0 on error
+ */
+int writeback_settimes(struct unix_filesystem *u, uint16_t inr, const struct inode *inode);
+
+/**
+ * @brief change the timestamps of an inode in the copy of its sector, which is written
+ *        later (lazily) if nothing else makes it dirty
+ * @param u the filesystem
+ * @param inr the inode number (in range)
+ * @param inode the new content of the inode, which differs by its timestamps only
+ *        (later ones only are kept, as with writeback_inode)
+ * @return 0 on success; <0 on error
+ */
+int writeback_touch(struct unix_filesystem *u, uint16_t inr, const struct inode *inode);
+
+/**
+ * @brief bring the dates of an inode up to those in the copy of its sector, if they are later
+ * @param u the filesystem
+ * @param inr the inode number (in range)
+ * @param inode the inode, whose dates may change (IN/OUT)
+ * @return 0 on success; <0 on error
+ */
+int writeback_dates(const struct unix_filesystem *u, uint16_t inr, struct inode *inode);
+
+/**
+ * @brief write a sector of metadata (of a directory, or an indirection sector):
+ *        a copy of it becomes dirty if the filesystem has a journal, it is written at once otherwise
+ * @param u the filesystem
+ * @param sector the sector
+ * @param data SECTOR_SIZE bytes (IN)
+ * @return 0 on success; <0 on error
+ */
+int writeback_write(struct unix_filesystem *u, uint32_t sector, const void *data);
+
+/**
+ * @brief read a sector, from its copy in memory if there is one
+ * @param u the filesystem
+ * @param sector the sector
+ * @param data SECTOR_SIZE bytes (OUT)
+ * @return 0 on success; <0 on error
+ */
+int writeback_read(const struct unix_filesystem *u, uint32_t sector, void *data);
+
+/**
+ * @brief release freed sectors: once the batch of the operation which freed them
+ *        is in the journal, or at once if the filesystem has none (see reclaim_sectors)
+ * @param u the filesystem
+ * @param sectors the sectors, allocated with malloc; freed by the write-back
+ * @param n the number of sectors (0 are ignored)
+ * @return 0 on success; <0 on error (the sectors then stay used until the next mount)
+ */
+int writeback_release(struct unix_filesystem *u, uint16_t *sectors, size_t n);
+
+/**
+ * @brief write a batch now if sectors freed by earlier operations wait for one, and release them,
+ *        e.g. when the disk is full (the operation in progress in the calling thread joins the batch)
+ * @param u the filesystem
+ * @return 1 if sectors were released; 0 if none waited; <0 on error
+ */
+int writeback_release_now(struct unix_filesystem *u);
+
+/**
+ * @brief write all the dirty sectors now, and the timestamps waiting to be written
+ * @param u the filesystem
+ * @return 0 on success; <0 on error (the sectors which could not be written stay dirty)
+ */
+int writeback_sync(struct unix_filesystem *u);
+
+#ifdef __cplusplus
+}
+#endif